@@ -46,690 +46,9328 @@ extern int errno; // preprocessor macro which is threadsafe
 
 
 
-// IOSTREAM ERROR HANDLING
+// ERRNO ERROR HANDLING - 2 | MEMORY MAPPED RECORD FILE
 
-void f()
-{
-std::ifstream file("input.txt");
-if ( ! file ) /* before C++11: void*, since C++11: bool */
-{
-std::cerr << "file opening failed\n";
-return;
-}
-for( int n; file >> n; ) /* while ( ! cin.fail() ) */
-{
-std::cout << n << '\n';
-}
-if ( file.bad() )
-{
-std::cerr << "i/o error while reading\n";
-}
-else if ( file.eof() )
-{
-std::cerr << "eof reached\n";
-}
-else if ( file.fail() )
+#include <cerrno>
+#include <cstddef>
+#include <cstring> // std::strerror
+#include <span>
+#include <type_traits>
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, madvise
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+
+enum record_error { rec_ok = 0, rec_cant_open = 1, rec_cant_find = 2, rec_cant_read = 3 }; // same codes as myerrno
+
+template <class Record>
+class RecordFile
 {
-std::cerr << "non-integer\n";
-}
-}
+    static_assert(std::is_trivially_copyable<Record>::value, "records are used straight from the file bytes");
 
-/*
-iostream has different flags for error handling. For example, if we want to see that we reached the end of a file
-we can use the flag eof() to see if it happened or not.
-The iostream error handling mostly relies on stream state flags, and optionally, exceptions.
-It can be used for files management, but we can also use it to check for example the if the user input matches
-what we expect in our code.
+public:
+    explicit RecordFile(const char* fname)
+    {
+        int fd = ::open(fname, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) < 0)
+        {
+            fail(rec_cant_open, errno);
+            if (fd >= 0)
+                ::close(fd);
+            return;
+        }
+        len = static_cast<std::size_t>(st.st_size);
+        if (len > 0)
+        {
+            void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                fail(rec_cant_open, errno);
+                len = 0;
+            }
+            else
+            {
+                base = static_cast<const char*>(p);
+            }
+        }
+        ::close(fd); // the mapping keeps the file alive
+        count = len / sizeof(Record);
+    }
 
-In our code detecting eof(), fail() bits is harder that is why it is possible that a programmer reads a file in and then
-when they know the actual size of the file they try to rewrite it, but because of the eof() bit it won't happen since the
-file is in a stage of having possible bugs. Hence it is not safe to rewrite it, so the compiler terminates.
-*/
+    RecordFile(const RecordFile&) = delete;
+    RecordFile& operator=(const RecordFile&) = delete;
 
+    RecordFile(RecordFile&& rhs) noexcept
+        : base(rhs.base), len(rhs.len), count(rhs.count), err(rhs.err), sys_errno(rhs.sys_errno)
+    {
+        rhs.base = nullptr;
+        rhs.len = rhs.count = 0;
+    }
 
+    ~RecordFile()
+    {
+        if (base)
+            ::munmap(const_cast<char*>(base), len);
+    }
 
-// ASSERT ERROR HANDLING
+    bool is_open() const noexcept { return err != rec_cant_open; }
+    std::size_t size() const noexcept { return count; }
 
-#include <cassert> /* assert.h in C */
-void open_file(std::string fname)
-{
-assert(fname.length() > 0);
-std::ifstream f(fname.c_str());
-. . .
-}
+    record_error error() const noexcept { return err; }
+    const char* reason() const noexcept { return std::strerror(sys_errno); } // like perror() for rec_cant_open
+    int sys_error() const noexcept { return sys_errno; } // the errno itself
+    void clear_error() noexcept { if (is_open()) err = rec_ok; }
 
-/*
-Checking errors with assert we can set logical condition(s) in our code. The problem is that with assert we can give error messages
-and our program just terminates. Imagine if it happens in a Boeing airplane. The program just terminates, but does not try to recover
-in any way that would lead to crash of the plane.
+    // tell the kernel how we are going to read, so read-ahead fits the access pattern
+    void advise_random() const noexcept { if (base) ::madvise(const_cast<char*>(base), len, MADV_RANDOM); }
+    void advise_sequential() const noexcept { if (base) ::madvise(const_cast<char*>(base), len, MADV_SEQUENTIAL); }
 
-If we are in the development phase of a project then doing assert can be a good option, but we have to replace it to assertions when we
-want to release or product.
+    // record n, or nullptr: rec_cant_find past the end, rec_cant_read for the truncated last record
+    const Record* get(std::size_t n) noexcept
+    {
+        if (n < count)
+            return at(n);
+        fail(n == count && len % sizeof(Record) != 0 ? rec_cant_read : rec_cant_find);
+        return nullptr;
+    }
 
-Assert does the checking in runtime. THI IS AN IMPORTANT NOTE! Good for checking for nullptr, for example.
-*/
+    // n records from first, zero copy; an empty span and the error if the range is not in the file
+    std::span<const Record> records(std::size_t first, std::size_t n) noexcept
+    {
+        if (first > count || n > count - first)
+        {
+            fail(first + n == count + 1 && len % sizeof(Record) != 0 ? rec_cant_read : rec_cant_find);
+            return { };
+        }
+        return { at(first), n };
+    }
 
+    std::span<const Record> records() noexcept { return records(0, count); }
 
+    // out[i] = &record(idx[i]); returns the number of records done, stops at the first bad index
+    std::size_t gather(std::span<const std::size_t> idx, const Record** out) noexcept
+    {
+        constexpr std::size_t ahead = 8;
+        for (std::size_t i = 0; i < idx.size() && i < ahead; ++i)
+            if (idx[i] < count)
+                __builtin_prefetch(at(idx[i]));
+        for (std::size_t i = 0; i < idx.size(); ++i)
+        {
+            if (i + ahead < idx.size() && idx[i + ahead] < count)
+                __builtin_prefetch(at(idx[i + ahead]));
+            if (!(out[i] = get(idx[i])))
+                return i;
+        }
+        return idx.size();
+    }
 
-// STATIC ASSERT ERROR HANDLING
+private:
+    const Record* at(std::size_t n) const noexcept
+    {
+        return reinterpret_cast<const Record*>(base + n * sizeof(Record));
+    }
 
-#include <type_traits>
-template <typename T>
+    void fail(record_error e, int sys = 0) noexcept
+    {
+        if (err == rec_cant_open)   // a file that could not be opened stays that way, get() must not hide it
+            return;
+        err = e;
+        sys_errno = sys;
+    }
 
-void swap(T &x, T &y)
+    const char* base = nullptr;
+    std::size_t len = 0;
+    std::size_t count = 0;
+    record_error err = rec_ok;
+    int sys_errno = 0;
+};
+
+// the f() from above with the same three messages, without a syscall per record
+
+struct record { long id; double value[7]; };
+
+int g(RecordFile<record>& file, std::size_t n)
 {
-static_assert( std::is_nothrow_move_constructible<T>::value, &&
-std::is_nothrow_move_assignable<T>::value, "Swap may throw" );
-auto tmp = x;
-x = y;
-y = tmp;
+    const record* r = file.get(n);
+    if (r)      /* the error is sticky, it may be from an earlier get(): only a failed get() looks at it */
+    {
+        return r->id > 0;
+    }
+    if (!file.is_open())
+    {
+        std::fprintf( stderr, "can't open file %s\n", "fname");
+        std::fprintf( stderr, "reason: %s\n", file.reason());
+    }
+    else if (file.error() == rec_cant_find)
+    {
+        std::fprintf( stderr, "can't find record %zu\n", n);
+    }
+    else
+    {
+        std::fprintf( stderr, "can't read record\n");
+    }
+    myerrno = file.error();
+    return -1;
 }
 
-#if __STDC_HOSTED__ != 1
-# error "Not a hosted implementation"
-#endif
+// Basic example of a benchmark: fseek/fread against the mapping (usage: bench file size_in_GB)
 
-#if __cplusplus >= 202302L
-# warning "Using #warning as a standard feature"
-#endif
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+template <class F>
+long long ms(F f)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fname = argc > 1 ? argv[1] : "records.bin";
+    double gb = argc > 2 ? std::atof(argv[2]) : 2.0;
+    std::size_t n = static_cast<std::size_t>(gb * (1ull << 30)) / sizeof(record);
+
+    if (std::FILE* out = std::fopen(fname, "wb"))
+    {
+        record r { };
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            r.id = static_cast<long>(i);
+            std::fwrite(&r, sizeof(r), 1, out);
+        }
+        std::fclose(out);
+    }
+
+    std::mt19937_64 rng(42);
+    std::vector<std::size_t> idx(2'000'000);
+    for (auto& i : idx)
+        i = rng() % n;
+
+    long sum1 = 0, sum2 = 0, sum3 = 0, sum4 = 0;
+    std::FILE* fp = std::fopen(fname, "rb");
+    record rec;
+    long long t_fread_rand = ms([&] {
+        for (std::size_t i : idx)
+            if (0 == std::fseek(fp, static_cast<long>(i * sizeof(rec)), SEEK_SET) && 1 == std::fread(&rec, sizeof(rec), 1, fp))
+                sum1 += rec.id;
+    });
+    std::rewind(fp);
+    long long t_fread_seq = ms([&] {
+        while (1 == std::fread(&rec, sizeof(rec), 1, fp))
+            sum2 += rec.id;
+    });
+    std::fclose(fp);
+
+    RecordFile<record> file(fname);
+    std::vector<const record*> out(idx.size());
+    file.advise_random();
+    long long t_map_rand = ms([&] {
+        std::size_t done = file.gather(idx, out.data());
+        for (std::size_t i = 0; i < done; ++i)
+            sum3 += out[i]->id;
+    });
+    file.advise_sequential();
+    long long t_map_seq = ms([&] {
+        for (const record& r : file.records())
+            sum4 += r.id;
+    });
+
+    std::printf("%zu records, 2M random reads: fseek/fread %lld ms, mapped gather %lld ms\n", n, t_fread_rand, t_map_rand);
+    std::printf("sequential scan: fread %lld ms, mapped span %lld ms\n", t_fread_seq, t_map_seq);
+    if (sum1 != sum3 || sum2 != sum4)   // the sums also keep the reads from being optimized away
+        std::printf("the two versions read different records: %ld / %ld, %ld / %ld\n", sum1, sum3, sum2, sum4);
+}
 
 /*
-Since C++ 11 we have static assert. The key difference between static assert and assert is that static assert does the checking in
-compilation time instead of runtime. In some cases stopping the code at compilation time instead of runtime can be more beneficial. That
-is the reason behind using static assert in some cases.
+In the errno example every record costs an fseek() and an fread(). With stdio buffering the fseek() throws away the buffer, so a random
+read is at least one read() syscall and a copy from the kernel into the FILE buffer and then into rec. RecordFile maps the whole file once
+with mmap(), so a record is just base + n * sizeof(record): get() returns a const reference (pointer) into the mapping, records() returns
+a std::span without any copy, and gather() resolves a whole list of indexes at once (prefetching the next ones, so the page faults and cache
+misses overlap). madvise() tells the kernel if we read randomly (no useless read-ahead) or sequentially (aggressive read-ahead).
 
-Static assert takes parameters -as seen in the code above-, but these paramaters only can be parameters that are known in compilation time.
+The three failure cases are kept, with the same codes as myerrno:
+    rec_cant_open (1): open(), fstat() or mmap() failed, reason() gives strerror(errno) like in the original
+    rec_cant_find (2): the index is past the end of the file (the original used fseek for this)
+    rec_cant_read (3): the index is the last, truncated record of the file, which fread() could not read fully
+The errors are sticky like the errno / iostream flags, so a loop can check error() once after a batch, clear_error() resets it.
+
+The output on my machine for a 1 GB file (it fit into the page cache, with a file bigger than the memory both versions wait for the disk,
+but the mapped one still saves the syscalls and the copies):
+
+    16777216 records, 2M random reads: fseek/fread 3645 ms, mapped gather 109 ms
+    sequential scan: fread 810 ms, mapped span 113 ms
+
+The records must be trivially copyable, because we use the bytes of the file as objects. This is the same assumption fread() made.
 */
 
 
 
-// EXCEPTION HANDLING WITH SETJMP/LONGJMP IN C
+// ERRNO ERROR HANDLING - 3 | VARIABLE LENGTH RECORDS: AN INDEX, CHECKSUMS AND BATCHED WRITES
 
-// ONE C SOURCE FILE
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>    // std::aligned_alloc
+#include <cstring>    // std::strerror, std::memcpy
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, madvise
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // pwrite, fdatasync, close
+
+// The format: two files, name and name.idx. Every write to name is a multiple of vrec_page at an offset that is a multiple of it
+//     name:     vrec_header, padded to a page, then blocks. A block is a vrec_block and the records of it, one after the
+//               other, padded to whole pages. A record never crosses a block, a record bigger than a block gets a block of its own
+//     name.idx: vrec_index_header, then a vrec_entry for every record, so record n is found with one multiplication
+
+constexpr std::size_t vrec_page = 4096;
+constexpr std::uint32_t vrec_block_magic = 0x4B4C4256;  // "VBLK"
+
+struct vrec_header
+{
+    char magic[8];          // "VRECDAT1"
+    std::uint32_t page;
+    std::uint32_t reserved;
+};
 
-#include <setjmp.h>
-#include <stdio.h>
-jmp_buf x;
-int main()
+struct vrec_block
 {
-int i = 0;
-if ( (i = setjmp(x)) == 0 ) // try
+    std::uint32_t magic;
+    std::uint32_t crc;      // CRC-32C of the bytes after this header
+    std::uint32_t bytes;
+    std::uint32_t records;
+};
+
+struct vrec_index_header
 {
-f();
-}
-else // catch
+    char magic[8];          // "VRECIDX1"
+    std::uint32_t entry_size;
+    std::uint32_t reserved;
+};
+
+struct vrec_entry
 {
-switch( i )
+    std::uint64_t offset;   // of the record in the data file
+    std::uint32_t length;
+    std::uint32_t block;    // the page number of its block
+};
+
+// CRC-32C (Castagnoli): the crc32 instruction of SSE 4.2 when the CPU has it, a table otherwise
+inline std::uint32_t crc32c_table(std::uint32_t crc, const unsigned char* p, std::size_t n) noexcept
 {
-case 1: handler1(); break;
-case 2: handler2(); break;
-default: fprintf( stdout, "error code = %d\n", i); break;
-}
-}
-return 0;
+    static const std::array<std::uint32_t, 256> table = [] {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    while (n--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
 }
 
-// ANOTHER C SOURCE FILE
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline std::uint32_t crc32c_sse42(std::uint32_t crc, const unsigned char* p, std::size_t n) noexcept
+{
+    std::uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        std::uint64_t w;
+        std::memcpy(&w, p, 8);
+        c = __builtin_ia32_crc32di(c, w);
+    }
+    crc = static_cast<std::uint32_t>(c);
+    for (; n; --n)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
 
-// perhaps in another source file
-#include <setjmp.h>
-extern jmp_buf x;
-void f()
+inline std::uint32_t crc32c(const void* data, std::size_t n) noexcept
 {
-    // ...
-    g();
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+#if defined(__x86_64__)
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (sse42)
+        return ~crc32c_sse42(~0u, p, n);
+#endif
+    return ~crc32c_table(~0u, p, n);
 }
-void g()
+
+struct record_writer_options
 {
-if ( something_wrong() )
+    std::size_t block_size = 64 * 1024;     // both are rounded up to whole pages, and the batch to at least one block
+    std::size_t batch_size = 1024 * 1024;
+    unsigned sync_every = 0;
+};
+
+// Appends records to a new file. The records are copied into blocks of a batch buffer, and a full batch goes to the data file with
+// one pwrite() and then its index entries to the index file with another one. fdatasync() comes after every sync_every batches
+// (0: only in sync() and close()), so one sync pays for many records. The errors are sticky like the ones of RecordFile: after a
+// failed write append() returns false, and sys_error() / reason() say why
+class RecordWriter
 {
-longjmp(x,2); // throw
-}
-}
+public:
+    using options = record_writer_options;
 
-/*
-Exception handling is an important part of developing softwares. It gives us the chance to store and cetegories bugs and also
-understand when a bug happens and why did it happen.
+    explicit RecordWriter(const std::string& fname, options o = { })
+        : opt(checked(o)), buf(static_cast<char*>(std::aligned_alloc(vrec_page, opt.batch_size)), std::free)
+    {
+        data_fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        index_fd = ::open((fname + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (!buf || data_fd < 0 || index_fd < 0)
+        {
+            fail(buf ? errno : ENOMEM);
+            return;
+        }
+        std::memset(buf.get(), 0, vrec_page);
+        vrec_header h = { { 'V', 'R', 'E', 'C', 'D', 'A', 'T', '1' }, vrec_page, 0 };
+        std::memcpy(buf.get(), &h, sizeof(h));
+        used = vrec_page;   // the header goes out with the first batch
+        vrec_index_header ih = { { 'V', 'R', 'E', 'C', 'I', 'D', 'X', '1' }, sizeof(vrec_entry), 0 };
+        if (!write_all(index_fd, &ih, sizeof(ih), 0))
+            return;
+        index_end = sizeof(ih);
+    }
 
-In the C standard library there were setjmp/longjmp macros that are used by creating a jump buffer variable and when the control flow started
-we called the setjmp macro and gave the already created variable to it as a parameter. This macro is basically represented the current state of the
-program. The variable was basically the definition of the stack heap.
+    RecordWriter(const RecordWriter&) = delete;
+    RecordWriter& operator=(const RecordWriter&) = delete;
 
-The setjmp/longjmp pair was used frequently in C programs. For example, in parser codes it was a good way to handle exceptions.
-The longjmp has it's name because it not only can do "go to" in the source file, but between source files as well.
-*/
+    ~RecordWriter() { close(); }   // an error of the last writes is lost here, call close() if it matters
 
+    bool good() const noexcept { return sys_errno == 0; }
+    int sys_error() const noexcept { return sys_errno; }
+    const char* reason() const noexcept { return std::strerror(sys_errno); }
 
+    std::size_t size() const noexcept { return count; }    // records appended
 
-// EXCEPTIONS IN C++
+    // the record gets the index size() - 1; false if a write failed (now or before)
+    bool append(std::string_view r)
+    {
+        if (!good())
+            return false;
+        if (sizeof(vrec_block) + r.size() > opt.block_size)
+            return append_large(r);
+        if (in_block && block_bytes + sizeof(vrec_block) + r.size() > opt.block_size)
+            seal();
+        if (!in_block)
+        {
+            if (used + opt.block_size > opt.batch_size && !write_batch())
+                return false;
+            block = used;
+            block_bytes = 0;
+            block_records = 0;
+            in_block = true;
+        }
+        std::size_t at = block + sizeof(vrec_block) + block_bytes;
+        std::memcpy(buf.get() + at, r.data(), r.size());
+        entries.push_back({ data_end + at, static_cast<std::uint32_t>(r.size()),
+                            static_cast<std::uint32_t>((data_end + block) / vrec_page) });
+        block_bytes += r.size();
+        ++block_records;
+        ++count;
+        return true;
+    }
 
-try // dangerous area
-{
-    f(); // someth
-}
-catch (T1 e1) { /* handler for T1 */ }
-catch (T2 e2) { /* handler for T2 */ }
-catch (T3 e3) { /* handler for T3 */ }
-void f()
-{
-    //...
-    T e;
-    throw e; /* throws exception of type T */
-    // or:
-    throw T(); /* throws default value of T */
-}
+    // writes out the open block and the batch, the block is closed even if it is not full
+    bool flush() { return good() && write_batch(); }
 
-/*
-When we throw an exception in C++ than that object will be copied into a static memory space. Static, const variables will be copied as well
-into a static memory space. This is crucial because in the code above if we throw an exception without this mechanic the first object that would
-be thrown is e1, so the program would crash. Copying object to a static memory space is the key when we are doing exceptions handling in C++.
+    // flush() and fdatasync() of both files: everything appended so far survives a crash. Before that the kernel may write the
+    // pages of the index before the ones of the data, the checksums show such records as rec_cant_read
+    bool sync() { return good() && write_batch(false) && sync_files(); }
 
-Since we have the move semantic (C++11) they would be moved. This is a better and more efficient approach.
+    unsigned long sync_count() const noexcept { return syncs; }
 
-The key is that we don't catch the object e, but it's copied version that is stored in the static memory space. If we cannot move or copy an object
-then we cannot throw that object as an exception.
+    bool close()
+    {
+        if (data_fd < 0 && index_fd < 0)
+            return good();
+        bool ok = good() && sync();
+        for (int* fd : { &data_fd, &index_fd })
+        {
+            if (*fd >= 0 && ::close(*fd) != 0 && ok)
+                ok = fail(errno);
+            *fd = -1;
+        }
+        return ok && good();
+    }
 
-The interesting part is that since e has a copy in the static memory space (so there is two of it) hence the e1 at the catch period also has a copy on
-the static memory space. This can lead to more memory overhead, but we can call e1 by a reference and that reference would refer to the object located
-in the static memory space.
-*/
+private:
+    bool fail(int e) noexcept
+    {
+        if (sys_errno == 0)
+            sys_errno = e;
+        return false;
+    }
 
+    static std::size_t round_up(std::size_t n) noexcept { return (n + vrec_page - 1) / vrec_page * vrec_page; }
 
+    // seal() pads a block to whole pages, and a block must fit into the batch buffer
+    static options checked(options o) noexcept
+    {
+        o.block_size = round_up(std::max(o.block_size, sizeof(vrec_block) + 1));
+        o.batch_size = std::max(round_up(o.batch_size), o.block_size);
+        return o;
+    }
 
-// HOW DOES HANDLING WORKS
+    bool sync_files()
+    {
+        if (::fdatasync(data_fd) != 0 || ::fdatasync(index_fd) != 0)
+            return fail(errno);
+        batches = 0;
+        ++syncs;
+        return true;
+    }
 
-/*
-A handler of type H catches the exception of type E if:
-    H and E is the same type
-    H is unambiguous base type of E
-    H and E are pointers or references and some of the above
-    stands
-*/
+    bool write_all(int fd, const void* p, std::size_t n, std::uint64_t offset)
+    {
+        for (std::size_t done = 0; done < n; )
+        {
+            ssize_t k = ::pwrite(fd, static_cast<const char*>(p) + done, n - done, static_cast<off_t>(offset + done));
+            if (k < 0 && errno == EINTR)
+                continue;
+            if (k < 0)
+                return fail(errno);
+            done += static_cast<std::size_t>(k);
+        }
+        return true;
+    }
 
-// EXCEPTION HIERARCHIES
+    // the header of the open block, with the checksum of its records; the rest of its last page is zeroed
+    void seal() noexcept
+    {
+        char* b = buf.get() + block;
+        vrec_block h = { vrec_block_magic, crc32c(b + sizeof(vrec_block), block_bytes), static_cast<std::uint32_t>(block_bytes),
+                         block_records };
+        std::memcpy(b, &h, sizeof(h));
+        std::size_t end = round_up(sizeof(vrec_block) + block_bytes);
+        std::memset(b + sizeof(vrec_block) + block_bytes, 0, end - sizeof(vrec_block) - block_bytes);
+        used = block + end;
+        in_block = false;
+    }
+
+    bool write_batch(bool may_sync = true)     // sync() passes false, it syncs anyway
+    {
+        if (in_block)
+            seal();
+        if (used == 0 && entries.empty())
+            return true;
+        if (used != 0)
+        {
+            if (!write_all(data_fd, buf.get(), used, data_end))
+                return false;
+            data_end += used;
+            used = 0;
+        }
+        if (!entries.empty())
+        {
+            if (!write_all(index_fd, entries.data(), entries.size() * sizeof(vrec_entry), index_end))
+                return false;
+            index_end += entries.size() * sizeof(vrec_entry);
+            entries.clear();
+        }
+        if (may_sync && opt.sync_every != 0 && ++batches >= opt.sync_every)
+            return sync_files();
+        return true;
+    }
+
+    // a block of its own, written straight away after the batch before it
+    bool append_large(std::string_view r)
+    {
+        if (!write_batch())
+            return false;
+        std::size_t size = round_up(sizeof(vrec_block) + r.size());
+        std::unique_ptr<char, void (*)(void*)> big(static_cast<char*>(std::aligned_alloc(vrec_page, size)), std::free);
+        if (!big)
+            return fail(ENOMEM);
+        vrec_block h = { vrec_block_magic, crc32c(r.data(), r.size()), static_cast<std::uint32_t>(r.size()), 1 };
+        std::memcpy(big.get(), &h, sizeof(h));
+        std::memcpy(big.get() + sizeof(h), r.data(), r.size());
+        std::memset(big.get() + sizeof(h) + r.size(), 0, size - sizeof(h) - r.size());
+        if (!write_all(data_fd, big.get(), size, data_end))
+            return false;
+        entries.push_back({ data_end + sizeof(h), static_cast<std::uint32_t>(r.size()), static_cast<std::uint32_t>(data_end / vrec_page) });
+        data_end += size;
+        ++count;
+        return true;
+    }
+
+    options opt;
+    std::unique_ptr<char, void (*)(void*)> buf;    // the batch, aligned to a page
+    int data_fd = -1;
+    int index_fd = -1;
+    std::size_t used = 0;                   // bytes of the batch in closed blocks
+    std::size_t block = 0;                  // the open block in the batch
+    std::size_t block_bytes = 0;
+    std::uint32_t block_records = 0;
+    bool in_block = false;
+    std::uint64_t data_end = 0;             // the file offset of the batch
+    std::uint64_t index_end = 0;
+    std::vector<vrec_entry> entries;        // of the records in the batch
+    std::size_t count = 0;
+    unsigned batches = 0;                   // since the last fdatasync()
+    unsigned long syncs = 0;
+    int sys_errno = 0;
+};
+
+// The reader of RecordWriter's files, the variable length pair of RecordFile: both files are mapped, record n is the n-th entry of
+// the index, so get() is O(1) and returns the bytes in the mapping. The checksum of a block is checked the first time a record of it
+// is read, the result is kept for the next ones
+class IndexedRecordFile
+{
+public:
+    explicit IndexedRecordFile(const std::string& fname)
+    {
+        if (!map(fname.c_str(), data, data_len) || !map((fname + ".idx").c_str(), index, index_len))
+            return;
+        vrec_header h{};
+        vrec_index_header ih{};
+        if (data_len >= vrec_page)
+            std::memcpy(&h, data, sizeof(h));
+        if (index_len >= sizeof(ih))
+            std::memcpy(&ih, index, sizeof(ih));
+        if (std::memcmp(h.magic, "VRECDAT1", 8) != 0 || h.page != vrec_page
+            || std::memcmp(ih.magic, "VRECIDX1", 8) != 0 || ih.entry_size != sizeof(vrec_entry))
+        {
+            fail(rec_cant_open, EINVAL);    // not our format
+            return;
+        }
+        count = (index_len - sizeof(ih)) / sizeof(vrec_entry);  // a torn last entry is not counted
+        checked.assign(data_len / vrec_page, unchecked);
+    }
+
+    IndexedRecordFile(const IndexedRecordFile&) = delete;
+    IndexedRecordFile& operator=(const IndexedRecordFile&) = delete;
+
+    ~IndexedRecordFile()
+    {
+        if (data)
+            ::munmap(const_cast<char*>(data), data_len);
+        if (index)
+            ::munmap(const_cast<char*>(index), index_len);
+    }
+
+    bool is_open() const noexcept { return err != rec_cant_open; }
+    std::size_t size() const noexcept { return count; }
+
+    record_error error() const noexcept { return err; }
+    const char* reason() const noexcept { return std::strerror(sys_errno); }
+    int sys_error() const noexcept { return sys_errno; }
+    void clear_error() noexcept { if (is_open()) err = rec_ok; }
+
+    void advise_random() const noexcept { if (data) ::madvise(const_cast<char*>(data), data_len, MADV_RANDOM); }
+
+    // Record n, or an empty view with data() == nullptr and:
+    //     rec_cant_find: n is past the last index entry
+    //     rec_cant_read: the entry points outside the data file or its block, or the checksum of the block is wrong
+    //                    (a crash after the index was written but before the data was)
+    std::string_view get(std::size_t n) noexcept
+    {
+        if (n >= count)
+        {
+            fail(rec_cant_find);
+            return { };
+        }
+        vrec_entry e;
+        std::memcpy(&e, index + sizeof(vrec_index_header) + n * sizeof(vrec_entry), sizeof(e));
+        if (e.block >= checked.size() || !block_ok(e.block))
+        {
+            fail(rec_cant_read);
+            return { };
+        }
+        vrec_block h;
+        std::memcpy(&h, data + std::size_t(e.block) * vrec_page, sizeof(h));
+        std::uint64_t first = std::uint64_t(e.block) * vrec_page + sizeof(vrec_block);
+        if (e.offset < first || e.length > h.bytes || e.offset - first > h.bytes - e.length)   // no overflow for any entry
+        {
+            fail(rec_cant_read);
+            return { };
+        }
+        return { data + e.offset, e.length };
+    }
+
+private:
+    enum : unsigned char { unchecked, good_block, bad_block };
+
+    bool block_ok(std::uint32_t page) noexcept
+    {
+        if (checked[page] == unchecked)
+        {
+            vrec_block h;
+            std::size_t at = std::size_t(page) * vrec_page;
+            std::memcpy(&h, data + at, sizeof(h));
+            bool ok = h.magic == vrec_block_magic && h.bytes <= data_len - at - sizeof(h)
+                      && crc32c(data + at + sizeof(h), h.bytes) == h.crc;
+            checked[page] = ok ? good_block : bad_block;
+        }
+        return checked[page] == good_block;
+    }
+
+    bool map(const char* fname, const char*& base, std::size_t& len) noexcept
+    {
+        int fd = ::open(fname, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) < 0)
+        {
+            fail(rec_cant_open, errno);
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        len = static_cast<std::size_t>(st.st_size);
+        void* p = len ? ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        int e = len ? errno : EINVAL;
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            fail(rec_cant_open, e);
+            len = 0;
+            return false;
+        }
+        base = static_cast<const char*>(p);
+        return true;
+    }
+
+    void fail(record_error e, int sys = 0) noexcept
+    {
+        if (err == rec_cant_open)
+            return;
+        err = e;
+        sys_errno = sys;
+    }
+
+    const char* data = nullptr;
+    std::size_t data_len = 0;
+    const char* index = nullptr;
+    std::size_t index_len = 0;
+    std::size_t count = 0;
+    std::vector<unsigned char> checked;     // per page, only the first page of a block is used
+    record_error err = rec_ok;
+    int sys_errno = 0;
+};
 
-class Base { … };
-class Der1 : public Base { … };
-class Der2 : public Base { … };
-class Der3 : public Der2 { … };
-try
-{
-    f();
-// …
-}
-catch (Der3 &e1) { /* handler for Der3 */ } /* the most derived handler first */
-catch (Der2 &e2) { /* handler for Der2 */ }
-catch (Der1 &e3) { /* handler for Der1 */ }
-catch (Base &e3) { /* handler for Base */ } /* the base handler last */
 void f()
 {
-    if ( ... )
-        throw Der3(); /* throw the most derived type */
+RecordWriter out("events", { .sync_every = 16 }); // an fdatasync() for every 16 MB
+for (const Event& ev : events)
+if (!out.append(serialize(ev)))
+break;
+if (!out.close())
+std::fprintf( stderr, "can't write events: %s\n", out.reason());
+
+IndexedRecordFile in("events");
+std::string_view r = in.get(n); // the three messages of g() above
+if (r.data() == nullptr) // like in g(), the sticky error only means something after a failed get()
+{
+if (in.error() == rec_cant_find)
+std::fprintf( stderr, "can't find record %zu\n", n);
+else
+std::fprintf( stderr, "can't read record\n"); // torn or corrupt block
+}
 }
 
-/*
-We should pay attention to how to catch the created object (because the stack works in a LIFO system) we have to do the catch in a
-reverse system.
+// Basic example of a benchmark: appending 1M records of 16-512 bytes, and 2M random lookups (usage: bench dir)
 
-Imagine that we throw the base handler first then we won't be able to get access to the other handlers, so they would not get to work
-meaning we won't use them. If we throw Der3 handler first than we can get to every handler and at the end for the base class handler.
+#include <chrono>
+#include <cstdio>
+#include <random>
 
-Also pay attention that the objects in the catches are called with reference. This is for getting access to the object that is created in the
-static memory space, so we avoid memory overhead.
+int main(int argc, char* argv[])
+{
+    std::string fname = std::string(argc > 1 ? argv[1] : "/tmp") + "/bench_records";
+    const std::size_t n = 1'000'000;
+
+    std::mt19937_64 rng(42);
+    std::vector<std::uint32_t> lengths(n);
+    std::size_t total = 0;
+    for (auto& l : lengths)
+        total += l = 16 + rng() % 497;
+    std::string bytes(512, 'r');
+
+    auto report = [&](const char* what, double s, unsigned long syncs) {
+        std::printf("%-36s %8.0f ms %8.1f MB/s %8.2f M records/s  %5lu fsyncs\n", what, s * 1e3, total / s / 1e6, n / s / 1e6, syncs);
+    };
+    auto now = [] { return std::chrono::steady_clock::now(); };
+    auto seconds = [](auto d) { return std::chrono::duration<double>(d).count(); };
+
+    {   // the simple way: a write() of the record and of its index entry, one fdatasync() at the end
+        int data_fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int index_fd = ::open((fname + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        auto t0 = now();
+        std::uint64_t offset = 0;
+        for (std::uint32_t l : lengths)
+        {
+            vrec_entry e = { offset, l, 0 };
+            if (::write(data_fd, bytes.data(), l) != ssize_t(l) || ::write(index_fd, &e, sizeof(e)) != ssize_t(sizeof(e)))
+                return 1;
+            offset += l;
+        }
+        ::fdatasync(data_fd);
+        ::fdatasync(index_fd);
+        report("write() per record, fsync at the end", seconds(now() - t0), 1);
+        ::close(data_fd);
+        ::close(index_fd);
+    }
+    for (unsigned sync_every : { 0u, 16u, 1u })
+    {
+        RecordWriter::options o;
+        o.sync_every = sync_every;
+        auto t0 = now();
+        RecordWriter out(fname, o);
+        for (std::uint32_t l : lengths)
+            out.append(std::string_view(bytes.data(), l));
+        bool ok = out.close();
+        char what[64];
+        std::snprintf(what, sizeof(what), "RecordWriter, fsync %s", sync_every == 0 ? "at the end" : sync_every == 1 ? "every batch"
+                                                                                                     : "every 16 batches");
+        report(what, seconds(now() - t0), out.sync_count());
+        if (!ok)
+            std::printf("can't write: %s\n", out.reason());
+    }
+
+    std::vector<std::size_t> idx(2'000'000);
+    for (auto& i : idx)
+        i = rng() % n;
+
+    IndexedRecordFile in(fname);
+    in.advise_random();
+    for (int pass = 1; pass <= 2; ++pass)
+    {
+        std::size_t sum = 0;
+        auto t0 = now();
+        for (std::size_t i : idx)
+            sum += in.get(i).size();
+        double s = seconds(now() - t0);
+        std::printf("2M random get(), %s pass: %7.0f ms %8.1f ns per record (%s)\n", pass == 1 ? "first " : "second", s * 1e3,
+                    s * 1e9 / idx.size(), in.error() == rec_ok && sum > 0 ? "ok" : "error");
+    }
+    {   // the fseek/fread way: pread() the entry, then pread() the record
+        int data_fd = ::open(fname.c_str(), O_RDONLY);
+        int index_fd = ::open((fname + ".idx").c_str(), O_RDONLY);
+        std::vector<char> rec(64 * 1024);
+        std::size_t sum = 0;
+        auto t0 = now();
+        for (std::size_t i : idx)
+        {
+            vrec_entry e;
+            if (::pread(index_fd, &e, sizeof(e), off_t(sizeof(vrec_index_header) + i * sizeof(e))) == ssize_t(sizeof(e))
+                && ::pread(data_fd, rec.data(), e.length, off_t(e.offset)) == ssize_t(e.length))
+                sum += e.length;
+        }
+        double s = seconds(now() - t0);
+        std::printf("2M random pread() pairs:     %7.0f ms %8.1f ns per record\n", s * 1e3, s * 1e9 / idx.size());
+        ::close(data_fd);
+        ::close(index_fd);
+    }
+
+    // the distinctions: past the end, and a block broken on the disk
+    std::printf("get(%zu): %s\n", n, in.get(n).data() == nullptr && in.error() == rec_cant_find ? "can't find record" : "?");
+    in.clear_error();
+    if (int fd = ::open(fname.c_str(), O_WRONLY); fd >= 0)
+    {
+        ::pwrite(fd, "X", 1, vrec_page + 100);  // a byte in the first block
+        ::close(fd);
+    }
+    IndexedRecordFile broken(fname);
+    std::printf("get(0) after a flipped byte: %s, get(%zu): %s\n",
+                broken.get(0).data() == nullptr && broken.error() == rec_cant_read ? "can't read record" : "?", n - 1,
+                (broken.clear_error(), broken.get(n - 1).size() == lengths.back()) ? "ok" : "?");
+    std::remove(fname.c_str());
+    std::remove((fname + ".idx").c_str());
+}
+
+/*
+RecordFile finds record n at n * sizeof(record), so every record has the same size. For records of different lengths the position
+has to be stored somewhere, and this is the index file: a vrec_entry (offset, length, block) for every record, 16 bytes each. It is
+mapped like the data, so get(n) is still one multiplication and a few comparisons, and it returns a string_view into the mapping.
+
+The data file is a header page and then blocks. A block starts with a vrec_block: a magic number, the CRC-32C of its records, the
+number of bytes and of records. Then come the records, and the block is padded to whole 4 KB pages. The checksum is per block, not per
+record: a 64 KB block has one CRC, and the reader checks it once, the first time it reads a record of that block, and remembers the
+result (one byte per page). The CRC-32C is the crc32 instruction of SSE 4.2 when the CPU has it (__builtin_cpu_supports), and a table
+on other CPUs.
+
+RecordWriter does what OutFile (MAPPING SEMANTIC ISSUE TO SYNTAX - 3) does for text, but without a thread:
+    the records are copied into blocks in a 1 MB batch buffer that is aligned to a page. A full batch goes out with one pwrite(),
+    and its size and file offset are multiples of 4 KB (that is also what O_DIRECT would need). Then the index entries of the batch
+    go to the index file with one more pwrite()
+    fdatasync() is the expensive part of making the data safe, so it is done for a group: after every sync_every batches, or only in
+    sync() and close(). Until then a crash can lose the last batches, and the kernel may even write back the index before the data.
+    The reader notices this too: the entry points past the end of the file or into a block with a wrong checksum
+    the errors are the errno style of RecordFile: append() returns false after a failed write, reason() is the strerror()
+
+The reader keeps the distinctions of the first example with the same codes. rec_cant_find: n is past the last complete index entry.
+rec_cant_read: the entry is there, but the record is not, or its block is broken. A torn last index entry is not counted at all.
+
+The benchmark appends 1M records with random lengths of 16-512 bytes (252 MB) to the files, then reads 2M random records. The
+output on my machine (g++ 12 -O2, a virtual disk, the files fit into the page cache):
+
+    write() per record, fsync at the end      964 ms    274.1 MB/s     1.04 M records/s      1 fsyncs
+    RecordWriter, fsync at the end            318 ms    831.5 MB/s     3.15 M records/s      1 fsyncs
+    RecordWriter, fsync every 16 batches      365 ms    724.4 MB/s     2.74 M records/s     16 fsyncs
+    RecordWriter, fsync every batch           405 ms    652.1 MB/s     2.47 M records/s    253 fsyncs
+    2M random get(), first  pass:     150 ms     75.1 ns per record (ok)
+    2M random get(), second pass:      96 ms     48.0 ns per record (ok)
+    2M random pread() pairs:        2893 ms   1446.6 ns per record
+    get(1000000): can't find record
+    get(0) after a flipped byte: can't read record, get(999999): ok
+
+Two write() calls per record make the simple way slow: it is the system calls, not the disk. The batches are 3x faster, and that
+includes computing the checksums. An fdatasync() on this virtual disk is cheap (the host has a write cache), so even one per batch only
+costs about 25%. On a real disk that waits for the platter or the flash, an fsync takes milliseconds, and the group sync would matter
+much more. In another run the simple way took 1474 ms, the rest changed by about 15%.
+
+The lookups are 20-30x faster than two pread() calls. The first pass also checks the CRC of every block it touches (all 4000 of them),
+and that is the 30 ns difference from the second pass. The last two lines are the error cases: an index past the end, and a byte
+changed in the first block of the file. Only the records of that block become unreadable, the rest of the file is still fine.
 */
 
 
 
-// EXCEPTION HIERARCHIES - 2
+// IOSTREAM ERROR HANDLING
 
-class net_error { ... };
-class file_error { ... };
-class nfs_error : public net_error, public file_error { ... };
 void f()
 {
-    try
+std::ifstream file("input.txt");
+if ( ! file ) /* before C++11: void*, since C++11: bool */
 {
-    …
+std::cerr << "file opening failed\n";
+return;
+}
+for( int n; file >> n; ) /* while ( ! cin.fail() ) */
+{
+std::cout << n << '\n';
+}
+if ( file.bad() )
+{
+std::cerr << "i/o error while reading\n";
+}
+else if ( file.eof() )
+{
+std::cerr << "eof reached\n";
+}
+else if ( file.fail() )
+{
+std::cerr << "non-integer\n";
 }
-    catch( nfs_error nfs ) { ... }
-    catch( file_error fe ) { ... }
-    catch( net_error ne ) { ... }
 }
 
 /*
-Doing inheritance -or multiple inheritance- with exceptions is possible and sometimes even beneficial. If I want to catch a bug with handler a and handler b
-then it can be very useful to do inheritance (Network Filesystems, for example). In network filesystem we can catch filesystem errors and networks errors with
-different handlers. In case of inheritance it can be a very useful approach.
+iostream has different flags for error handling. For example, if we want to see that we reached the end of a file
+we can use the flag eof() to see if it happened or not.
+The iostream error handling mostly relies on stream state flags, and optionally, exceptions.
+It can be used for files management, but we can also use it to check for example the if the user input matches
+what we expect in our code.
+
+In our code detecting eof(), fail() bits is harder that is why it is possible that a programmer reads a file in and then
+when they know the actual size of the file they try to rewrite it, but because of the eof() bit it won't happen since the
+file is in a stage of having possible bugs. Hence it is not safe to rewrite it, so the compiler terminates.
 */
 
 
 
-// RE-THROW
+// IOSTREAM ERROR HANDLING - 2 | FAST BULK INTEGER READING
 
-class Base { … };
-class Der1 : public Base { … };
-void g()
+#include <charconv> // std::from_chars
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+class IntReader
 {
-    throw Der1; // throw derived exception Der1
-}
+public:
+    explicit IntReader(const char* fname, std::size_t block = 1 << 20)
+        : fd(::open(fname, O_RDONLY)), buf(block + slack)
+    {
+        st_bad = fd < 0;
+    }
+
+    IntReader(const IntReader&) = delete;
+    IntReader& operator=(const IntReader&) = delete;
+
+    ~IntReader()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool is_open() const noexcept { return fd >= 0; }
+    explicit operator bool() const noexcept { return !st_bad && !st_fail; }
+    bool bad() const noexcept { return st_bad; }    // i/o error (or could not open)
+    bool eof() const noexcept { return st_eof; }    // ran out of input
+    bool fail() const noexcept { return st_fail; }  // non-integer (or out of range) token
+    std::size_t error_offset() const noexcept { return err_off; }  // byte offset of that token in the file
+
+    // parse up to max integers into out, returns how many; 0 means we stopped, check the state
+    std::size_t read(int* out, std::size_t max)
+    {
+        std::size_t n = 0;
+        while (n < max && *this)
+        {
+            while (pos < lim && is_space(buf[pos]))
+                ++pos;
+            if (pos == lim)
+            {
+                if (!refill())
+                    break;
+                continue;
+            }
+            const char* ptr = parse_token(buf.data() + pos, buf.data() + lim, out[n]);
+            if (!ptr)
+            {
+                st_fail = true;
+                err_off = file_off + pos;
+                break;
+            }
+            ++n;
+            pos = ptr - buf.data();
+        }
+        return n;
+    }
+
+    // one integer token starting at first (not whitespace), like >> would read it; nullptr if it is not one.
+    // The 32 bytes after last must be readable and must not continue the token (see parse_int)
+    static const char* parse_token(const char* first, const char* last, int& out) noexcept
+    {
+        if (const char* ptr = parse_int(first, out))
+            return ptr;
+        // more than 10 digits, overflow or not a number: let from_chars decide
+        const char* start = (*first == '+' && first + 1 != last && first[1] != '-') ? first + 1 : first; // >> accepts "+5"
+        auto res = std::from_chars(start, last, out);
+        return res.ec == std::errc() ? res.ptr : nullptr;
+    }
+
+    static bool is_space(char c) noexcept   // the "C" locale whitespace, without asking the locale
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    // calls f(const int* values, std::size_t n) for every batch
+    template <class F>
+    void for_each_batch(F f)
+    {
+        for (std::size_t n; (n = read(batch, batch_size)) > 0; )
+            f(static_cast<const int*>(batch), n);
+    }
+
+    bool next(int& x)
+    {
+        if (bpos == bn)
+        {
+            bn = read(batch, batch_size);
+            bpos = 0;
+            if (bn == 0)
+                return false;
+        }
+        x = batch[bpos++];
+        return true;
+    }
+
+    class iterator  // input iterator: for (int n : reader)
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int*;
+        using reference = const int&;
+
+        iterator() = default;
+        explicit iterator(IntReader* r) : rd(r) { ++*this; }
+
+        const int& operator*() const noexcept { return val; }
+        iterator& operator++() { if (!rd->next(val)) rd = nullptr; return *this; }
+        void operator++(int) { ++*this; }
+        bool operator==(const iterator& o) const noexcept { return rd == o.rd; }
+        bool operator!=(const iterator& o) const noexcept { return rd != o.rd; }
+
+    private:
+        IntReader* rd = nullptr;
+        int val = 0;
+    };
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    static std::uint64_t load8(const char* p) noexcept
+    {
+        std::uint64_t x;
+        std::memcpy(&x, p, 8);
+        return x - 0x3030303030303030ull;  // '0' is 0 in every byte
+    }
+
+    // number of leading bytes (lowest first) that are digits; a byte is not a digit if it is >= 10 after - '0'
+    static unsigned digit_run(std::uint64_t x) noexcept
+    {
+        std::uint64_t t = ((x + 0x7676767676767676ull) | x) & 0x8080808080808080ull;
+        return t ? __builtin_ctzll(t) / 8 : 8;
+    }
+
+    // value of 8 digits in one word (SWAR: two digits, then four, then eight at a time)
+    static std::uint64_t swar8(std::uint64_t x) noexcept
+    {
+        x = x * 10 + (x >> 8);
+        return ((x & 0x000000FF000000FFull) * (100 + (1000000ull << 32))
+              + ((x >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32))) >> 32;
+    }
+
+    // the common case: [+-] and at most 10 digits, read 8 bytes at a time instead of char by char;
+    // nullptr if the token is anything else. It may read 17 bytes past p, hence the slack of the buffer
+    static const char* parse_int(const char* p, int& out) noexcept
+    {
+        bool neg = *p == '-';
+        const char* d = p + (neg || *p == '+');
+        std::uint64_t x = load8(d);
+        unsigned len = digit_run(x);
+        std::uint64_t v;
+        if (len == 0)
+        {
+            return nullptr;
+        }
+        else if (len < 8)
+        {
+            v = swar8(x << (8 * (8 - len)));    // shift in leading zeros
+        }
+        else
+        {
+            std::uint64_t y = load8(d + 8);
+            unsigned tail = digit_run(y);
+            if (tail > 2)
+                return nullptr;
+            std::uint64_t d0 = y & 0xff, d1 = (y >> 8) & 0xff;
+            v = swar8(x) * (tail == 2 ? 100 : tail == 1 ? 10 : 1) + (tail == 2 ? d0 * 10 + d1 : tail == 1 ? d0 : 0);
+            len += tail;
+        }
+        if (v > static_cast<std::uint64_t>(INT_MAX) + neg)
+            return nullptr;
+        out = neg ? static_cast<int>(0u - static_cast<unsigned>(v)) : static_cast<int>(v);
+        return d + len;
+    }
+
+    // keep the unparsed tail, read the next block and set lim after the last whitespace,
+    // so from_chars never sees a number cut in half by the block boundary
+    bool refill()
+    {
+        if (at_eof)
+        {
+            st_eof = true;
+            return false;
+        }
+        std::size_t keep = filled - pos;
+        std::copy(buf.begin() + pos, buf.begin() + filled, buf.begin());
+        file_off += pos;
+        pos = 0;
+        filled = keep;
+        for (;;)
+        {
+            if (filled + slack == buf.size())
+                buf.resize(2 * buf.size());    // a single token longer than a block
+            ssize_t r = ::read(fd, buf.data() + filled, buf.size() - slack - filled);
+            if (r < 0)
+            {
+                st_bad = true;
+                return false;
+            }
+            filled += static_cast<std::size_t>(r);
+            std::memset(buf.data() + filled, 0, slack);   // parse_int must not see stale digits after the end
+            if (r == 0)
+            {
+                at_eof = true;
+                lim = filled;
+                if (pos == lim)
+                    st_eof = true;
+                return pos < lim;
+            }
+            for (lim = filled; lim > keep && !is_space(buf[lim - 1]); --lim)
+                ;
+            if (lim > keep)
+                return true;
+            keep = filled;     // no whitespace in the new bytes yet, read more
+        }
+    }
+
+    static constexpr std::size_t batch_size = 4096;
+    static constexpr std::size_t slack = 32;
+
+    int fd;
+    std::vector<char> buf;
+    std::size_t pos = 0, lim = 0, filled = 0;
+    std::size_t file_off = 0;
+    std::size_t err_off = 0;
+    bool at_eof = false;
+    bool st_bad = false, st_eof = false, st_fail = false;
+    int batch[batch_size];
+    std::size_t bpos = 0, bn = 0;
+};
+
 void f()
-try // function block itself can be try block
 {
-    g();
+IntReader file("input.txt");
+if ( ! file.is_open() )
+{
+std::cerr << "file opening failed\n";
+return;
 }
-catch ( Base b ) // catch Base by value: copied, since C++11 can be moved
+for ( int n : file )
 {
-    must_do_at_exception(b);
-    throw; // re-throw original exception Der1
+std::cout << n << '\n';
 }
-catch ( ... ) // catch all
+if ( file.bad() )
 {
-    must_do_at_exception();
-    throw; // re-throw original exception
+std::cerr << "i/o error while reading\n";
+}
+else if ( file.fail() ) /* checked before eof: "1 2 x" is a non-integer, not an eof */
+{
+std::cerr << "non-integer at byte " << file.error_offset() << '\n';
+}
+else if ( file.eof() )
+{
+std::cerr << "eof reached\n";
+}
+}
+
+// Basic example of a benchmark: file >> n against IntReader (usage: bench file size_in_MB)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+int main(int argc, char* argv[])
+{
+    const char* fname = argc > 1 ? argv[1] : "ints.txt";
+    long mb = argc > 2 ? std::atol(argv[2]) : 1024;
+
+    if (std::FILE* out = std::fopen(fname, "w"))
+    {
+        std::mt19937 rng(42);
+        for (long written = 0; written < mb * 1024 * 1024; )
+            written += std::fprintf(out, "%d%c", static_cast<int>(rng()), rng() % 16 ? ' ' : '\n');
+        std::fclose(out);
+    }
+
+    using clock = std::chrono::steady_clock;
+    long long sum1 = 0, sum2 = 0;
+
+    auto t0 = clock::now();
+    std::ifstream file(fname);
+    for (int n; file >> n; )
+        sum1 += n;
+    auto t1 = clock::now();
+    IntReader reader(fname);
+    reader.for_each_batch([&](const int* p, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i)
+            sum2 += p[i];
+    });
+    auto t2 = clock::now();
+
+    auto ms = [](auto d) { return (long long)std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+    std::printf("%ld MB: operator>> %lld ms, IntReader %lld ms, %.1fx\n", mb, ms(t1 - t0), ms(t2 - t1),
+                double(ms(t1 - t0)) / ms(t2 - t1));
+    if (sum1 != sum2 || !reader.eof() || reader.fail())     // only a broken run prints more
+        std::printf("IntReader disagrees with >>: sums %lld / %lld, eof: %d, fail: %d\n", sum1, sum2, reader.eof(), reader.fail());
 }
 
 /*
-Re-throw can be useful when a handler cannot handle the given job so it throws it to another handler in a higher hierarchy that will do the handling.
-Also if a handle only can solve a part of it then it is possible to throw it, so another handler can solve the rest of the job (it has to work with)
-the original object and not the sliced one! In this case it is important to note that we must re-throw the original object, and not the sliced one.
+file >> n is slow for a lot of reasons: every extraction creates a sentry object, asks the locale of the stream for the num_get facet
+and the ctype facet (whitespace, digits, thousands separators) and goes through the stream buffer one character at a time via virtual calls.
+
+IntReader reads 1 MB blocks with read() and parses them without any locale. The common token (an optional sign and at most 10 digits) is
+parsed 8 bytes at a time: one subtraction finds the digits, and three multiplications combine them (SWAR, "SIMD within a register").
+Everything else (longer tokens, overflow, garbage) goes to std::from_chars, so the result is the same as with >>. The only tricky
+part is the end of a block: a number can be cut in half there, so we only parse up to the last whitespace in the block and the unfinished
+tail is moved to the front of the buffer before the next read. The values come out either one by one (for (int n : reader), next())
+or in batches of 4096 through a callback, which is what you want for bulk ingestion.
+
+The states are the same as the ones of the stream:
+    bad():  i/o error (read() failed) or the file could not be opened
+    eof():  we ran out of input
+    fail(): a token that is not an integer (or does not fit into an int), error_offset() tells where it starts in the file
+Just like with >>, "12abc" gives 12 first and then fails on "abc", and a leading '+' is accepted. One difference: a stream that fails on
+the last token has both eof and fail set, that is why f() checks fail() before eof() here.
+
+The output on my machine for 1 GB of random ints:
+
+    1024 MB: operator>> 13809 ms, IntReader 3153 ms, 4.4x
+
+This is less than the 10x we wanted. The machine is a small VM and the random lengths of the numbers make the branches hard to predict.
+Plain std::from_chars (GCC 12) was only about 3x faster than >> here, the SWAR path adds the rest. To get more we have to use more cores,
+see the next section.
+*/
 
-Re-throw happens in the catch phase and we know if it's a re-throw if the throw does not have any parameters, so we will throw the object that evoke the
-original exception.
 
-In the code above when we do the re-throw we do not throw the Base b. The der1 will be copied into the static memory location which is the base class, so
-we will throw the copy that is stored in the static memory location. If we would say throw(b) then we would throw the original object and not the copied version
-that is located in the static memory. THIS IS AN IMPORTANT PART OF RE-THROWING!
 
-(...) -> this is an universal handler which catches "everything". This is the most general handler. If we have this handler then we must write it as the lowest handler
-and of course it should not be at the top of the hierarchy. In this case always think of the "szita efektus".
+// IOSTREAM ERROR HANDLING - 3 | PARSING A BIG FILE ON ALL CORES
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct ParseResult
+{
+    std::vector<int> values;    // in file order, up to the first bad token
+    bool bad = false;           // could not open / map the file, errno is in sys_errno
+    bool fail = false;          // non-integer token at error_offset (global byte offset in the file)
+    std::size_t error_offset = 0;
+    int sys_errno = 0;
+};
+
+// runs f(0) ... f(n - 1) on n threads and waits for all of them
+template <class F>
+void run_on_threads(unsigned n, F f)
+{
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < n; ++i)
+        pool.emplace_back(f, i);
+    f(0u);
+    for (std::thread& t : pool)
+        t.join();
+}
+
+ParseResult parse_ints_parallel(const char* fname, unsigned threads = std::thread::hardware_concurrency())
+{
+    ParseResult result;
+    if (threads == 0)
+        threads = 1;
+
+    int fd = ::open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) < 0)
+    {
+        result.bad = true;
+        result.sys_errno = errno;
+        if (fd >= 0)
+            ::close(fd);
+        return result;
+    }
+    std::size_t len = static_cast<std::size_t>(st.st_size);
+    long page = ::sysconf(_SC_PAGESIZE);
+
+    // reserve one extra zero page after the file, so IntReader::parse_token can read past the last byte
+    void* area = ::mmap(nullptr, len + page, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED || (len > 0 && ::mmap(area, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+        result.bad = true;
+        result.sys_errno = errno;
+        if (area != MAP_FAILED)
+            ::munmap(area, len + page);
+        ::close(fd);
+        return result;
+    }
+    ::close(fd);
+    ::madvise(area, len, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(area);
+
+    // more chunks than threads, so a slow chunk does not hold up everybody;
+    // every boundary is moved just after a whitespace, so no token is cut in half
+    std::size_t n_chunks = len < (1 << 20) ? 1 : threads * 8;
+    std::vector<std::size_t> bound(n_chunks + 1, len);
+    bound[0] = 0;
+    for (std::size_t i = 1; i < n_chunks; ++i)
+    {
+        std::size_t b = std::max(len / n_chunks * i, bound[i - 1]);
+        while (b < len && !IntReader::is_space(data[b]))
+            ++b;
+        bound[i] = b < len ? b + 1 : len;
+    }
+
+    struct Chunk
+    {
+        std::vector<int> values;
+        std::size_t error_offset = static_cast<std::size_t>(-1);
+    };
+    std::vector<Chunk> chunks(n_chunks);
+    std::atomic<std::size_t> next_chunk{0};
+
+    // runs once, on the last thread that finishes parsing, before any of them starts copying:
+    // the first bad token in file order wins, just like the serial loop would stop there
+    std::size_t used = n_chunks;
+    std::vector<std::size_t> start;
+    std::exception_ptr failure;
+    auto between_phases = [&]() noexcept {
+        for (std::size_t c = 0; c < n_chunks; ++c)
+        {
+            if (chunks[c].error_offset != static_cast<std::size_t>(-1))
+            {
+                result.fail = true;
+                result.error_offset = chunks[c].error_offset;
+                used = c + 1;
+                break;
+            }
+        }
+        try
+        {
+            start.assign(used + 1, 0);
+            for (std::size_t c = 0; c < used; ++c)
+                start[c + 1] = start[c] + chunks[c].values.size();
+            result.values.resize(start[used]);
+        }
+        catch (...)
+        {
+            failure = std::current_exception();
+            used = 0;
+        }
+        next_chunk.store(0, std::memory_order_relaxed);
+    };
+    std::barrier sync(threads, between_phases);
+
+    // the same threads parse the chunks and then concatenate them in order
+    run_on_threads(threads, [&](unsigned) {
+        for (std::size_t c; (c = next_chunk.fetch_add(1, std::memory_order_relaxed)) < n_chunks; )
+        {
+            const char* p = data + bound[c];
+            const char* last = data + bound[c + 1];
+            Chunk& chunk = chunks[c];
+            chunk.values.reserve((last - p) / 8);
+            for (;;)
+            {
+                while (p < last && IntReader::is_space(*p))
+                    ++p;
+                if (p == last)
+                    break;
+                int x;
+                const char* q = IntReader::parse_token(p, last, x);
+                if (!q)
+                {
+                    chunk.error_offset = p - data;
+                    break;
+                }
+                chunk.values.push_back(x);
+                p = q;
+            }
+        }
+        sync.arrive_and_wait();
+        for (std::size_t c; (c = next_chunk.fetch_add(1, std::memory_order_relaxed)) < used; )
+        {
+            std::copy(chunks[c].values.begin(), chunks[c].values.end(), result.values.begin() + start[c]);
+            std::vector<int>().swap(chunks[c].values);
+        }
+    });
+
+    ::munmap(area, len + page);
+    if (failure)
+        std::rethrow_exception(failure);
+    return result;
+}
+
+void f()
+{
+ParseResult file = parse_ints_parallel("input.txt");
+if ( file.bad )
+{
+std::cerr << "file opening failed\n";
+return;
+}
+for ( int n : file.values )
+{
+std::cout << n << '\n';
+}
+if ( file.fail )
+{
+std::cerr << "non-integer at byte " << file.error_offset << '\n';
+}
+else
+{
+std::cerr << "eof reached\n";
+}
+}
+
+// Basic example of a benchmark: scaling from 1 to N threads (usage: bench file size_in_MB max_threads)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+int main(int argc, char* argv[])
+{
+    const char* fname = argc > 1 ? argv[1] : "ints.txt";
+    long mb = argc > 2 ? std::atol(argv[2]) : 1024;
+    unsigned max_threads = argc > 3 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    if (std::FILE* out = std::fopen(fname, "w"))
+    {
+        std::mt19937 rng(42);
+        for (long written = 0; written < mb * 1024 * 1024; )
+            written += std::fprintf(out, "%d%c", static_cast<int>(rng()), rng() % 16 ? ' ' : '\n');
+        std::fclose(out);
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    IntReader reader(fname);
+    long long serial_sum = 0;
+    std::size_t serial_count = 0;
+    reader.for_each_batch([&](const int* p, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i)
+            serial_sum += p[i];
+        serial_count += n;
+    });
+    double serial = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::printf("IntReader (serial): %6.0f ms\n", serial);
+
+    for (unsigned t = 1; t <= max_threads; t *= 2)
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        ParseResult r = parse_ints_parallel(fname, t);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count();
+        long long sum = 0;
+        for (int x : r.values)
+            sum += x;
+        std::printf("%3u threads:        %6.0f ms  speedup %.2fx\n", t, ms, serial / ms);
+        if (sum != serial_sum || r.values.size() != serial_count)
+            std::printf("  the parallel result differs from the serial one\n");
+    }
+}
+
+/*
+The file is mapped into memory once and cut into chunks (8 per thread, so the threads that finish early can take the next one). A chunk
+boundary can fall into the middle of a number, so every boundary is moved forward to just after the next whitespace. The chunks are parsed
+independently with the same IntReader::parse_token as the serial reader, each into its own vector, and at the end the vectors are copied
+into the result in chunk order. So the values come back in the order of the file.
+
+Both phases run on the same threads, they are started once per call. A std::barrier sits between parsing and copying, and its completion
+step (run by the last thread that arrives, while the others wait) finds the first bad chunk and sizes the result, so the copies can start
+right away without joining the threads and creating new ones. The completion step must be noexcept, so a bad_alloc from the resize is
+caught there, nothing is copied, and it is rethrown on the calling thread after the threads are joined and the file is unmapped.
+
+The error handling is the interesting part. Every chunk remembers the offset of its first bad token, and we take the first chunk (in file
+order) that has one. Everything before it is valid, everything after it is thrown away. This gives exactly the same result as the serial
+for ( int n; file >> n; ) loop, which would stop at that token with file.fail() set, the position is the global byte offset in the file.
+The price is that the chunks after the bad token are parsed for nothing, but errors are supposed to be rare.
+
+The file is mapped with an extra zero page behind it (an anonymous mapping first, then the file over it with MAP_FIXED). parse_token reads
+up to 32 bytes past the token, and without that page reading past the last page of the file would crash with SIGBUS.
+
+The machine I tried this on has a single core, so the numbers (1 GB file) only show that the parallel version costs about the same as the
+serial IntReader when it cannot run in parallel. The scaling curve has to be measured on a real multi-core machine, run the benchmark there.
+
+    IntReader (serial):   3052 ms
+      1 threads:          3246 ms  speedup 0.94x
+      2 threads:          3123 ms  speedup 0.98x
+      4 threads:          3023 ms  speedup 1.01x
+*/
+
+
+
+// ASSERT ERROR HANDLING
+
+#include <cassert> /* assert.h in C */
+void open_file(std::string fname)
+{
+assert(fname.length() > 0);
+std::ifstream f(fname.c_str());
+. . .
+}
+
+/*
+Checking errors with assert we can set logical condition(s) in our code. The problem is that with assert we can give error messages
+and our program just terminates. Imagine if it happens in a Boeing airplane. The program just terminates, but does not try to recover
+in any way that would lead to crash of the plane.
+
+If we are in the development phase of a project then doing assert can be a good option, but we have to replace it to assertions when we
+want to release or product.
+
+Assert does the checking in runtime. THI IS AN IMPORTANT NOTE! Good for checking for nullptr, for example.
+*/
+
+
+
+// ASSERT ERROR HANDLING - 2 | CONTRACT CHECKS WITH LEVELS, ACTIONS AND COUNTERS
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+
+// Which checks are compiled in (-DCONTRACT_LEVEL=0, 1 or 2):
+//     off:    none, the conditions are not even evaluated
+//     cheap:  the checks that cost about one branch (bounds, nullptr), the default, also in the release build
+//     audit:  the expensive ones too (is the range sorted, does the tree still balance), for the test builds
+enum class contract_level { off, cheap, audit };
+
+#if !defined(CONTRACT_LEVEL)
+#define CONTRACT_LEVEL 1
+#endif
+
+inline constexpr contract_level build_contract_level = static_cast<contract_level>(CONTRACT_LEVEL);
+
+constexpr bool contract_enabled(contract_level l) noexcept { return l <= build_contract_level; }
+
+// What a failed check does, chosen at every check:
+//     terminate:    prints the site and calls std::terminate(), like assert but in the release build too
+//     throw_error:  throws contract_violation
+//     log_count:    counts, prints the first violation of the site, and the program goes on
+enum class contract_action { terminate, throw_error, log_count };
+
+// One per check in the code, a static object: where it is and how many times it failed. The sites that failed at least once
+// are in a list, contract_report() prints them
+struct contract_site
+{
+    const char* expr;
+    const char* file;
+    int line;
+    contract_level level;
+    contract_action action;
+    std::atomic<unsigned long> violations{ 0 };
+    std::atomic<bool> listed{ false };
+    contract_site* next = nullptr;
+
+    constexpr contract_site(const char* e, const char* f, int l, contract_level lv, contract_action a) noexcept
+        : expr(e), file(f), line(l), level(lv), action(a) { }
+};
+
+class contract_violation : public std::logic_error
+{
+public:
+    explicit contract_violation(const contract_site& s) : std::logic_error(s.expr), st(&s) { }
+    const contract_site& site() const noexcept { return *st; }
+
+private:
+    const contract_site* st;
+};
+
+inline std::atomic<contract_site*> contract_sites{ nullptr };
+
+// everything below is only reached when a check fails: out of line and cold, so the hot code is the compare and a branch that
+// is never taken, and the compiler moves the call to the end of the function. contract_count returns the count before this violation:
+// only that value says which thread failed first, a load after the fetch_add can already see the other threads' violations
+[[gnu::cold, gnu::noinline]] inline unsigned long contract_count(contract_site& s) noexcept
+{
+    const unsigned long before = s.violations.fetch_add(1, std::memory_order_relaxed);
+    if (!s.listed.exchange(true, std::memory_order_acq_rel))
+    {
+        s.next = contract_sites.load(std::memory_order_relaxed);
+        while (!contract_sites.compare_exchange_weak(s.next, &s, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+    return before;
+}
+
+[[gnu::cold, gnu::noinline]] inline void contract_print(const contract_site& s, const char* what) noexcept
+{
+    std::fprintf(stderr, "%s:%d: contract violation: %s (%s)\n", s.file, s.line, s.expr, what);
+}
+
+[[noreturn, gnu::cold, gnu::noinline]] inline void contract_fail_terminate(contract_site& s) noexcept
+{
+    contract_count(s);
+    contract_print(s, "terminating");
+    std::terminate();
+}
+
+[[noreturn, gnu::cold, gnu::noinline]] inline void contract_fail_throw_error(contract_site& s)
+{
+    contract_count(s);
+    throw contract_violation(s);
+}
+
+[[gnu::cold, gnu::noinline]] inline void contract_fail_log_count(contract_site& s) noexcept
+{
+    if (contract_count(s) == 0)
+        contract_print(s, "counted, the next ones are only counted");
+}
+
+// CONTRACT_CHECK(cheap, throw_error, i < n): level and action are the names of the enumerators. If the level is not compiled in, the
+// condition is in a discarded if constexpr branch: it must compile, but it is never evaluated
+#define CONTRACT_CHECK(level, action, cond)                                                                         \
+    do                                                                                                              \
+    {                                                                                                               \
+        if constexpr (contract_enabled(contract_level::level))                                                      \
+        {                                                                                                           \
+            if (!(cond)) [[unlikely]]                                                                               \
+            {                                                                                                       \
+                static contract_site contract_site_{ #cond, __FILE__, __LINE__, contract_level::level,              \
+                                                     contract_action::action };                                     \
+                contract_fail_##action(contract_site_);                                                             \
+            }                                                                                                       \
+        }                                                                                                           \
+    } while (0)
+
+// the counters at run time: every site that failed at least once (for a log line, a metrics endpoint, the end of a test run)
+inline void contract_report(std::FILE* out)
+{
+    static const char* const levels[] = { "off", "cheap", "audit" };
+    static const char* const actions[] = { "terminate", "throw", "log" };
+    for (const contract_site* s = contract_sites.load(std::memory_order_acquire); s; s = s->next)
+        std::fprintf(out, "%s:%d: %s [%s, %s] failed %lu times\n", s->file, s->line, s->expr, levels[static_cast<int>(s->level)],
+                     actions[static_cast<int>(s->action)], s->violations.load(std::memory_order_relaxed));
+}
+
+// the bounds policy of Matrix (EXCEPTION HIERARCHIES - 5) as contract checks: the sites are these two lines, for every Matrix
+struct contract_checked
+{
+    static void row(std::size_t i, std::size_t rows) { CONTRACT_CHECK(cheap, throw_error, i < rows); }
+    static void col(std::size_t j, std::size_t cols) { CONTRACT_CHECK(cheap, throw_error, j < cols); }
+};
+
+void open_file(std::string fname)
+{
+CONTRACT_CHECK(cheap, throw_error, fname.length() > 0); // instead of assert(fname.length() > 0), stays in the release build
+CONTRACT_CHECK(audit, log_count, is_valid_path(fname)); // only with -DCONTRACT_LEVEL=2
+std::ifstream f(fname.c_str());
+. . .
+}
+
+void f()
+{
+contract_report(stderr); // file.cpp:42: fname.length() > 0 [cheap, throw] failed 3 times
+}
+
+// Basic example of a benchmark: Matrix<float, Check> with unchecked, checked and contract_checked bounds, four access patterns
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+template <class Check>
+struct Kernels
+{
+    using M = Matrix<float, Check>;
+
+    static float sum(const M& m)        // row by row
+    {
+        float s = 0;
+        for (std::size_t i = 0; i < m.rows(); ++i)
+            for (std::size_t j = 0; j < m.cols(); ++j)
+                s += m(i, j);
+        return s;
+    }
+
+    static float stencil(const M& m, M& out)    // 5 point stencil, the indexes are computed
+    {
+        for (std::size_t i = 1; i + 1 < m.rows(); ++i)
+            for (std::size_t j = 1; j + 1 < m.cols(); ++j)
+                out(i, j) = m(i, j) - 0.25f * (m(i - 1, j) + m(i + 1, j) + m(i, j - 1) + m(i, j + 1));
+        return out(1, 1);
+    }
+
+    static float stencil_rows(const M& m, M& out)   // the same, the bounds are checked once per row (first and last element)
+    {
+        const std::size_t c = m.cols();
+        for (std::size_t i = 1; i + 1 < m.rows(); ++i)
+        {
+            const float* up = &m(i - 1, 0);
+            const float* mid = &m(i, 0);
+            const float* down = &m(i + 1, 0);
+            float* o = &out(i, 0);
+            (void)m(i + 1, c - 1);
+            (void)out(i, c - 1);
+            for (std::size_t j = 1; j + 1 < c; ++j)
+                o[j] = mid[j] - 0.25f * (up[j] + down[j] + mid[j - 1] + mid[j + 1]);
+        }
+        return out(1, 1);
+    }
+
+    static float gather(const M& m, const std::vector<unsigned>& idx)  // the indexes come from data: no check can be proven away
+    {
+        float s = 0;
+        for (std::size_t k = 0; k + 1 < idx.size(); k += 2)
+            s += m(idx[k], idx[k + 1]);
+        return s;
+    }
+};
+
+// the best of 15 rounds, the three variants take turns in every round, so a slow period of the machine hits all of them
+template <class... F>
+void best_ms(double* best, F... f)
+{
+    for (int i = 0; i < int(sizeof...(F)); ++i)
+        best[i] = 1e30;
+    for (int round = 0; round < 15; ++round)
+    {
+        int i = 0;
+        ((void)[&] {
+            auto t0 = std::chrono::steady_clock::now();
+            f();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            best[i] = std::min(best[i], ms);
+            ++i;
+        }(), ...);
+    }
+}
+
+int main()
+{
+    const std::size_t n = 1024;
+    std::mt19937 rng(42);
+    Matrix<float, unchecked> a(n, n);
+    Matrix<float, checked> b(n, n);
+    Matrix<float, contract_checked> c(n, n);
+    Matrix<float, unchecked> ao(n, n);
+    Matrix<float, checked> bo(n, n);
+    Matrix<float, contract_checked> co(n, n);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            a(i, j) = b(i, j) = c(i, j) = float(rng() % 100);
+    std::vector<unsigned> idx(2'000'000);
+    for (unsigned& x : idx)
+        x = rng() % n;
+
+    volatile float sink = 0;
+    std::printf("%-12s %12s %12s %12s %10s\n", "", "unchecked", "checked", "contract", "overhead");
+    auto row = [&](const char* name, auto fu, auto fc, auto fk) {
+        double t[3];
+        best_ms(t, fu, fc, fk);
+        std::printf("%-12s %9.2f ms %9.2f ms %9.2f ms %+9.1f%%\n", name, t[0], t[1], t[2], (t[2] / t[0] - 1) * 100);
+    };
+    row("sum", [&] { sink = Kernels<unchecked>::sum(a); }, [&] { sink = Kernels<checked>::sum(b); },
+        [&] { sink = Kernels<contract_checked>::sum(c); });
+    row("stencil", [&] { sink = Kernels<unchecked>::stencil(a, ao); }, [&] { sink = Kernels<checked>::stencil(b, bo); },
+        [&] { sink = Kernels<contract_checked>::stencil(c, co); });
+    row("stencil/row", [&] { sink = Kernels<unchecked>::stencil_rows(a, ao); },
+        [&] { sink = Kernels<checked>::stencil_rows(b, bo); }, [&] { sink = Kernels<contract_checked>::stencil_rows(c, co); });
+    row("gather", [&] { sink = Kernels<unchecked>::gather(a, idx); }, [&] { sink = Kernels<checked>::gather(b, idx); },
+        [&] { sink = Kernels<contract_checked>::gather(c, idx); });
+
+    for (int k = 0; k < 3; ++k)
+    {
+        try
+        {
+            c(n, 0) = 1;
+        }
+        catch (const contract_violation& e)
+        {
+            if (k == 2)
+                std::printf("caught: %s, the site has failed %lu times\n", e.what(), e.site().violations.load());
+        }
+    }
+}
+
+/*
+The assert above has only two modes. With NDEBUG there is no check at all, and without it every failed check terminates the program. So
+the release build either has no checks, or it has checks that kill it. The contract checks separate the two questions:
+    which checks are compiled in: the level, one for the whole build (-DCONTRACT_LEVEL). The cheap checks stay in the release build.
+    The audit checks are for the checks that cost more than the work they protect, and are left out of it
+    what a failed check does: the action, chosen at each check. terminate is the assert of the release build. throw_error throws
+    contract_violation, a std::logic_error that knows its site. log_count writes the first violation of a site and after that only
+    counts, for the checks where going on is better than stopping (a bad value in a statistics module, not in the flight control)
+Every check has a static contract_site with its own atomic counter. A site gets into the list only when it fails for the first time,
+so contract_report() shows only the checks that failed, with their counts. It can be called at any time, for example from a metrics
+endpoint or at the end of a test run. The site is constant initialized (constexpr constructor), so it has no guard variable and costs
+nothing while the check passes.
+
+The hot path is the condition and one branch marked [[unlikely]]. Everything after it is in [[gnu::cold]] noinline functions, so the
+compiler moves the failure call out of the loop body to the end of the function. With the level off, the condition is in a discarded
+if constexpr branch: it must still compile, so a check can not rot, but it is never evaluated.
+
+contract_checked is the bounds policy of Matrix (EXCEPTION HIERARCHIES - 5) with contract checks. checked is the old policy, which
+throws rowIndexError. The output on my machine (g++ 12 -O2, 1024x1024 floats, best of 15 rounds, CONTRACT_LEVEL=1 (cheap),
+overhead is contract against unchecked):
+
+                    unchecked      checked     contract   overhead
+    sum               0.91 ms      0.92 ms      0.94 ms      +3.1%
+    stencil           1.72 ms      2.40 ms      2.50 ms     +45.4%
+    stencil/row       1.15 ms      1.13 ms      1.17 ms      +1.8%
+    gather            5.20 ms      6.30 ms      6.37 ms     +22.4%
+    caught: i < rows, the site has failed 3 times
+
+The machine is a noisy VM. The same program built with CONTRACT_LEVEL=0, where all three columns run the same code, moves by up to
++-15% between runs. So read these as three groups:
+    sum: the loop is scalar anyway (a float sum is not vectorized without -ffast-math), and the compiler proves most of the checks away
+    with the loop bounds. Within the noise
+    stencil/row: the bounds are checked once per row (the first and the last element of the three rows), and the inner loop uses the
+    row pointers. It has no checks, so it vectorizes like the unchecked one. Within 2%
+    stencil and gather: a check on every element. In the stencil the possible throw in the middle of the loop stops the vectorizer, and
+    in the gather the indexes come from data, so two compares per element remain. This costs 20-45%
+In every row checked and contract are the same: the cost is the branch itself, not the counters or the cold path of the facility. So the
+cheap level is cheap if the checks are where the interface is (a row, a call, a buffer), and not inside the innermost loop.
+*/
+
+
+
+// STATIC ASSERT ERROR HANDLING
+
+#include <type_traits>
+template <typename T>
+
+void swap(T &x, T &y)
+{
+static_assert( std::is_nothrow_move_constructible<T>::value, &&
+std::is_nothrow_move_assignable<T>::value, "Swap may throw" );
+auto tmp = x;
+x = y;
+y = tmp;
+}
+
+#if __STDC_HOSTED__ != 1
+# error "Not a hosted implementation"
+#endif
+
+#if __cplusplus >= 202302L
+# warning "Using #warning as a standard feature"
+#endif
+
+/*
+Since C++ 11 we have static assert. The key difference between static assert and assert is that static assert does the checking in
+compilation time instead of runtime. In some cases stopping the code at compilation time instead of runtime can be more beneficial. That
+is the reason behind using static assert in some cases.
+
+Static assert takes parameters -as seen in the code above-, but these paramaters only can be parameters that are known in compilation time.
+*/
+
+
+
+// STATIC ASSERT ERROR HANDLING - 2 | TRIVIALLY RELOCATABLE TYPES
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A type is trivially relocatable if moving an object to a new address and ending the old one is the same as copying its bytes:
+// the object does not point into itself and nobody remembers its address. Most types are like that (unique_ptr, shared_ptr,
+// vector...), but not all: the std::string of libstdc++ points into its own small buffer.
+//     detected:  every trivially copyable type
+//     opted in:  a class with "using trivially_relocatable_for = Self;" inside, or a specialization of the trait
+// The tag names the class itself because member typedefs are inherited: a class derived from an opted in one (with a libstdc++
+// string member, say) would be opted in too, if the tag were only a true_type
+
+template <class T, class = void>
+struct has_relocatable_tag : std::false_type { };
+
+template <class T>
+struct has_relocatable_tag<T, std::void_t<typename T::trivially_relocatable_for>>
+    : std::is_same<typename T::trivially_relocatable_for, T> { };
+
+template <class T>
+struct is_trivially_relocatable
+    : std::bool_constant<std::is_trivially_copyable<T>::value || has_relocatable_tag<T>::value> { };
+
+template <class T>
+inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<std::remove_cv_t<T>>::value;
+
+// the standard types that only hold pointers to the heap (true for libstdc++ and libc++)
+template <class T>
+struct is_trivially_relocatable<std::unique_ptr<T>> : std::true_type { };
+
+template <class T>
+struct is_trivially_relocatable<std::shared_ptr<T>> : std::true_type { };
+
+template <class T>
+struct is_trivially_relocatable<std::vector<T>> : std::true_type { };
+
+template <class A, class B>
+struct is_trivially_relocatable<std::pair<A, B>>
+    : std::bool_constant<is_trivially_relocatable_v<A> && is_trivially_relocatable_v<B>> { };
+
+#if defined(_LIBCPP_VERSION)
+template <>
+struct is_trivially_relocatable<std::string> : std::true_type { };  // the libc++ string has no pointer to itself
+#endif
+
+// moves n objects from src to the raw memory at dest; the objects at src are gone after it, their destructors must not run.
+// The ranges may overlap (shifting inside a buffer)
+template <class T>
+void relocate_bytes(T* dest, T* src, std::size_t n) noexcept
+{
+    static_assert(is_trivially_relocatable_v<T>, "T is not trivially relocatable");
+    if (n)
+        std::memmove(static_cast<void*>(dest), static_cast<const void*>(src), n * sizeof(T));
+}
+
+// The swap from above, for relocatable types: three copies of the bytes instead of a move construction and two move
+// assignments, and it can not throw, whatever the move operations of T do. x and y must be complete objects (not base
+// class parts of a bigger object, whose padding may be used by the derived class)
+template <class T>
+void swap_relocatable(T& x, T& y) noexcept
+{
+    static_assert(is_trivially_relocatable_v<T>, "Swap may throw");
+    alignas(T) unsigned char tmp[sizeof(T)];
+    std::memcpy(tmp, static_cast<const void*>(&x), sizeof(T));
+    std::memcpy(static_cast<void*>(&x), static_cast<const void*>(&y), sizeof(T));
+    std::memcpy(static_cast<void*>(&y), tmp, sizeof(T));
+}
+
+struct Widget // an own type that opts in
+{
+    using trivially_relocatable_for = Widget;
+    std::unique_ptr<int> data;
+    std::vector<double> values;
+};
+
+struct NamedWidget : Widget // inherits the tag, but it names Widget: a std::string can point into itself
+{
+    std::string name;
+};
+
+static_assert(is_trivially_relocatable_v<int> && is_trivially_relocatable_v<Widget>);
+static_assert(!is_trivially_relocatable_v<NamedWidget>);
+static_assert(is_trivially_relocatable_v<std::pair<std::unique_ptr<int>, long>>);
+
+// Basic example of a benchmark: reallocation (reserve), insert / erase at the front, Vec against std::vector
+
+#include <chrono>
+#include <cstdio>
+
+struct Pod { long a, b, c, d; };
+
+template <class C, class Make>
+void relocation_bench(const char* name, Make make)
+{
+    const std::size_t n = 200'000, rounds = 50, shifts = 200, small = 100'000;
+    C c;
+    c.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        c.push_back(make(i));
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (std::size_t round = 0; round < rounds; ++round)
+        c.reserve(c.capacity() + 1);    // every call moves all n elements into a new buffer
+    auto t1 = std::chrono::steady_clock::now();
+
+    C d;
+    d.reserve(small + 1);
+    for (std::size_t i = 0; i < small; ++i)
+        d.push_back(make(i));
+    auto t2 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < shifts; ++i)
+    {
+        d.insert(d.begin(), make(i));   // shifts every element one place up
+        d.erase(d.begin());             // and back
+    }
+    auto t3 = std::chrono::steady_clock::now();
+
+    double realloc_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / double(rounds * n);
+    double shift_ns = std::chrono::duration<double, std::nano>(t3 - t2).count() / (2.0 * shifts * small);
+    std::printf("%-34s %8.2f ns %8.2f ns  %6.1f GB/s\n", name, realloc_ns, shift_ns, sizeof(c[0]) / realloc_ns);
+}
+
+int main()
+{
+    auto pod = [](std::size_t i) { return Pod{ long(i), 0, 0, 0 }; };
+    auto uptr = [](std::size_t i) { return std::make_unique<long>(i); };
+    auto str = [](std::size_t i) { return std::string(i % 2 ? "short" : "a string that does not fit into the small buffer"); };
+
+    std::printf("%-34s %11s %11s %10s\n", "", "realloc", "shift", "realloc");
+    relocation_bench<std::vector<Pod>>("std::vector<Pod>", pod);
+    relocation_bench<Vec<Pod>>("Vec<Pod>", pod);
+    relocation_bench<std::vector<std::unique_ptr<long>>>("std::vector<unique_ptr<long>>", uptr);
+    relocation_bench<Vec<std::unique_ptr<long>>>("Vec<unique_ptr<long>>", uptr);
+    relocation_bench<std::vector<std::string>>("std::vector<string>", str);
+    relocation_bench<Vec<std::string>>("Vec<string> (not relocatable here)", str);
+
+    std::string s1 = "x", s2 = "y";
+    std::unique_ptr<int> p1 = std::make_unique<int>(1), p2 = std::make_unique<int>(2);
+    swap_relocatable(p1, p2);
+    // swap_relocatable(s1, s2);   // compile error with libstdc++: Swap may throw
+    std::printf("%d %d\n", *p1, *p2);
+}
+
+/*
+Moving an element to a new buffer is a move construction and a destruction of the old element, for every element: for a unique_ptr
+that is a copy of the pointer, a write of nullptr into the old one, and a check of the old one in the destructor. The result is the
+same as copying the bytes of the pointer and forgetting the old object, and memcpy does that for a whole buffer at once. This is what
+"trivially relocatable" means (there is a proposal for C++26 with the same name). The compiler can not detect it, because a move
+constructor is user code, so the trait detects the trivially copyable types and the others have to opt in, with a member typedef or
+a specialization. The typedef names the class (trivially_relocatable_for = Widget), not just true: it is inherited, and a derived
+class that adds a libstdc++ string must not be memcpy'd because its base was. The specializations above are for the standard types that are only pointers to the heap.
+
+Vec (STRONG GUARANTEE EXAMPLE - 2) uses the trait in every place where the elements change address:
+    reserve() and the growth in emplace_back() / emplace(): one memcpy into the new buffer, the old elements are not destroyed
+    emplace() in the middle: the new element is built first in a local buffer (it may throw, nothing has changed yet, and the
+    arguments may refer into the vector), then one memmove opens the gap and memcpy puts the new element in
+    erase(): destroys the element and closes the gap with one memmove
+A bonus is the exception safety: copying bytes can not throw, so these are strong (and nothrow after the allocation) even for types
+whose move constructor is not noexcept. Vec::swap() swaps three pointers already, swap_relocatable() is the same idea for single
+objects: it replaces the static_assert + three moves of the swap template above.
+
+std::string is the counterexample: libstdc++ keeps a pointer to the small buffer inside the object, a copy of the bytes would point
+into the old object. It stays on the element by element path with this standard library.
+
+The output on my machine (g++ 12 -O2, ns per element; realloc is reserve() of 200000 elements, shift is insert + erase at the front
+of 100000 elements):
+
+                                           realloc       shift    realloc
+    std::vector<Pod>                      15.41 ns     1.18 ns     2.1 GB/s
+    Vec<Pod>                              15.07 ns     1.20 ns     2.1 GB/s
+    std::vector<unique_ptr<long>>          0.84 ns     0.74 ns     9.5 GB/s
+    Vec<unique_ptr<long>>                  0.75 ns     0.22 ns    10.7 GB/s
+    std::vector<string>                   14.38 ns     2.41 ns     2.2 GB/s
+    Vec<string> (not relocatable here)    18.11 ns     4.07 ns     1.8 GB/s
+
+Pod was already trivially copyable, std::vector uses memmove for it too, so the two are the same (the reallocation of a 6 MB buffer is
+mostly the page faults of the new memory, not the copy). For unique_ptr the shift is 3x faster: the element by element move has to
+write nullptr into every source, the memmove does not. The reallocation gains less, there the new memory dominates again. std::string
+is not relocatable with libstdc++, so Vec moves it element by element like before; the difference to std::vector there changes from
+run to run, it is the same loop.
+*/
+
+
+
+// EXCEPTION HANDLING WITH SETJMP/LONGJMP IN C
+
+// ONE C SOURCE FILE
+
+#include <setjmp.h>
+#include <stdio.h>
+jmp_buf x;
+int main()
+{
+int i = 0;
+if ( (i = setjmp(x)) == 0 ) // try
+{
+f();
+}
+else // catch
+{
+switch( i )
+{
+case 1: handler1(); break;
+case 2: handler2(); break;
+default: fprintf( stdout, "error code = %d\n", i); break;
+}
+}
+return 0;
+}
+
+// ANOTHER C SOURCE FILE
+
+// perhaps in another source file
+#include <setjmp.h>
+extern jmp_buf x;
+void f()
+{
+    // ...
+    g();
+}
+void g()
+{
+if ( something_wrong() )
+{
+longjmp(x,2); // throw
+}
+}
+
+/*
+Exception handling is an important part of developing softwares. It gives us the chance to store and cetegories bugs and also
+understand when a bug happens and why did it happen.
+
+In the C standard library there were setjmp/longjmp macros that are used by creating a jump buffer variable and when the control flow started
+we called the setjmp macro and gave the already created variable to it as a parameter. This macro is basically represented the current state of the
+program. The variable was basically the definition of the stack heap.
+
+The setjmp/longjmp pair was used frequently in C programs. For example, in parser codes it was a good way to handle exceptions.
+The longjmp has it's name because it not only can do "go to" in the source file, but between source files as well.
+*/
+
+
+
+// EXCEPTIONS IN C++
+
+try // dangerous area
+{
+    f(); // someth
+}
+catch (T1 e1) { /* handler for T1 */ }
+catch (T2 e2) { /* handler for T2 */ }
+catch (T3 e3) { /* handler for T3 */ }
+void f()
+{
+    //...
+    T e;
+    throw e; /* throws exception of type T */
+    // or:
+    throw T(); /* throws default value of T */
+}
+
+/*
+When we throw an exception in C++ than that object will be copied into a static memory space. Static, const variables will be copied as well
+into a static memory space. This is crucial because in the code above if we throw an exception without this mechanic the first object that would
+be thrown is e1, so the program would crash. Copying object to a static memory space is the key when we are doing exceptions handling in C++.
+
+Since we have the move semantic (C++11) they would be moved. This is a better and more efficient approach.
+
+The key is that we don't catch the object e, but it's copied version that is stored in the static memory space. If we cannot move or copy an object
+then we cannot throw that object as an exception.
+
+The interesting part is that since e has a copy in the static memory space (so there is two of it) hence the e1 at the catch period also has a copy on
+the static memory space. This can lead to more memory overhead, but we can call e1 by a reference and that reference would refer to the object located
+in the static memory space.
+*/
+
+
+
+// EXCEPTIONS IN C++ - 2 | MEASURING THE ERROR HANDLING STRATEGIES
+
+#include <csetjmp>
+#include <type_traits>
+
+// the same call chain five times: Depth levels of calls, the leaf fails if x < 0. Every level is a separate
+// function (a template), so the compiler cannot turn the recursion into a loop
+
+// 1. return codes: every level has to check and pass the code up
+template <int Depth>
+[[gnu::noinline]] int chain_rc(int x, int& out)
+{
+    if constexpr (Depth == 0)
+    {
+        if (x < 0)
+            return 2;
+        out = x * 3;
+        return 0;
+    }
+    else
+    {
+        if (int rc = chain_rc<Depth - 1>(x, out))
+            return rc;
+        out += Depth;
+        return 0;
+    }
+}
+
+// 2. errno: the value is returned, the error goes to a (thread local) global that the caller checks
+thread_local int my_errno = 0;
+
+template <int Depth>
+[[gnu::noinline]] int chain_errno(int x)
+{
+    if constexpr (Depth == 0)
+    {
+        if (x < 0)
+        {
+            my_errno = 2;
+            return 0;
+        }
+        return x * 3;
+    }
+    else
+    {
+        int r = chain_errno<Depth - 1>(x);
+        if (my_errno)
+            return 0;
+        return r + Depth;
+    }
+}
+
+// 3. exceptions: no check on the way up, the unwinder does the work when something is thrown
+struct chain_error { int code; };
+
+template <int Depth>
+[[gnu::noinline]] int chain_exc(int x)
+{
+    if constexpr (Depth == 0)
+    {
+        if (x < 0)
+            throw chain_error{2};
+        return x * 3;
+    }
+    else
+    {
+        return chain_exc<Depth - 1>(x) + Depth;
+    }
+}
+
+// 4. setjmp/longjmp: like exceptions, but no destructors are called on the way (only use it with trivial frames)
+std::jmp_buf chain_env;
+
+template <int Depth>
+[[gnu::noinline]] int chain_jmp(int x)
+{
+    if constexpr (Depth == 0)
+    {
+        if (x < 0)
+            std::longjmp(chain_env, 2);
+        return x * 3;
+    }
+    else
+    {
+        return chain_jmp<Depth - 1>(x) + Depth;
+    }
+}
+
+// 5. an expected-style result type (std::expected is C++23), checked at every level like a return code.
+// The value and the error share the storage like in std::expected; this sketch only takes trivial types
+template <class T, class E>
+class Result
+{
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<E>::value, "sketch only");
+
+public:
+    Result(T v) : val(v), ok(true) { }
+    static Result error(E e) { Result r; r.err = e; r.ok = false; return r; }
+
+    explicit operator bool() const noexcept { return ok; }
+    bool has_value() const noexcept { return ok; }
+    T& value() & { return val; }                        // like operator* of std::expected: no check
+    const E& error() const& { return err; }
+
+private:
+    Result() = default;
+    union { T val; E err; };
+    bool ok;
+};
+
+template <int Depth>
+[[gnu::noinline]] Result<int, int> chain_res(int x)
+{
+    if constexpr (Depth == 0)
+    {
+        if (x < 0)
+            return Result<int, int>::error(2);
+        return x * 3;
+    }
+    else
+    {
+        Result<int, int> r = chain_res<Depth - 1>(x);
+        if (!r)
+            return r;
+        return r.value() + Depth;
+    }
+}
+
+// one call from the top of the chain with each mechanism, returns 1 if the call failed
+
+template <int Depth>
+int top_rc(int x, long long& sum)
+{
+    int out;
+    if (chain_rc<Depth>(x, out))
+        return 1;
+    sum += out;
+    return 0;
+}
+
+template <int Depth>
+int top_errno(int x, long long& sum)
+{
+    my_errno = 0;
+    int r = chain_errno<Depth>(x);
+    if (my_errno)
+        return 1;
+    sum += r;
+    return 0;
+}
+
+template <int Depth>
+int top_exc(int x, long long& sum)
+{
+    try
+    {
+        sum += chain_exc<Depth>(x);
+        return 0;
+    }
+    catch (const chain_error&)
+    {
+        return 1;
+    }
+}
+
+template <int Depth>
+int top_jmp(int x, long long& sum)
+{
+    if (setjmp(chain_env) == 0) // try
+    {
+        sum += chain_jmp<Depth>(x);
+        return 0;
+    }
+    return 1;                   // catch
+}
+
+template <int Depth>
+int top_res(int x, long long& sum)
+{
+    Result<int, int> r = chain_res<Depth>(x);
+    if (!r)
+        return 1;
+    sum += r.value();
+    return 0;
+}
+
+// Basic example of a benchmark: ns per call for depths 1..64 and error rates 0%..50% (and 100%: the error path alone)
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using top_fn = int (*)(int, long long&);
+
+template <template <int> class Top>
+struct for_depths
+{
+    // every mechanism is instantiated for depth 1, 4, 16 and 64
+    static constexpr top_fn fns[4] = { Top<1>::f, Top<4>::f, Top<16>::f, Top<64>::f };
+};
+
+template <int D> struct rc_t    { static int f(int x, long long& s) { return top_rc<D>(x, s); } };
+template <int D> struct errno_t { static int f(int x, long long& s) { return top_errno<D>(x, s); } };
+template <int D> struct exc_t   { static int f(int x, long long& s) { return top_exc<D>(x, s); } };
+template <int D> struct jmp_t   { static int f(int x, long long& s) { return top_jmp<D>(x, s); } };
+template <int D> struct res_t   { static int f(int x, long long& s) { return top_res<D>(x, s); } };
+
+int main()
+{
+    struct { const char* name; const top_fn* fns; } mechanisms[] = {
+        { "return code", for_depths<rc_t>::fns }, { "errno", for_depths<errno_t>::fns },
+        { "exception", for_depths<exc_t>::fns }, { "setjmp/longjmp", for_depths<jmp_t>::fns },
+        { "Result<T, E>", for_depths<res_t>::fns },
+    };
+    const int depths[] = { 1, 4, 16, 64 };
+    const double rates[] = { 0.0, 0.01, 0.1, 0.5, 1.0 };
+    const int calls = 200'000;
+
+    std::printf("%-15s %5s", "", "depth");
+    for (double rate : rates)
+        std::printf(" %8.0f%%", rate * 100);
+    std::printf("   (ns per call)\n");
+
+    for (auto& m : mechanisms)
+    {
+        for (int d = 0; d < 4; ++d)
+        {
+            std::printf("%-15s %5d", m.name, depths[d]);
+            for (double rate : rates)
+            {
+                std::mt19937 rng(42);
+                std::bernoulli_distribution fails(rate);
+                std::vector<int> input(calls);
+                for (int& x : input)
+                    x = fails(rng) ? -1 : static_cast<int>(rng() % 1000);
+
+                long long sum = 0;
+                int errors = 0;
+                auto t0 = std::chrono::steady_clock::now();
+                for (int x : input)
+                    errors += m.fns[d](x, sum);
+                auto t1 = std::chrono::steady_clock::now();
+                std::printf(" %9.1f", std::chrono::duration<double, std::nano>(t1 - t0).count() / calls);
+                if (sum + errors == 42)
+                    std::printf("!");   // keeps the results alive
+            }
+            std::printf("\n");
+        }
+    }
+}
+
+/*
+The claim at the top of this file was that exceptions can be faster than checking the return value of every function. This benchmark
+runs the same call chain with five mechanisms: return codes, errno, exceptions, setjmp/longjmp and an expected-style Result<T, E>
+(std::expected only arrives in C++23, but the idea is the same: the value or the error in one object, checked by the caller).
+The 0% column is the happy path, the 100% column is the error path alone.
+
+The output on my machine (g++ 12 -O2, x86-64 VM, ns per call):
+
+                    depth        0%        1%       10%       50%      100%
+    return code         1       5.3       5.4       6.4      12.6       8.2
+    return code         4       9.9      10.4       8.1      16.9      12.4
+    return code        16      27.5      26.2      35.1      58.8      61.8
+    return code        64     642.6     660.8     684.6     726.2     785.1
+    errno               1       5.4       5.4       6.9      12.3       7.0
+    errno               4       9.1       9.2      11.2      17.4      13.3
+    errno              16      28.3      29.0      34.2      61.1      60.8
+    errno              64     748.9     738.2     792.5     777.8     753.1
+    exception           1       3.8      24.7     203.7    1230.5    2136.5
+    exception           4      11.0      46.8     334.7    1751.8    2373.4
+    exception          16      22.7     121.1     804.8    3590.0    7208.4
+    exception          64     751.9     942.0    2787.5   11874.5   24473.9
+    setjmp/longjmp      1      13.7      20.7      14.3      31.4      39.0
+    setjmp/longjmp      4      17.7      15.2      16.8      31.5      34.4
+    setjmp/longjmp     16      50.4      29.4      40.5      48.5      46.8
+    setjmp/longjmp     64     721.1     761.6     579.8     436.7      85.4
+    Result<T, E>        1       7.0       7.2       8.3      14.2       8.6
+    Result<T, E>        4      12.2      11.9      13.1      20.1      15.2
+    Result<T, E>       16      38.0      58.9      28.9      71.0      62.9
+    Result<T, E>       64     719.4     685.7     666.4     737.7     674.8
+
+What we can read from it:
+    On the happy path (0%) exceptions are the fastest or as fast as the others: there is nothing to check on the way back, the cost is
+    paid only when something is thrown. This is what the claim in the notes means.
+    A throw costs about 2 microseconds, and the unwinding adds about 300 ns for every frame. With 1% errors exceptions are already
+    the slowest at depth 16, with 10% they are many times slower. So exceptions are for errors that are really exceptional.
+    setjmp has a fixed cost on every call (it saves the registers), but longjmp itself is cheap and does not depend on the depth.
+    The price is that no destructors run on the way, so it is only usable with C-like frames.
+    Return codes, errno and Result are about the same, the branch on every level is well predicted.
+    At depth 64 everything jumps to ~700 ns: the CPU can only predict about 16 return addresses, so the returns of a deeper chain are
+    mispredicted whatever the error handling is.
+
+The code size of the hot functions (one level of the chain) with nm -C -S --size-sort, and the size of the whole benchmark with size:
+
+    0000000000000011 W int chain_exc<1>(int)               17 bytes
+    0000000000000011 W int chain_jmp<1>(int)               17 bytes
+    0000000000000012 W int chain_rc<1>(int, int&)          18 bytes
+    0000000000000021 W Result<int, int> chain_res<1>(int)  33 bytes
+    0000000000000029 W int chain_errno<1>(int)             41 bytes (reading a thread_local is not free)
+
+       text    data     bss     dec     hex filename
+      31235     912     236   32383    7e7f bench
+
+The exception version has no check code in the function at all, but it needs the unwind tables (.eh_frame) and the landing pads of the
+callers, which are counted in the binary and not in the function. On latency critical paths where errors are frequent (parsing user
+input, I/O that often fails) the return value based ones (Result or error codes) are the better choice, for rare errors exceptions are fine.
+*/
+
+
+
+// EXCEPTIONS IN C++ - 3 | MANY THREADS THROWING AT ONCE
+
+// Opt-in with -DTHROW_POOL, like THROW_STATS below: it replaces functions of the C++ runtime and of the unwinder, and the sizes
+// are the ones of libstdc++ on x86-64 (Linux, glibc)
+#if defined(THROW_POOL)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>      // dlsym(RTLD_NEXT)
+#include <exception>
+#include <link.h>       // dl_iterate_phdr
+#include <mutex>
+
+struct dwarf_eh_bases   // the same as in unwind-dw2-fde.h of libgcc
+{
+    void* tbase;
+    void* dbase;
+    void* func;
+};
+
+class ThrowPool
+{
+public:
+    static constexpr std::size_t abi_header = 128;  // sizeof(__cxa_refcounted_exception): the runtime's data before the object
+    static constexpr std::size_t max_object = 112;  // bigger exception objects come from malloc, like before
+    static constexpr std::size_t n_blocks = 16;     // per thread: exceptions alive at the same time (nested, in exception_ptrs)
+    static constexpr std::size_t n_cached = 256;    // unwind table lookups cached per thread
+
+    // the replacements call these
+    static void* allocate(std::size_t size) noexcept;
+    static void release(void* obj) noexcept;
+    static const void* find_fde(void* pc, dwarf_eh_bases* bases) noexcept;
+
+private:
+    struct Pool;
+
+    // [ Block | the runtime's header | the exception object ], the object stays aligned to 16 like with malloc
+    struct alignas(16) Block
+    {
+        Pool* owner;    // nullptr: the block is from malloc, from_runtime(): from the runtime's allocator
+        Block* next;
+    };
+    static constexpr std::size_t block_size = sizeof(Block) + abi_header + max_object;
+
+    // Only the owner thread takes blocks from free and puts them back there. Another thread can end the life of an exception too
+    // (an exception_ptr moved to it), it gives the block back through remote, which the owner takes over all at once
+    struct Pool
+    {
+        Block* free = nullptr;
+        std::atomic<Block*> remote{ nullptr };
+        Pool* next_orphan = nullptr;
+        alignas(64) unsigned char storage[n_blocks][block_size];
+    };
+
+    struct Cached
+    {
+        void* pc;
+        const void* fde;
+        dwarf_eh_bases bases;
+    };
+
+    // the number of shared objects loaded and unloaded so far, any change empties the cache (libgcc checks the same counters)
+    struct Loaded
+    {
+        unsigned long long adds = 0;
+        unsigned long long subs = 0;
+        bool known = false;
+
+        bool operator==(const Loaded&) const = default;
+    };
+
+    static int read_loaded(dl_phdr_info* info, std::size_t size, void* data) noexcept
+    {
+        if (size < offsetof(dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+            return 1;       // an old loader without the counters: known stays false, nothing is cached
+        Loaded* loaded = static_cast<Loaded*>(data);
+        loaded->adds = info->dlpi_adds;
+        loaded->subs = info->dlpi_subs;
+        loaded->known = true;
+        return 1;           // the counters are the same for every object, the first one is enough
+    }
+
+    // The pool of a finished thread may still have exceptions alive somewhere, so it is not freed: the next new thread takes it over
+    struct Owner
+    {
+        Pool* pool = nullptr;
+
+        Pool* get() noexcept
+        {
+            if (!pool)
+                pool = adopt();
+            return pool;
+        }
+
+        ~Owner()
+        {
+            if (pool)
+            {
+                std::lock_guard<std::mutex> lock(orphans_mutex);
+                pool->next_orphan = orphans;
+                orphans = pool;
+                pool = nullptr;
+            }
+        }
+    };
+
+    static Pool* adopt() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(orphans_mutex);    // once per thread, not per throw
+            if (Pool* p = orphans)
+            {
+                orphans = p->next_orphan;
+                return p;
+            }
+        }
+        Pool* p = new (std::nothrow) Pool;
+        if (p)
+        {
+            for (std::size_t k = 0; k < n_blocks; ++k)
+            {
+                Block* b = reinterpret_cast<Block*>(p->storage[k]);
+                b->owner = p;
+                b->next = p->free;
+                p->free = b;
+            }
+        }
+        return p;
+    }
+
+    // the owner of the blocks that malloc could not give: the runtime's allocator has an emergency pool for that case
+    static Pool* from_runtime() noexcept
+    {
+        static char tag;
+        return reinterpret_cast<Pool*>(&tag);
+    }
+
+    static Block* block_of(void* obj) noexcept
+    {
+        return reinterpret_cast<Block*>(static_cast<char*>(obj) - abi_header - sizeof(Block));
+    }
+
+    static void* object_of(Block* b) noexcept
+    {
+        std::memset(b + 1, 0, abi_header);     // the runtime expects its header zeroed
+        return reinterpret_cast<char*>(b + 1) + abi_header;
+    }
+
+    static thread_local Owner owner;
+    static inline std::mutex orphans_mutex;
+    static inline Pool* orphans = nullptr;
+};
+
+thread_local ThrowPool::Owner ThrowPool::owner;
+
+void* ThrowPool::allocate(std::size_t size) noexcept
+{
+    if (size <= max_object)
+    {
+        if (Pool* p = owner.get())
+        {
+            if (!p->free)
+                p->free = p->remote.exchange(nullptr, std::memory_order_acquire);
+            if (Block* b = p->free)
+            {
+                p->free = b->next;
+                return object_of(b);
+            }
+        }
+    }
+    Pool* from = nullptr;
+    Block* b = static_cast<Block*>(std::malloc(sizeof(Block) + abi_header + size));
+    if (!b)
+    {
+        // out of memory: the real one takes it from its emergency pool (or terminates, as it would without ThrowPool).
+        // It gets the whole block as the object, so its own header in front of it is not used
+        using allocate_fn = void* (*)(std::size_t);
+        static const allocate_fn real = reinterpret_cast<allocate_fn>(dlsym(RTLD_NEXT, "__cxa_allocate_exception"));
+        b = static_cast<Block*>(real(sizeof(Block) + abi_header + size));
+        from = from_runtime();
+    }
+    b->owner = from;
+    return object_of(b);
+}
+
+void ThrowPool::release(void* obj) noexcept
+{
+    Block* b = block_of(obj);
+    Pool* p = b->owner;
+    if (!p)
+    {
+        std::free(b);
+    }
+    else if (p == from_runtime())
+    {
+        using free_fn = void (*)(void*);
+        static const free_fn real = reinterpret_cast<free_fn>(dlsym(RTLD_NEXT, "__cxa_free_exception"));
+        real(b);
+    }
+    else if (p == owner.pool)
+    {
+        b->next = p->free;
+        p->free = b;
+    }
+    else
+    {
+        b->next = p->remote.load(std::memory_order_relaxed);
+        while (!p->remote.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+}
+
+// The unwinder looks up the unwind table entry (the FDE) of every frame twice, once when it searches for the handler and once when
+// it cleans up. The same throw goes through the same return addresses every time, so a small direct mapped cache per thread makes
+// most of the lookups a compare. The misses are not cached: the code may be loaded later. A dlopen / dlclose anywhere in the process
+// (also the ones that do not go through this executable) changes the counters of dl_iterate_phdr, and that empties the cache
+const void* ThrowPool::find_fde(void* pc, dwarf_eh_bases* bases) noexcept
+{
+    using find_fn = const void* (*)(void*, dwarf_eh_bases*);
+    static const find_fn real = reinterpret_cast<find_fn>(dlsym(RTLD_NEXT, "_Unwind_Find_FDE"));
+    static thread_local Cached cache[n_cached];
+    static thread_local Loaded cache_loaded;
+
+    Loaded loaded;
+    dl_iterate_phdr(read_loaded, &loaded);
+    if (!loaded.known)
+        return real(pc, bases);
+    if (!(cache_loaded == loaded))
+    {
+        std::memset(cache, 0, sizeof(cache));
+        cache_loaded = loaded;
+    }
+    Cached& c = cache[(reinterpret_cast<std::uintptr_t>(pc) * 0x9E3779B97F4A7C15u >> 32) % n_cached];
+    if (c.pc == pc && c.fde)
+    {
+        *bases = c.bases;
+        return c.fde;
+    }
+    const void* fde = real(pc, bases);
+    if (fde)
+        c = { pc, fde, *bases };
+    return fde;
+}
+
+// The replacements: a definition in the executable comes before the one in libstdc++.so / libgcc_s.so, also for their own calls
+extern "C" void* __cxa_allocate_exception(std::size_t size) noexcept { return ThrowPool::allocate(size); }
+extern "C" void __cxa_free_exception(void* obj) noexcept { ThrowPool::release(obj); }
+extern "C" const void* _Unwind_Find_FDE(void* pc, dwarf_eh_bases* bases) { return ThrowPool::find_fde(pc, bases); }
+
+#endif // THROW_POOL
+
+// Basic example of a benchmark: throws per second of the whole process with 1 - 64 threads, with and without -DTHROW_POOL
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+struct Base { virtual ~Base() = default; };    // the hierarchy from EXCEPTION HIERARCHIES
+struct Der1 : public Base { };
+struct Der2 : public Base { };
+struct Der3 : public Der2 { };
+
+[[gnu::noinline]] void fail(unsigned k, int depth)   // a few frames between the throw and the handler
+{
+    if (depth > 0)
+    {
+        fail(k, depth - 1);
+        asm volatile("");   // not a tail call
+        return;
+    }
+    switch (k % 3)
+    {
+    case 0: throw Der1();
+    case 1: throw Der2();
+    default: throw Der3();
+    }
+}
+
+long throw_loop(int n, unsigned seed)
+{
+    long caught = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        try
+        {
+            fail(seed >> 16, 4);
+        }
+        catch (const Der3&)
+        {
+            caught += 3;
+        }
+        catch (const Der2&)
+        {
+            caught += 2;
+        }
+        catch (const Base&)
+        {
+            caught += 1;
+        }
+    }
+    return caught;
+}
+
+int main()
+{
+    const int total = 640'000;
+#if defined(THROW_POOL)
+    std::printf("THROW_POOL\n");
+#else
+    std::printf("runtime\n");
+#endif
+    std::printf("%7s %14s %12s\n", "threads", "throws / s", "ns / throw");
+    for (int threads : { 1, 2, 4, 8, 16, 32, 64 })
+    {
+        double s = 1e9;
+        std::atomic<long> sum{ 0 };
+        for (int run = 0; run < 3; ++run)   // the best of 3
+        {
+            std::vector<std::thread> workers;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int t = 0; t < threads; ++t)
+                workers.emplace_back([&, t] { sum += throw_loop(total / threads, t + 1); });
+            for (std::thread& w : workers)
+                w.join();
+            s = std::min(s, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+        }
+        std::printf("%7d %14.0f %12.1f%s\n", threads, total / s, s * 1e9 / total, sum > 0 ? "" : " ?");
+    }
+}
+
+/*
+"The thrown object is copied into a static memory space" (EXCEPTIONS IN C++ above) is how the language describes it. In libstdc++ that
+space is the heap: __cxa_allocate_exception() mallocs the object together with 128 bytes of bookkeeping of the runtime, and
+__cxa_free_exception() frees it when the last handler or exception_ptr is done with it. Then the unwinder walks the frames twice (search,
+then cleanup), and for every frame it looks up the unwind table entry of the return address with _Unwind_Find_FDE(). That lookup is the
+part that used to serialize the threads: older libgcc / glibc found the table of the shared object with dl_iterate_phdr(), under the
+global lock of the dynamic loader, so N threads throwing at once waited for each other. (With glibc 2.35 and gcc 12 the lookup goes
+through _dl_find_object(), which takes no lock, but it is still a search in every frame.)
+
+The -DTHROW_POOL mode replaces these functions with the same trick as ThrowStats below (a definition in the executable comes first):
+    every thread gets a pool of 16 blocks for the exception objects (up to 112 bytes, all of the Der types and most exceptions are
+    much smaller). Taking and giving back a block is a pointer swap without atomics. An exception can die on another thread (an
+    exception_ptr passed to it), then its block goes back to the owner through a lock-free list, and the pool of a finished thread is
+    taken over by the next new thread, because its blocks may still be in use. Bigger objects and an empty pool fall back to malloc,
+    and when malloc fails, to the real __cxa_allocate_exception() and its emergency pool, the same as without THROW_POOL
+    _Unwind_Find_FDE() gets a cache per thread: 256 entries, direct mapped by the return address. A throw from the same place goes
+    through the same return addresses every time, so after the first one every lookup is a compare. Like libgcc, every lookup first
+    reads the counters of loaded and unloaded objects from dl_iterate_phdr() (dlpi_adds, dlpi_subs), and a change empties the cache,
+    whoever called dlopen() / dlclose(). That call takes the lock of the loader for a moment, so what the cache saves is the search,
+    not the lock. Code that is generated at run time and registered with __register_frame is not supported
+The sizes come from libstdc++ on x86-64 (the 128 bytes of the header were measured), so this is a mode for a known platform,
+not portable code.
+
+The output on my machine (g++ 12 -O2, glibc 2.36, 640000 throws of Der1 / Der2 / Der3 through 5 frames, caught by a
+Der3 / Der2 / Base cascade, divided between the threads, the best of 3 runs):
+
+    runtime                                     THROW_POOL
+    threads     throws / s   ns / throw         threads     throws / s   ns / throw
+          1         483334       2069.0               1         499136       2003.5
+          2         437876       2283.8               2         488022       2049.1
+          4         424754       2354.3               4         495915       2016.5
+          8         418775       2387.9               8         484205       2065.2
+         16         471268       2121.9              16         439049       2277.6
+         32         473667       2111.2              32         458008       2183.4
+         64         457665       2185.0              64         403204       2480.1
+
+This machine has a single core, so it can not show the scaling itself: all the threads share one CPU, and both curves are flat. What it
+shows is that the lock-free parts do not cost anything when many threads take turns (no convoy on a lock, the differences between
+the rows are the noise of the machine), and the cost of one throw, which is about the same with and without THROW_POOL. The cache
+saves the search in the 13 lookups per throw here, but the dl_iterate_phdr() call that reads the counters before every lookup costs
+about as much with this glibc, whose own lookup (_dl_find_object) is already fast. Without the check the throw was about 15% cheaper,
+and wrong: after a dlclose() that the executable does not see, a stale entry would give the unwinder a table that is not mapped
+any more. With an older glibc, where the real lookup walks all the objects under the lock, the check is the cheap part. The pool
+alone does not change the single thread time, the thread cache of glibc malloc is as fast for one thread. The pool is for many cores:
+there the mallocs of the exceptions of all threads and the frees on other threads go to shared arenas, the pool keeps them local.
+The rest of the 2 microseconds is the personality routine and the interpretation of the unwind tables, which is per frame work that
+no cache removes: the real fix for throughput is still to throw less (see the Result and error_code sections).
+*/
+
+
+
+// HOW DOES HANDLING WORKS
+
+/*
+A handler of type H catches the exception of type E if:
+    H and E is the same type
+    H is unambiguous base type of E
+    H and E are pointers or references and some of the above
+    stands
+*/
+
+// EXCEPTION HIERARCHIES
+
+class Base { … };
+class Der1 : public Base { … };
+class Der2 : public Base { … };
+class Der3 : public Der2 { … };
+try
+{
+    f();
+// …
+}
+catch (Der3 &e1) { /* handler for Der3 */ } /* the most derived handler first */
+catch (Der2 &e2) { /* handler for Der2 */ }
+catch (Der1 &e3) { /* handler for Der1 */ }
+catch (Base &e3) { /* handler for Base */ } /* the base handler last */
+void f()
+{
+    if ( ... )
+        throw Der3(); /* throw the most derived type */
+}
+
+/*
+We should pay attention to how to catch the created object (because the stack works in a LIFO system) we have to do the catch in a
+reverse system.
+
+Imagine that we throw the base handler first then we won't be able to get access to the other handlers, so they would not get to work
+meaning we won't use them. If we throw Der3 handler first than we can get to every handler and at the end for the base class handler.
+
+Also pay attention that the objects in the catches are called with reference. This is for getting access to the object that is created in the
+static memory space, so we avoid memory overhead.
+*/
+
+
+
+// EXCEPTION HIERARCHIES - 2
+
+class net_error { ... };
+class file_error { ... };
+class nfs_error : public net_error, public file_error { ... };
+void f()
+{
+    try
+{
+    …
+}
+    catch( nfs_error nfs ) { ... }
+    catch( file_error fe ) { ... }
+    catch( net_error ne ) { ... }
+}
+
+/*
+Doing inheritance -or multiple inheritance- with exceptions is possible and sometimes even beneficial. If I want to catch a bug with handler a and handler b
+then it can be very useful to do inheritance (Network Filesystems, for example). In network filesystem we can catch filesystem errors and networks errors with
+different handlers. In case of inheritance it can be a very useful approach.
+*/
+
+
+
+// RE-THROW
+
+class Base { … };
+class Der1 : public Base { … };
+void g()
+{
+    throw Der1; // throw derived exception Der1
+}
+void f()
+try // function block itself can be try block
+{
+    g();
+}
+catch ( Base b ) // catch Base by value: copied, since C++11 can be moved
+{
+    must_do_at_exception(b);
+    throw; // re-throw original exception Der1
+}
+catch ( ... ) // catch all
+{
+    must_do_at_exception();
+    throw; // re-throw original exception
+}
+
+/*
+Re-throw can be useful when a handler cannot handle the given job so it throws it to another handler in a higher hierarchy that will do the handling.
+Also if a handle only can solve a part of it then it is possible to throw it, so another handler can solve the rest of the job (it has to work with)
+the original object and not the sliced one! In this case it is important to note that we must re-throw the original object, and not the sliced one.
+
+Re-throw happens in the catch phase and we know if it's a re-throw if the throw does not have any parameters, so we will throw the object that evoke the
+original exception.
+
+In the code above when we do the re-throw we do not throw the Base b. The der1 will be copied into the static memory location which is the base class, so
+we will throw the copy that is stored in the static memory location. If we would say throw(b) then we would throw the original object and not the copied version
+that is located in the static memory. THIS IS AN IMPORTANT PART OF RE-THROWING!
+
+(...) -> this is an universal handler which catches "everything". This is the most general handler. If we have this handler then we must write it as the lowest handler
+and of course it should not be at the top of the hierarchy. In this case always think of the "szita efektus".
+*/
+
+
+
+// EXCEPTION HIERARCHIES - 3 | WHY IS IT USEFUL TO CREATE EXCEPTION HIERARCHIES?
+
+#include <stdexcept>
+
+struct matrixError // perhaps member in class Matrix
+{
+    matrixError(std::string r) : reason(r) { }
+    std::string reason;
+    virtual ~matrixError() { } // we know that we will be working with inheritance, so we need a virtual destructor
+};
+
+struct indexError : public matrixError, public std::out_of_range
+{
+    indexError(int i, const char *r = "Bad index") : matrixError(r), out_of_range(r), index(i)
+    {
+        std::ostringstream os;
+        os << index;
+        reason += ", index = ";
+        reason += os.str();
+    }
+
+    const char *what() const noexcept override
+    {
+        return reason.c_str();
+    }
+
+    virtual ~indexError() { }
+    int index;
+};
+
+struct rowIndexError : public indexError
+{
+    rowIndexError(int i) : indexError(i, "Bad row index") { }
+};
+
+struct colIndexError : public indexError
+{
+    colIndexError(int i) : indexError(i, "Bad col index") { }
+};
+
+/*
+The main point of creating exception hierarchies is that we can express the bugs and handle them in the most sophisticated way.
+*/
+
+
+
+// COUNTING THE HEAP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// The benchmarks below that count allocations are linked with this, they reset the counters before the part they measure. Every block
+// has a header with its size, so operator delete knows how much to take off. The counters are relaxed atomics, so the thread pool can
+// use it as well. operator new[] and the nothrow versions call these, the aligned versions are not counted
+static std::atomic<std::size_t> n_allocs{ 0 }, cur_bytes{ 0 }, peak_bytes{ 0 };
+
+constexpr std::size_t heap_header = alignof(std::max_align_t);     // keeps the block as aligned as malloc made it
+
+void* operator new(std::size_t n)
+{
+    n_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (n > SIZE_MAX - heap_header)     // a huge new[] must not wrap around to a tiny block
+        throw std::bad_alloc();
+    std::size_t* p = static_cast<std::size_t*>(std::malloc(n + heap_header));
+    if (!p)
+        throw std::bad_alloc();
+    *p = n;
+    const std::size_t cur = cur_bytes.fetch_add(n, std::memory_order_relaxed) + n;
+    std::size_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (cur > peak && !peak_bytes.compare_exchange_weak(peak, cur, std::memory_order_relaxed))
+    {
+    }
+    return reinterpret_cast<char*>(p) + heap_header;
+}
+
+void operator delete(void* q) noexcept
+{
+    if (!q)
+        return;
+    std::size_t* p = reinterpret_cast<std::size_t*>(static_cast<char*>(q) - heap_header);
+    cur_bytes.fetch_sub(*p, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void operator delete(void* q, std::size_t) noexcept { operator delete(q); }
+
+/*
+One counter for all the benchmarks instead of a copy in every section. n_allocs is the number of operator new calls, cur_bytes the heap
+in use and peak_bytes its maximum since the last reset (peak_bytes = cur_bytes.load()). The header makes every block 16 bytes bigger
+than the request (alignof(max_align_t) on x86-64, sizeof is 32), which is the same for all the versions we compare. The atomics and the
+header cost about 10 ns per allocation, that only shows where the allocations themselves are measured (STRONG GUARANTEE EXAMPLE - 3).
+The runtime allocates the exception objects with malloc, so they are not in the counters.
+*/
+
+
+
+// EXCEPTION HIERARCHIES - 4 | THE SAME HIERARCHY WITHOUT HEAP ALLOCATION
+
+#include <charconv> // std::to_chars
+#include <cstring>
+#include <stdexcept>
+
+struct matrixError // perhaps member in class Matrix
+{
+    explicit matrixError(const char* r) noexcept : reason(r) { }
+    const char* reason; // always a string literal, nothing to copy or free
+    virtual ~matrixError() { }
+};
+
+struct indexError : public matrixError, public std::out_of_range
+{
+    indexError(int i, const char* r = "Bad index") noexcept : indexError(i, r, proto) { }
+
+    const char* what() const noexcept override { return msg; }  // "<reason>, index = <i>"
+
+    virtual ~indexError() { }
+    int index;
+
+protected:
+    // the std::out_of_range base is copied from a prototype, one per class: the libstdc++ message string is reference
+    // counted, so the copy does not allocate (constructing it from a const char* would). The prototypes are made before
+    // main(), a bad_alloc in a noexcept constructor would be std::terminate
+    indexError(int i, const char* r, const std::out_of_range& base) noexcept
+        : matrixError(r), out_of_range(base), index(i)
+    {
+        // formatted here and not in what(): what() is const and may be called by many threads at once (a shared exception_ptr)
+        std::size_t n = std::strlen(reason);
+        if (n > sizeof(msg) - 24)
+            n = sizeof(msg) - 24;
+        std::memcpy(msg, reason, n);
+        std::memcpy(msg + n, ", index = ", 10);
+        char* end = std::to_chars(msg + n + 10, msg + sizeof(msg) - 1, index).ptr;
+        *end = '\0';
+    }
+
+private:
+    static inline const std::out_of_range proto{ "Bad index" };
+
+    char msg[64];  // inline, copied with the exception object
+};
+
+struct rowIndexError : public indexError
+{
+    explicit rowIndexError(int i) noexcept : indexError(i, "Bad row index", proto) { }
+
+private:
+    static inline const std::out_of_range proto{ "Bad row index" };
+};
+
+struct colIndexError : public indexError
+{
+    explicit colIndexError(int i) noexcept : indexError(i, "Bad col index", proto) { }
+
+private:
+    static inline const std::out_of_range proto{ "Bad col index" };
+};
+
+// Basic example of a benchmark: throw/catch latency and allocations per throw, before and after
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+
+namespace before // the hierarchy from the previous section
+{
+    struct matrixError
+    {
+        matrixError(std::string r) : reason(r) { }
+        std::string reason;
+        virtual ~matrixError() { }
+    };
+
+    struct indexError : public matrixError, public std::out_of_range
+    {
+        indexError(int i, const char *r = "Bad index") : matrixError(r), out_of_range(r), index(i)
+        {
+            std::ostringstream os;
+            os << index;
+            reason += ", index = ";
+            reason += os.str();
+        }
+        const char *what() const noexcept override { return reason.c_str(); }
+        virtual ~indexError() { }
+        int index;
+    };
+
+    struct rowIndexError : public indexError
+    {
+        rowIndexError(int i) : indexError(i, "Bad row index") { }
+    };
+}
+
+// the allocations are counted by the operator new of COUNTING THE HEAP
+
+template <class E>
+[[gnu::noinline]] void check_row(int i, int rows)
+{
+    if (i >= rows)
+        throw E(i);
+}
+
+template <class E>
+void throw_bench(const char* name)
+{
+    const int n = 200'000;
+    long caught = 0;
+    n_allocs = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        try
+        {
+            check_row<E>(i, 0);
+        }
+        catch (const std::out_of_range& e)  // the old catch sites still work
+        {
+            caught += e.what()[0] == 'B';
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    std::printf("%-28s %7.1f ns per throw, %4.2f operator new calls per throw (%ld)\n", name,
+                std::chrono::duration<double, std::nano>(t1 - t0).count() / n, double(n_allocs) / n, caught);
+}
+
+int main()
+{
+    throw_bench<before::rowIndexError>("before (ostringstream)");
+    throw_bench<rowIndexError>("after (inline what())");
+}
+
+/*
+The old indexError does a lot of work for one bad index: the message of std::out_of_range (the const char* is copied into a heap
+string), the std::ostringstream (with its own locale), os.str() and the reason string of matrixError, which grows past the small string
+buffer. That is all in the constructor, so we pay it even if the handler never looks at the message.
+
+The new version keeps the same classes and the same multiple inheritance, so catch (std::out_of_range&) and catch (matrixError&) sites
+work without any change. The differences:
+    matrixError stores a const char* to a string literal instead of a std::string
+    the constructor formats "Bad row index, index = 5" with std::to_chars into a 64 byte buffer inside the exception object, and
+    what() returns it. The buffer is copied with the object, so the pointer is valid as long as the object
+    the std::out_of_range base is copy-constructed from a static prototype of the class, made before main(). In libstdc++ the message
+    of the standard exceptions is a reference counted string, so the copy is only an atomic increment instead of an allocation
+One thing stays: the exception object itself is allocated by the runtime (__cxa_allocate_exception uses malloc, not operator new, with
+an emergency pool if malloc fails). That is one malloc per throw whatever we do.
+
+The message could be formatted lazily, in the first what() call, because most handlers never ask for it. But what() is const, and an
+exception shared through an exception_ptr can be read by two threads at once, so it would need a lock or an atomic flag. to_chars into
+a buffer costs a few nanoseconds, next to the microseconds of the throw, so the constructor does it.
+
+The output on my machine:
+
+    before (ostringstream)        2461.9 ns per throw, 2.00 operator new calls per throw (200000)
+    after (inline what())         1737.9 ns per throw, 0.00 operator new calls per throw (200000)
+
+So most of the cost of a throw is the unwinding itself (see EXCEPTIONS IN C++ - 2), but a quarter to a third of it was the construction
+of the message (the "after" line moved between 1480 and 2160 ns in five runs, the "before" one between 2410 and 2820 ns).
+*/
+
+
+
+// EXCEPTION HIERARCHIES - 5 | THE MATRIX CLASS FOR THE HIERARCHY
+
+#include <algorithm>
+#include <cstddef>
+#include <experimental/simd> // Parallelism TS 2, in libstdc++ since GCC 11
+#include <vector>
+
+namespace stdx = std::experimental;
+
+// bounds checking policies: the checked one throws the exceptions from above, the unchecked one compiles to nothing
+struct checked
+{
+    static void row(std::size_t i, std::size_t rows) { if (i >= rows) throw rowIndexError(static_cast<int>(i)); }
+    static void col(std::size_t j, std::size_t cols) { if (j >= cols) throw colIndexError(static_cast<int>(j)); }
+};
+
+struct unchecked
+{
+    static void row(std::size_t, std::size_t) noexcept { }
+    static void col(std::size_t, std::size_t) noexcept { }
+};
+
+template <class T, class Check = checked>
+class Matrix
+{
+public:
+    using value_type = T;
+
+    Matrix() = default;
+    Matrix(std::size_t rows, std::size_t cols, T init = T()) : r(rows), c(cols), v(rows * cols, init) { }
+
+    std::size_t rows() const noexcept { return r; }
+    std::size_t cols() const noexcept { return c; }
+    T* data() noexcept { return v.data(); }
+    const T* data() const noexcept { return v.data(); }
+    T* row_ptr(std::size_t i) noexcept { return v.data() + i * c; }
+    const T* row_ptr(std::size_t i) const noexcept { return v.data() + i * c; }
+
+    T& operator()(std::size_t i, std::size_t j) noexcept(noexcept(Check::row(i, r)))
+    {
+        Check::row(i, r);
+        Check::col(j, c);
+        return v[i * c + j];
+    }
+
+    const T& operator()(std::size_t i, std::size_t j) const noexcept(noexcept(Check::row(i, r)))
+    {
+        Check::row(i, r);
+        Check::col(j, c);
+        return v[i * c + j];
+    }
+
+    // always checked, whatever the policy is (like std::vector::at)
+    T& at(std::size_t i, std::size_t j)
+    {
+        checked::row(i, r);
+        checked::col(j, c);
+        return v[i * c + j];
+    }
+
+    Matrix transpose() const
+    {
+        constexpr std::size_t tile = 32;    // a 32x32 tile of both matrices fits into L1
+        Matrix t(c, r);
+        for (std::size_t ii = 0; ii < r; ii += tile)
+            for (std::size_t jj = 0; jj < c; jj += tile)
+                for (std::size_t i = ii; i < std::min(ii + tile, r); ++i)
+                    for (std::size_t j = jj; j < std::min(jj + tile, c); ++j)
+                        t.v[j * r + i] = v[i * c + j];
+        return t;
+    }
+
+    Matrix& operator+=(const Matrix& m) { return elementwise(m, [](auto a, auto b) { return a + b; }); }
+    Matrix& operator-=(const Matrix& m) { return elementwise(m, [](auto a, auto b) { return a - b; }); }
+    Matrix& hadamard(const Matrix& m) { return elementwise(m, [](auto a, auto b) { return a * b; }); }
+
+    Matrix& operator*=(T s)
+    {
+        for_simd(v.data(), v.size(), [s](auto& a) { a *= s; });
+        return *this;
+    }
+
+    friend Matrix operator+(Matrix a, const Matrix& b) { return a += b; }
+    friend Matrix operator-(Matrix a, const Matrix& b) { return a -= b; }
+
+    friend Matrix operator*(const Matrix& a, const Matrix& b)
+    {
+        if (a.c != b.r)
+            throw matrixError("Matrix size mismatch");
+        Matrix m(a.r, b.c);
+        multiply(a, b, m);
+        return m;
+    }
+
+private:
+    using simd = stdx::native_simd<T>;
+    static constexpr std::size_t W = simd::size();
+
+    // f(simd&) on full vectors, f(T&) on the tail
+    template <class F>
+    static void for_simd(T* p, std::size_t n, F f)
+    {
+        std::size_t i = 0;
+        for (; i + W <= n; i += W)
+        {
+            simd a(p + i, stdx::element_aligned);
+            f(a);
+            a.copy_to(p + i, stdx::element_aligned);
+        }
+        for (; i < n; ++i)
+            f(p[i]);
+    }
+
+    template <class F>
+    Matrix& elementwise(const Matrix& m, F f)
+    {
+        if (r != m.r || c != m.c)
+            throw matrixError("Matrix size mismatch");
+        T* p = v.data();
+        const T* q = m.v.data();
+        std::size_t n = v.size(), i = 0;
+        for (; i + W <= n; i += W)
+        {
+            simd a(p + i, stdx::element_aligned), b(q + i, stdx::element_aligned);
+            f(a, b).copy_to(p + i, stdx::element_aligned);
+        }
+        for (; i < n; ++i)
+            p[i] = f(p[i], q[i]);
+        return *this;
+    }
+
+    // C += A * B, blocked so that a KB x JB panel of B stays in the L2 cache while all the rows of A go through it.
+    // The micro kernel keeps a 4 x 2W block of C in registers over the whole k loop
+    static void multiply(const Matrix& a, const Matrix& b, Matrix& m)
+    {
+        constexpr std::size_t KB = 256, JB = 512;
+        const std::size_t n = a.r, p = a.c, q = b.c;
+        for (std::size_t kk = 0; kk < p; kk += KB)
+        {
+            const std::size_t ke = std::min(kk + KB, p);
+            for (std::size_t jj = 0; jj < q; jj += JB)
+            {
+                const std::size_t je = std::min(jj + JB, q);
+                std::size_t i = 0;
+                for (; i + 4 <= n; i += 4)
+                {
+                    std::size_t j = jj;
+                    for (; j + 2 * W <= je; j += 2 * W)
+                        kernel_4x2(a, b, m, i, j, kk, ke);
+                    for (std::size_t r4 = i; r4 < i + 4; ++r4)
+                        scalar_tail(a, b, m, r4, j, je, kk, ke);
+                }
+                for (; i < n; ++i)
+                    scalar_tail(a, b, m, i, jj, je, kk, ke);
+            }
+        }
+    }
+
+    static void kernel_4x2(const Matrix& a, const Matrix& b, Matrix& m, std::size_t i, std::size_t j,
+                           std::size_t kk, std::size_t ke)
+    {
+        simd acc[4][2];
+        for (int r4 = 0; r4 < 4; ++r4)
+        {
+            acc[r4][0].copy_from(m.row_ptr(i + r4) + j, stdx::element_aligned);
+            acc[r4][1].copy_from(m.row_ptr(i + r4) + j + W, stdx::element_aligned);
+        }
+        for (std::size_t k = kk; k < ke; ++k)
+        {
+            simd b0(b.row_ptr(k) + j, stdx::element_aligned), b1(b.row_ptr(k) + j + W, stdx::element_aligned);
+            for (int r4 = 0; r4 < 4; ++r4)
+            {
+                simd x = a.v[(i + r4) * a.c + k];   // broadcast
+                acc[r4][0] += x * b0;
+                acc[r4][1] += x * b1;
+            }
+        }
+        for (int r4 = 0; r4 < 4; ++r4)
+        {
+            acc[r4][0].copy_to(m.row_ptr(i + r4) + j, stdx::element_aligned);
+            acc[r4][1].copy_to(m.row_ptr(i + r4) + j + W, stdx::element_aligned);
+        }
+    }
+
+    static void scalar_tail(const Matrix& a, const Matrix& b, Matrix& m, std::size_t i, std::size_t j0,
+                            std::size_t je, std::size_t kk, std::size_t ke)
+    {
+        for (std::size_t k = kk; k < ke; ++k)
+        {
+            const T x = a.v[i * a.c + k];
+            for (std::size_t j = j0; j < je; ++j)
+                m.v[i * m.c + j] += x * b.v[k * b.c + j];
+        }
+    }
+
+    std::size_t r = 0, c = 0;
+    std::vector<T> v;
+};
+
+// Basic example of a benchmark: GFLOP/s of the naive triple loop and of operator* (usage: bench max_size max_naive_size)
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+template <class M>
+M naive(const M& a, const M& b)
+{
+    M m(a.rows(), b.cols());
+    for (std::size_t i = 0; i < a.rows(); ++i)
+        for (std::size_t j = 0; j < b.cols(); ++j)
+        {
+            typename M::value_type s = 0;
+            for (std::size_t k = 0; k < a.cols(); ++k)
+                s += a(i, k) * b(k, j);
+            m(i, j) = s;
+        }
+    return m;
+}
+
+template <class F>
+double seconds(F f)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t max_n = argc > 1 ? std::atol(argv[1]) : 4096;
+    std::size_t max_naive = argc > 2 ? std::atol(argv[2]) : 1024;   // the naive 4096 takes minutes
+
+    using M = Matrix<float, unchecked>;
+    std::printf("%6s %14s %14s %14s\n", "n", "naive GFLOP/s", "tiled GFLOP/s", "max |diff|");
+    for (std::size_t n = 64; n <= max_n; n *= 2)
+    {
+        M a(n, n), b(n, n);
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+            {
+                a(i, j) = float((i * 7 + j * 3) % 17) / 17;
+                b(i, j) = float((i * 5 + j * 11) % 13) / 13;
+            }
+        double flop = 2.0 * n * n * n;
+        M c1, c2;
+        double t_tiled = seconds([&] { c2 = a * b; });
+        if (n <= max_naive)
+        {
+            double t_naive = seconds([&] { c1 = naive(a, b); });
+            float diff = 0;
+            for (std::size_t i = 0; i < n * n; ++i)
+                diff = std::max(diff, std::abs(c1.data()[i] - c2.data()[i]));
+            std::printf("%6zu %14.2f %14.2f %14g\n", n, flop / t_naive * 1e-9, flop / t_tiled * 1e-9, diff);
+        }
+        else
+        {
+            std::printf("%6zu %14s %14.2f\n", n, "-", flop / t_tiled * 1e-9);
+        }
+    }
+
+    Matrix<float> checked_m(2, 3);
+    try
+    {
+        checked_m(1, 3) = 1.0f;
+    }
+    catch (const std::out_of_range& e)
+    {
+        std::printf("%s\n", e.what());     // Bad col index, index = 3
+    }
+}
+
+/*
+The matrixError comment says "perhaps member in class Matrix", so here is the Matrix. The elements are in one contiguous std::vector,
+row after row (row-major), so a row is a plain array that the SIMD instructions can load directly.
+
+The bounds checking is a policy, a template parameter: Matrix<T, checked> throws rowIndexError / colIndexError from operator(), and
+Matrix<T, unchecked> has empty inline functions in their place, so after inlining there is nothing left of them. at() checks with both
+policies, like std::vector::at(). operator() is also noexcept with the unchecked policy, because noexcept(noexcept(Check::row(i, r)))
+asks the policy (the noexcept operator from the NOEXCEPT OPERATOR section).
+
+The multiply is where the speed is:
+    the naive i-j-k loop walks B column by column, so every b(k, j) is a cache miss for big matrices
+    the i-k-j order walks B and C row by row, so the inner loop is contiguous and can be vectorized
+    blocking: a 256 x 512 panel of B is reused by all rows of A while it is still in the L2 cache
+    the micro kernel keeps a 4 x 16 block of C (for float and AVX2: 4 rows x 2 simd vectors) in registers for the whole k loop,
+    so every loaded vector of B is used 4 times and C is loaded and stored only once per panel
+The SIMD part uses std::experimental::simd from the Parallelism TS 2, native_simd<float> is 4 floats with SSE, 8 with AVX2 (compile
+with -march=native to get the wider one). transpose() goes in 32 x 32 tiles, so both the reads and the writes stay in the cache.
+
+The output on my machine (g++ 12 -O2 -march=native, float, single thread, the naive loop is skipped above 1024):
+
+         n  naive GFLOP/s  tiled GFLOP/s     max |diff|
+        64           1.87          17.21              0
+       128           1.54          21.00              0
+       256           1.68          26.09              0
+       512           1.31          33.33              0
+      1024           0.23          28.33              0
+      2048              -          25.04
+      4096              -          15.97
+    Bad col index, index = 3
+
+At 1024 the naive loop falls off a cliff (every step of k jumps 4 KB in B, the rows of B do not fit into the cache any more), the tiled one
+is 100x faster there. At 4096 the tiled one slows down too, because the 4 rows of A that the micro kernel reads are far apart in memory,
+copying (packing) the panels of A and B into contiguous buffers would be the next step, like the BLAS libraries do.
+*/
+
+
+
+// EXCEPTION HIERARCHIES - 6 | THE HIERARCHY AS A VARIANT, DISPATCH WITHOUT THE UNWINDER
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+// the parameter type of a handler (a lambda or a function object with one, non-template operator())
+template <class F> struct handler_arg : handler_arg<decltype(&F::operator())> { };
+template <class C, class R, class A> struct handler_arg<R (C::*)(A) const> { using type = std::remove_cvref_t<A>; };
+template <class C, class R, class A> struct handler_arg<R (C::*)(A)> { using type = std::remove_cvref_t<A>; };
+template <class R, class A> struct handler_arg<R (*)(A)> { using type = std::remove_cvref_t<A>; };
+template <class F> using handler_arg_t = typename handler_arg<std::remove_cvref_t<F>>::type;
+
+// row j of the "is a base of" matrix: is_base_of<Hs[k], H> for every k
+template <class H, class... Hs>
+constexpr std::array<bool, sizeof...(Hs) + 1> bases_of() { return { std::is_base_of_v<Hs, H>..., false }; }
+
+// Which handler would a catch cascade written in the right order pick for E? The one whose type is E or a base of E,
+// and is derived from every other such handler. Returns sizeof...(Hs) if none matches, sizeof...(Hs) + 1 if the
+// best is ambiguous (like net_error and file_error for an nfs_error), both are compile errors in dispatch()
+template <class E, class... Hs>
+constexpr std::size_t pick_handler()
+{
+    constexpr std::size_t n = sizeof...(Hs);
+    constexpr std::array<bool, n + 1> match = bases_of<E, Hs...>();
+    constexpr std::array<std::array<bool, n + 1>, n + 1> below = { bases_of<Hs, Hs...>()... };
+
+    std::size_t best = n;
+    for (std::size_t j = 0; j < n; ++j)
+    {
+        if (!match[j])
+            continue;
+        bool covers_all = true;
+        for (std::size_t k = 0; k < n; ++k)
+            covers_all = covers_all && (!match[k] || below[j][k]);
+        if (covers_all)
+            return j;
+        best = n + 1;
+    }
+    return best;
+}
+
+// how many of Es are (proper) bases of E
+template <class E, class... Es>
+constexpr std::size_t n_bases() { return ((std::is_base_of_v<Es, E> && !std::is_same_v<Es, E>) + ... + 0); }
+
+// a closed set of error types, like one catch cascade: Es are the types, with their inheritance
+template <class... Es>
+class ErrorVariant
+{
+    static_assert(sizeof...(Es) > 0);
+
+public:
+    template <class E, class = std::enable_if_t<(std::is_same_v<std::remove_cvref_t<E>, Es> || ...)>>
+    ErrorVariant(E&& e) : v(std::forward<E>(e)) { }
+
+    std::size_t index() const noexcept { return v.index(); }
+
+    template <class E>
+    bool holds() const noexcept { return std::holds_alternative<E>(v); }
+
+    // Calls the handler that a catch cascade in the right order would call, whatever the order of the handlers is:
+    // dispatch([](const Base&) { ... }, [](const Der2&) { ... }) calls the Der2 one for a Der3. The choice is made at compile
+    // time for every type of the set, the call goes through a table indexed with index(), so it is one indirect call
+    template <class... Hs>
+    decltype(auto) dispatch(Hs&&... hs) const
+    {
+        using R = std::common_type_t<std::invoke_result_t<Hs&, const handler_arg_t<Hs>&>...>;
+        using Handlers = std::tuple<Hs&...>;
+        Handlers handlers(hs...);
+        return table<R, Handlers, handler_arg_t<Hs>...>[v.index()](v, handlers);
+    }
+
+    // The bridge from exceptions: catches the exception with the same most derived first order, with a single rethrow.
+    // Exceptions that are not in the set give std::nullopt
+    static std::optional<ErrorVariant> from(const std::exception_ptr& p)
+    {
+        try
+        {
+            return catch_from<0>(p);
+        }
+        catch (...)
+        {
+            return std::nullopt;
+        }
+    }
+
+    // and back: throws the error as an exception (its own type, so every catch cascade still works)
+    [[noreturn]] void raise() const
+    {
+        std::visit([](const auto& e) { throw e; }, v);
+        std::terminate();   // not reached, std::visit can not be [[noreturn]]
+    }
+
+private:
+    template <std::size_t I>
+    using nth = std::variant_alternative_t<I, std::variant<Es...>>;
+
+    template <class R, class Handlers, class... Args, std::size_t... I>
+    static constexpr auto make_table(std::index_sequence<I...>)
+    {
+        using Fn = R (*)(const std::variant<Es...>&, Handlers&);
+        constexpr std::size_t n = sizeof...(Args);
+        static_assert(((pick_handler<Es, Args...>() != n) && ...), "dispatch: an error type of the set has no handler");
+        static_assert(((pick_handler<Es, Args...>() != n + 1) && ...), "dispatch: ambiguous handlers for an error type");
+        return std::array<Fn, sizeof...(Es)>{ &call<I, std::min(pick_handler<nth<I>, Args...>(), n - 1), R, Handlers>... };
+    }
+
+    template <class R, class Handlers, class... Args>
+    static constexpr auto table = make_table<R, Handlers, Args...>(std::index_sequence_for<Es...>{ });
+
+    template <std::size_t I, std::size_t J, class R, class Handlers>
+    static R call(const std::variant<Es...>& v, Handlers& hs)
+    {
+        return std::get<J>(hs)(*std::get_if<I>(&v));
+    }
+
+    // Catching in increasing number of bases from the outside in means that the innermost catch (tried first) is the
+    // most derived one, the same order as a hand written cascade
+    static constexpr std::array<std::size_t, sizeof...(Es)> order = [] {
+        constexpr std::size_t rank[] = { n_bases<Es, Es...>()... };
+        std::array<std::size_t, sizeof...(Es)> o{ };
+        for (std::size_t k = 0; k < o.size(); ++k)
+            o[k] = k;
+        std::sort(o.begin(), o.end(), [&](std::size_t a, std::size_t b) { return rank[a] < rank[b] || (rank[a] == rank[b] && a < b); });
+        return o;
+    }();
+
+    template <std::size_t K>
+    static ErrorVariant catch_from(const std::exception_ptr& p)
+    {
+        using E = nth<order[K]>;
+        try
+        {
+            if constexpr (K + 1 < sizeof...(Es))
+                return catch_from<K + 1>(p);
+            else
+                std::rethrow_exception(p);
+        }
+        catch (const E& e)
+        {
+            return ErrorVariant(e);
+        }
+    }
+
+    std::variant<Es...> v;
+};
+
+// the two hierarchies from above, as values
+struct Base { virtual ~Base() = default; };
+struct Der1 : public Base { };
+struct Der2 : public Base { };
+struct Der3 : public Der2 { };
+struct net_error { };
+struct file_error { };
+struct nfs_error : public net_error, public file_error { };
+
+using DerError = ErrorVariant<Base, Der1, Der2, Der3>;
+using FsError = ErrorVariant<net_error, file_error, nfs_error>;
+
+DerError g(); // returns the error instead of throwing it
+
+void f()
+{
+DerError e = g();
+e.dispatch([](const Base&) { /* handler for Base and Der1 */ },
+           [](const Der2&) { /* handler for Der2 and Der3 */ }); // the order of the handlers does not matter
+
+FsError fe = nfs_error();
+fe.dispatch([](const net_error&) { ... },
+            [](const file_error&) { ... },
+            [](const nfs_error&) { ... }); // without the nfs_error handler: compile error, ambiguous handlers
+try
+{
+open_remote_file(); // old code that throws
+}
+catch ( ... )
+{
+if ( std::optional<FsError> err = FsError::from(std::current_exception()) ) // the boundary: one rethrow, from here it is a value
+{
+return handle(*err);
+}
+throw; // not one of ours
+}
+}
+
+// Basic example of a benchmark: classifying 4, 16 and 64 error types with a catch cascade, dispatch() and the bridge
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// a tree of N error types: Err<i> is derived from Err<(i - 1) / 2>, so the deepest ones have log2(N) bases
+template <int I> struct Err : public Err<(I - 1) / 2> { };
+template <> struct Err<0> { };
+
+template <int K, int N, class F>
+[[gnu::always_inline]] inline int cascade(F& f)     // catch (Err<N - 1>&) { } ... catch (Err<0>&) { }, most derived first
+{
+    try
+    {
+        if constexpr (K + 1 < N)
+            return cascade<K + 1, N>(f);
+        else
+            return f(), -1;
+    }
+    catch (const Err<K>&)
+    {
+        return K;
+    }
+}
+
+template <int N, int... I>
+void bench(std::integer_sequence<int, I...>)
+{
+    using Error = ErrorVariant<Err<I>...>;
+    static void (*throwers[])() = { [] { throw Err<I>(); }... };
+    static Error (*makers[])() = { [] { return Error(Err<I>()); }... };
+    const int calls = 200'000;
+
+    std::mt19937 rng(42);
+    std::vector<int> which(calls);
+    for (int& k : which)
+        k = rng() % N;
+    std::vector<std::exception_ptr> ptrs;
+    for (int k = 0; k < N; ++k)
+        ptrs.push_back([k] { try { throwers[k](); } catch (...) { return std::current_exception(); } return std::exception_ptr(); }());
+
+    long hits = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int k : which)
+    {
+        auto fail = [k] { throwers[k](); };
+        hits += cascade<0, N>(fail) == k;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int k : which)
+    {
+        Error e = makers[k]();
+        hits += e.dispatch([](const Err<I>&) { return I; }...) == k;
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    for (int k : which)
+        hits += static_cast<int>(Error::from(ptrs[k])->index()) == k;
+    auto t3 = std::chrono::steady_clock::now();
+
+    auto ns = [&](auto d) { return std::chrono::duration<double, std::nano>(d).count() / calls; };
+    std::printf("%5d %14.1f ns %14.1f ns %14.1f ns   %s\n", N, ns(t1 - t0), ns(t2 - t1), ns(t3 - t2),
+                hits == 3L * calls ? "ok" : "WRONG");
+}
+
+int main()
+{
+    std::printf("%5s %17s %17s %17s\n", "types", "throw + cascade", "dispatch()", "from(eptr)");
+    bench<4>(std::make_integer_sequence<int, 4>{ });
+    bench<16>(std::make_integer_sequence<int, 16>{ });
+    bench<64>(std::make_integer_sequence<int, 64>{ });
+}
+
+/*
+A catch cascade classifies the error at run time: the unwinder takes the handlers one after the other and asks the type_info of each
+one whether the thrown type is the same or derived from it (HOW DOES HANDLING WORKS above), and it does this on top of the unwinding.
+If the errors are frequent, or we want to classify an error many times, the same hierarchy can be a value instead: ErrorVariant<Es...>
+is a std::variant of the error types, it is returned like the Result in EXCEPTIONS IN C++ - 2, and it keeps the inheritance of the types.
+
+dispatch() takes the handlers in any order and does the matching at compile time: for every type of the set it chooses the handler that
+a correctly ordered catch cascade would choose, the one that is the same type or the most derived base. So the mistake from EXCEPTION
+HIERARCHIES (the Base handler first shadows all the others) can not happen. If no handler fits a type, or two handlers fit with none of
+them more derived (net_error and file_error for an nfs_error), it is a compile error instead of a silent choice. The chosen handlers
+go into a table of function pointers built at compile time, the call is table[index()], so the cost does not depend on the number of
+handlers or on the depth of the hierarchy.
+
+from() is the bridge at the boundary with code that throws: one rethrow into a generated cascade, ordered by the number of bases each type
+has in the set (a type always has more bases than its own bases, so the most derived ones are tried first). raise() goes the other way.
+
+The output on my machine (g++ 12 -O2, the error type is random for every call, the hierarchy is a binary tree of Err<i> types):
+
+    types   throw + cascade        dispatch()        from(eptr)
+        4         2396.6 ns           15.7 ns         1997.0 ns   ok
+       16         2781.9 ns           21.6 ns         1706.5 ns   ok
+       64         4254.5 ns           49.1 ns         4592.3 ns   ok
+
+The catch cascade gets slower with more types (the unwinder checks the handlers one by one, from the most derived towards Err<0>), the
+dispatch stays within tens of nanoseconds (what grows there is the misprediction of the indirect call on a random type, the table
+lookup is the same). The bridge costs as much as a throw, because it is one, so it is worth it only if the error is converted once and
+then passed around or classified as a value.
+*/
+
+
+
+// STD EXCEPTION HIERARCHY
+
+class exception {}; // in <exception>
+
+class bad_exception : public exception {}; // calls unexpected()
+class bad_weak_ptr : public exception {}; // C++11 weak_ptr -> shared_ptr
+class bad_function_call : public exception {}; // C++11 function::operator()
+class bad_typeid : public exception {}; // typeid(0)
+class bad_cast : public exception {}; // dynamic_cast
+    class bad_any_cast : public bad_cast {}; // C++17
+class bad_variant_access : exception {} // C++17
+class bad_optional_access : exception {} // C++17
+class bad_alloc : public exception {}; // new <new>
+    class bad_array_new_length : bad_alloc {} // C++11, new T[-1]
+
+class logic_error : public exception {};
+    class domain_error : public logic_error {}; // domain error,std::sqrt(-1)
+    class invalid_argument : public logic_error {}; // bitset char != 0 or 1
+    class length_error : public logic_error {}; // length str.resize(-1)
+    class out_of_range : public logic_error {}; // bad index in container or string
+    class future_error : public logic_error {}; // C++11: promise abandons the shared state
+
+class runtime_error : public exception {};
+    class range_error : public runtime_error {}; // floating point ovf or unf
+    class overflow_error : public runtime_error {}; // int overflow INT_MAX+1
+    class underflow_error : public runtime_error {}; // int underflow INT_MIN-1
+    class system_error : public runtime_error {}; // e.g. std::thread constr.
+        class ios_base::failure : public system_error {}; // C++11
+        class filesystem::filesystem_error : public system_error {}; // C++17
+        class nonexistent_local_time : public system_error // C++20
+        class ambigous_local_time : public system_error // C++20
+        class format_error : public system_error // C++20
+
+
+
+// STD EXCEPTION HIERARCHY - 2 | ERROR CODES FOR THE NET / FILE / NFS ERRORS
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+enum class file_errc { not_found = 1, permission_denied, cant_find_record, cant_read_record };
+enum class net_errc { connection_refused = 1, timed_out, unreachable };
+enum class nfs_errc { stale_handle = 1, server_not_responding };
+
+enum class io_condition { file_error = 1, net_error }; // what the handlers ask: "is it a file error?"
+
+namespace std
+{
+    template <> struct is_error_code_enum<file_errc> : true_type { };
+    template <> struct is_error_code_enum<net_errc> : true_type { };
+    template <> struct is_error_code_enum<nfs_errc> : true_type { };
+    template <> struct is_error_condition_enum<io_condition> : true_type { };
+}
+
+// one category object per domain; the messages are string literals, an error_code is an int and a pointer to the category,
+// so making, copying and comparing the codes never allocates (only message() builds a std::string, when somebody prints it)
+class io_error_category : public std::error_category
+{
+public:
+    template <std::size_t N>
+    constexpr io_error_category(const char* name, const char* const (&messages)[N]) noexcept : nm(name), msgs(messages), n(N) { }
+
+    const char* name() const noexcept override { return nm; }
+
+    std::string message(int c) const override { return c > 0 && c <= static_cast<int>(n) ? msgs[c - 1] : "unknown error"; }
+
+    std::error_condition default_error_condition(int c) const noexcept override;
+
+private:
+    const char* nm;
+    const char* const* msgs;
+    std::size_t n;
+};
+
+const std::error_category& file_category() noexcept
+{
+    static const char* const msgs[] = { "no such file", "permission denied", "can't find record", "can't read record" };
+    static const io_error_category c("file", msgs);
+    return c;
+}
+
+const std::error_category& net_category() noexcept
+{
+    static const char* const msgs[] = { "connection refused", "timed out", "unreachable" };
+    static const io_error_category c("net", msgs);
+    return c;
+}
+
+const std::error_category& nfs_category() noexcept
+{
+    static const char* const msgs[] = { "stale file handle", "server not responding" };
+    static const io_error_category c("nfs", msgs);
+    return c;
+}
+
+// file_error is every file and nfs code (and the generic errno codes of a missing / forbidden file),
+// net_error is every net and nfs code: an nfs error is equivalent to both, like nfs_error is derived from both
+class io_condition_category : public std::error_category
+{
+public:
+    const char* name() const noexcept override { return "io"; }
+
+    std::string message(int c) const override { return c == 1 ? "file error" : c == 2 ? "net error" : "unknown error"; }
+
+    bool equivalent(const std::error_code& ec, int cond) const noexcept override
+    {
+        const std::error_category& cat = ec.category();
+        if (cat == nfs_category())
+            return cond == 1 || cond == 2;
+        if (cond == 1)
+            return cat == file_category() || ec == std::errc::no_such_file_or_directory || ec == std::errc::permission_denied;
+        if (cond == 2)
+            return cat == net_category();
+        return false;
+    }
+};
+
+const std::error_category& io_category() noexcept
+{
+    static const io_condition_category c;
+    return c;
+}
+
+// the two file codes that have a portable meaning are also the standard conditions: ec == std::errc::no_such_file_or_directory works
+std::error_condition io_error_category::default_error_condition(int c) const noexcept
+{
+    if (this == &file_category() && c == static_cast<int>(file_errc::not_found))
+        return std::errc::no_such_file_or_directory;
+    if (this == &file_category() && c == static_cast<int>(file_errc::permission_denied))
+        return std::errc::permission_denied;
+    return std::error_condition(c, *this);
+}
+
+std::error_code make_error_code(file_errc e) noexcept { return { static_cast<int>(e), file_category() }; }
+std::error_code make_error_code(net_errc e) noexcept { return { static_cast<int>(e), net_category() }; }
+std::error_code make_error_code(nfs_errc e) noexcept { return { static_cast<int>(e), nfs_category() }; }
+std::error_condition make_error_condition(io_condition e) noexcept { return { static_cast<int>(e), io_category() }; }
+
+// errno of a failed open / read into our domains; the rest stays a generic errno code
+std::error_code io_error_from_errno(int e) noexcept
+{
+    switch (e)
+    {
+    case ENOENT:        return file_errc::not_found;
+    case EACCES:
+    case EPERM:         return file_errc::permission_denied;
+    case ESTALE:        return nfs_errc::stale_handle;          // only network file systems have stale handles
+    case ETIMEDOUT:     return nfs_errc::server_not_responding; // an open that times out is on a network file system too
+    case ECONNREFUSED:  return net_errc::connection_refused;
+    case EHOSTUNREACH:
+    case ENETUNREACH:   return net_errc::unreachable;
+    default:            return std::error_code(e, std::generic_category());
+    }
+}
+
+// the non-throwing overloads: the error goes to ec, like in <filesystem>
+
+int open_file(const char* name, std::error_code& ec) noexcept   // a file descriptor, -1 on error
+{
+    int fd = ::open(name, O_RDONLY | O_CLOEXEC);
+    ec = fd < 0 ? io_error_from_errno(errno) : std::error_code();
+    return fd;
+}
+
+template <class Record>
+const Record* read_record(RecordFile<Record>& file, std::size_t n, std::error_code& ec) noexcept
+{
+    const Record* r = file.get(n);
+    if (r)
+        ec.clear();
+    else if (!file.is_open())
+        ec = io_error_from_errno(file.sys_error());
+    else
+        ec = file.error() == rec_cant_find ? file_errc::cant_find_record : file_errc::cant_read_record;
+    return r;
+}
+
+// The adapter at the API edges: the code becomes one of the exception types from EXCEPTION HIERARCHIES - 2, which is also a
+// std::system_error, so catch (nfs_error&), catch (file_error&), catch (net_error&) and catch (std::system_error&) all work
+template <class Error>
+struct io_exception : public Error, public std::system_error
+{
+    io_exception(std::error_code ec, const char* what) : system_error(ec, what) { }
+};
+
+[[noreturn]] void throw_io_error(std::error_code ec, const char* what)
+{
+    if (ec.category() == nfs_category())
+        throw io_exception<nfs_error>(ec, what);
+    if (ec == io_condition::file_error)
+        throw io_exception<file_error>(ec, what);
+    if (ec == io_condition::net_error)
+        throw io_exception<net_error>(ec, what);
+    throw std::system_error(ec, what);
+}
+
+// and the throwing overloads are thin wrappers
+int open_file(const char* name)
+{
+    std::error_code ec;
+    int fd = open_file(name, ec);
+    if (ec)
+        throw_io_error(ec, name);
+    return fd;
+}
+
+template <class Record>
+const Record& read_record(RecordFile<Record>& file, std::size_t n)
+{
+    std::error_code ec;
+    const Record* r = read_record(file, n, ec);
+    if (ec)
+        throw_io_error(ec, "read_record");
+    return *r;
+}
+
+void f()
+{
+std::error_code ec;
+int fd = open_file("fname", ec);
+if ( ec == io_condition::file_error ) // true for file and nfs errors
+{
+std::fprintf( stderr, "can't open file %s\n", "fname");
+std::fprintf( stderr, "reason: %s (%s)\n", ec.message().c_str(), ec.category().name());
+}
+if ( ec == io_condition::net_error ) // true for net and nfs errors
+{
+retry_later();
+}
+}
+
+// Basic example of a benchmark: 10% of the opens fail, error_code against exceptions (usage: bench dir)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    std::string dir = argc > 1 ? argv[1] : "/tmp";
+    const int opens = 200'000;
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 100; ++i)
+    {
+        std::string name = dir + "/bench_file_" + std::to_string(i);
+        if (i % 10 == 0)
+            ::unlink(name.c_str());                         // 10% of the names do not exist
+        else if (std::FILE* fp = std::fopen(name.c_str(), "w"))
+            std::fclose(fp);
+        names.push_back(name);
+    }
+    std::mt19937 rng(42);
+    std::vector<const char*> order(opens);
+    for (const char*& s : order)
+        s = names[rng() % names.size()].c_str();
+
+    long failed_codes = 0, failed_exceptions = 0, nfs_or_net = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (const char* name : order)
+    {
+        std::error_code ec;
+        int fd = open_file(name, ec);
+        if (ec)
+        {
+            failed_codes += ec == io_condition::file_error;
+            nfs_or_net += ec == io_condition::net_error;
+        }
+        else
+        {
+            ::close(fd);
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (const char* name : order)
+    {
+        try
+        {
+            ::close(open_file(name));
+        }
+        catch (const file_error&)
+        {
+            ++failed_exceptions;
+        }
+        catch (const net_error&)
+        {
+            ++nfs_or_net;
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    for (const std::string& name : names)
+        ::unlink(name.c_str());
+
+    auto ns = [&](auto d) { return std::chrono::duration<double, std::nano>(d).count() / opens; };
+    std::printf("error_code: %7.1f ns per open (%ld failed)\n", ns(t1 - t0), failed_codes);
+    std::printf("exceptions: %7.1f ns per open (%ld failed)\n", ns(t2 - t1), failed_exceptions);
+    std::printf("extra cost of a failure as an exception: %.0f ns\n", (ns(t2 - t1) - ns(t1 - t0)) * opens / failed_exceptions);
+
+    std::error_code ec = nfs_errc::stale_handle;
+    std::printf("%s: %s, file error: %d, net error: %d\n", ec.category().name(), ec.message().c_str(),
+                ec == io_condition::file_error, ec == io_condition::net_error);
+    if (nfs_or_net)     // local files: every failure must be a plain file error
+        std::printf("unexpected nfs / net errors: %ld\n", nfs_or_net);
+}
+
+/*
+The std::error_code is the standard way of the return code strategy: an int plus a pointer to a category object, which knows the name
+and the message of the codes. The codes of one domain can be compared to error conditions of another category, std::system_error (see
+above) carries an error_code, and <filesystem> already has the pattern of two overloads for everything: one that throws and one that
+takes a std::error_code& and is noexcept.
+
+Here every domain of the net / file / nfs hierarchy is a category with an enum of codes (file_errc, net_errc, nfs_errc), and the
+hierarchy itself is an error condition, io_condition. The multiple inheritance of nfs_error becomes io_condition_category::equivalent():
+an nfs code is equal to io_condition::file_error and to io_condition::net_error too. So a handler can ask the same question as the
+catch (file_error&) handler did, ec == io_condition::file_error, without knowing about nfs.
+
+open_file(name, ec) and read_record(file, n, ec) are the non-throwing overloads, the errno of the system calls is mapped into the domains
+(ENOENT is a file error, ESTALE can only happen on a network file system). open_file(name) and read_record(file, n) are the throwing
+ones for the places where exceptions are wanted: throw_io_error() turns the code into io_exception<nfs_error>, io_exception<file_error>
+or io_exception<net_error>, which are the old classes and std::system_error at the same time.
+
+RecordFile got a sys_error() accessor for this, the errno of a failed open.
+
+The output on my machine (g++ 12 -O2, 200000 opens of 100 names, 10 of them missing):
+
+    error_code:  1570.6 ns per open (20069 failed)
+    exceptions:  2062.5 ns per open (20069 failed)
+    extra cost of a failure as an exception: 4903 ns
+    nfs: stale file handle, file error: 1, net error: 1
+
+The open system call itself is about 1.5 microseconds, the same in both loops. A failure reported with an error_code costs nothing on top
+of that, reported with an exception it costs about 5 microseconds: the throw and the unwinding, plus std::system_error builds its what()
+string ("name: no such file") in the constructor. With 10% failing opens this makes the whole loop a third slower, so on I/O paths where
+failing is normal (probing for files, optional config files) the error_code overload is the one to call, and the exception is for the
+edges of the API where the caller can not do anything locally anyway.
+*/
+
+
+
+// EXCEPTION SPECIFICATION BEFORE C++11
+
+class E1;
+class E2;
+
+void f() throw(E1) // throws only E1 or subclasses
+{
+    ...
+    throw E1(); // throws exception of type E1
+    ...
+    throw E2(); // calls unexpected() which calls terminate()
+}
+
+// same as:
+void f()
+try {
+    ...
+}
+catch(E1) { throw; }
+catch(...) { std::unexpected(); }
+
+/*
+The problem is that if f calls function c that calls another function that does exception handling. If this function throws exception that will go through
+function c and then in function f as well. The compiler cannot check it in C.
+
+That is the reason why in C++ the throw(E1) only can throw E1 or its subclasses, but not any other classes avoiding the problem we described above. If E1 comes
+we catch it and throw, but if anything else comes then we abort the code instantly.
+
+Since C++17 this got deleted from the standard.
+
+The code below is a more sophisticated way of throwing exception and we do not terminate the code:
+*/
+
+class E1;
+class E2;
+
+void f() throw(E1, std::bad_exception) // throws only E1 or subclasses
+{
+    ...
+    throw E1(); // throws exception of type E1
+    ...
+    throw E2(); // calls unexpected() which throws bad_exception()
+}
+
+typedef void (*terminate_handler)();
+terminate_handler set_terminate(terminate_handler);
+terminate_handler get_terminate(); // C++11
+
+// until C++17
+typedef void (*unexpected_handler)();
+unexpected_handler set_unexpected(unexpected_handler);
+unexpected_handler get_unexpected(); // C++11
+
+void f() throw() // does not throw, can be optimized
+// People using the f() function could assume that this function does not throw exception since the () after the throw is empty, so
+// they could optimize it. The problem is that during compilation time we cannot check it
+
+/*
+So here, instead of terminating the code we just include the std::bad_exception and then handle the exception.
+
+This got also removed from the standard since C++20
+
+Because all of the issues with these exception handling methods we got the noexcept in the standard.
+*/
+
+
+
+// EXCEPTION SPECIFICATION BEFORE C++11 - 2 | THROW STATISTICS AND A TERMINATE HANDLER
+
+// Opt-in with -DTHROW_STATS: without it none of this exists and the throws go straight to the runtime. With it every throw of the
+// program (also the ones inside the standard library, like the std::out_of_range of string::at) goes through the hooks below.
+// Linux, libstdc++ and x86 only: the hooks replace the functions of the C++ ABI and the clock is the time stamp counter
+#if defined(THROW_STATS)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>      // dlsym(RTLD_NEXT), dladdr
+#include <exception>
+#include <string>
+#include <typeinfo>
+#include <unistd.h>
+#include <unwind.h>
+#include <vector>
+#include <x86intrin.h>  // __rdtsc
+
+// Not <cxxabi.h>: it declares __cxa_throw [[noreturn]], and gcc never turns the last call of a noreturn function into a jump
+namespace __cxxabiv1
+{
+    extern "C" char* __cxa_demangle(const char* name, char* buf, std::size_t* n, int* status);
+    extern "C" std::type_info* __cxa_current_exception_type() noexcept;
+}
+namespace abi = __cxxabiv1;
+
+class ThrowStats
+{
+public:
+    // everything so far as JSON: the throws and catches per type and per throw site, the throw to catch latency, the last throws
+    static void write_json(std::FILE* out);
+
+    // std::set_terminate() with a handler that prints the last throws to stderr and then calls the previous handler
+    static void install_terminate_dump() noexcept { previous = std::set_terminate(&terminate_dump); }
+
+    // the hooks call these
+    static void on_throw(void* obj, const std::type_info* type, void* where) noexcept;
+    static void on_catch(void* obj) noexcept;
+
+private:
+    static constexpr std::size_t n_sites = 128;     // (type, site) pairs per thread
+    static constexpr std::size_t n_buckets = 48;    // latency, bucket k counts [2^k, 2^(k+1)) clock ticks
+    static constexpr std::size_t n_recent = 64;
+    static constexpr std::size_t n_dumped = 16;     // by the terminate handler
+    static constexpr int max_flying = 4;            // exceptions thrown and not caught yet on a thread (a throw during unwinding)
+
+    struct Site
+    {
+        std::atomic<const std::type_info*> type{ nullptr };
+        std::atomic<void*> where{ nullptr };
+        std::atomic<std::uint64_t> thrown{ 0 };
+        std::atomic<std::uint64_t> caught{ 0 };
+    };
+
+    struct Flying
+    {
+        void* obj;
+        std::uint64_t tsc;
+        Site* site;
+    };
+
+    // Only the owner thread writes its block, so a counter is a load and a store, not a locked add. The readers (write_json on
+    // another thread) see the atomics, so there is no data race. The blocks are never freed: the counts of finished threads stay
+    struct PerThread
+    {
+        Site sites[n_sites];
+        std::atomic<std::uint64_t> lost{ 0 };       // throws that found the site table full
+        std::atomic<std::uint64_t> latency[n_buckets] = { };
+        Flying flying[max_flying];
+        int n_flying = 0;
+        std::uint32_t id = 0;
+        PerThread* next = nullptr;
+    };
+
+    // the last throws of all threads, a seqlock per slot: seq is 0 while the slot is written, the position + 1 after that
+    struct Recent
+    {
+        std::atomic<std::uint64_t> seq;         // (no initializers: the array is static, so it starts as zeros)
+        std::atomic<const std::type_info*> type;
+        std::atomic<void*> where;
+        std::atomic<std::uint64_t> tsc;
+        std::atomic<std::uint32_t> thread;
+    };
+
+    static void bump(std::atomic<std::uint64_t>& c) noexcept
+    {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static PerThread* current(bool create) noexcept
+    {
+        static thread_local PerThread* mine = nullptr;
+        if (!mine && create)
+        {
+            mine = new (std::nothrow) PerThread;     // a throwing new here would come back into the hook
+            if (mine)
+            {
+                mine->id = n_threads.fetch_add(1, std::memory_order_relaxed);
+                mine->next = threads.load(std::memory_order_relaxed);
+                while (!threads.compare_exchange_weak(mine->next, mine, std::memory_order_release, std::memory_order_relaxed))
+                    ;
+            }
+        }
+        return mine;
+    }
+
+    static Site* find(PerThread* t, const std::type_info* type, void* where) noexcept
+    {
+        std::size_t h = (reinterpret_cast<std::uintptr_t>(type) ^ reinterpret_cast<std::uintptr_t>(where)) * 0x9E3779B97F4A7C15u >> 57;
+        for (std::size_t k = 0; k < n_sites; ++k)
+        {
+            Site& s = t->sites[(h + k) % n_sites];
+            const std::type_info* st = s.type.load(std::memory_order_relaxed);
+            if (st == type && s.where.load(std::memory_order_relaxed) == where)
+                return &s;
+            if (!st)
+            {
+                s.where.store(where, std::memory_order_relaxed);
+                s.type.store(type, std::memory_order_release);  // the readers check type first
+                return &s;
+            }
+        }
+        return nullptr;
+    }
+
+    static void terminate_dump();
+    static void write_recent_raw(int fd) noexcept;
+    static double ns_per_tick();
+
+    static inline std::atomic<PerThread*> threads{ nullptr };
+    static inline std::atomic<std::uint32_t> n_threads{ 0 };
+    static inline Recent recent[n_recent];
+    static inline std::atomic<std::uint64_t> recent_pos{ 0 };
+    static inline std::terminate_handler previous = nullptr;
+    static inline const std::uint64_t start_tsc = __rdtsc();
+    static inline const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+};
+
+void ThrowStats::on_throw(void* obj, const std::type_info* type, void* where) noexcept
+{
+    std::uint64_t now = __rdtsc();
+    PerThread* t = current(true);
+    if (!t)
+        return;
+    Site* s = find(t, type, where);
+    bump(s ? s->thrown : t->lost);
+
+    int k = 0;  // an entry with the same address is an exception that was never caught by a handler (rethrow_exception, terminate)
+    while (k < t->n_flying && t->flying[k].obj != obj)
+        ++k;
+    if (k == t->n_flying && k == max_flying)
+        k = 0;  // full: drop the oldest
+    for (; k + 1 < t->n_flying; ++k)
+        t->flying[k] = t->flying[k + 1];
+    t->flying[k] = { obj, now, s };
+    t->n_flying = k + 1;
+
+    std::uint64_t pos = recent_pos.fetch_add(1, std::memory_order_relaxed);
+    Recent& r = recent[pos % n_recent];
+    r.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    r.type.store(type, std::memory_order_relaxed);
+    r.where.store(where, std::memory_order_relaxed);
+    r.tsc.store(now, std::memory_order_relaxed);
+    r.thread.store(t->id, std::memory_order_relaxed);
+    r.seq.store(pos + 1, std::memory_order_release);
+}
+
+void ThrowStats::on_catch(void* obj) noexcept
+{
+    std::uint64_t now = __rdtsc();
+    PerThread* t = current(false);
+    if (!t)
+        return;
+    for (int k = t->n_flying - 1; k >= 0; --k)
+    {
+        if (t->flying[k].obj != obj)
+            continue;
+        std::uint64_t ticks = now - t->flying[k].tsc;
+        std::size_t b = 63 - __builtin_clzll(ticks | 1);
+        bump(t->latency[b < n_buckets ? b : n_buckets - 1]);
+        if (t->flying[k].site)
+            bump(t->flying[k].site->caught);
+        for (; k + 1 < t->n_flying; ++k)
+            t->flying[k] = t->flying[k + 1];
+        --t->n_flying;
+        return;
+    }
+}
+
+// The hooks. A definition in the executable comes before the one in libstdc++.so, also for the calls inside libstdc++, the real
+// function is the next one, found with dlsym(RTLD_NEXT). The site is the return address: the instruction after the call of the throw
+namespace __cxxabiv1
+{
+    extern "C" void __cxa_throw(void* obj, std::type_info* type, void (*dest)(void*))
+    {
+        using throw_fn = void (*)(void*, std::type_info*, void (*)(void*));
+        static const throw_fn real = reinterpret_cast<throw_fn>(dlsym(RTLD_NEXT, "__cxa_throw"));
+        ThrowStats::on_throw(obj, type, __builtin_return_address(0));
+        real(obj, type, dest);  // a tail call (a jmp): one more frame would cost the unwinder as much as a frame of the program
+    }
+
+    extern "C" void* __cxa_begin_catch(void* header) noexcept
+    {
+        using catch_fn = void* (*)(void*) noexcept;
+        static const catch_fn real = reinterpret_cast<catch_fn>(dlsym(RTLD_NEXT, "__cxa_begin_catch"));
+        ThrowStats::on_catch(static_cast<_Unwind_Exception*>(header) + 1);  // the thrown object follows its unwind header
+        return real(header);
+    }
+}
+
+double ThrowStats::ns_per_tick()
+{
+    std::uint64_t ticks = __rdtsc() - start_tsc;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    return ticks ? ns / ticks : 0.0;
+}
+
+void ThrowStats::write_json(std::FILE* out)
+{
+    struct Row
+    {
+        const std::type_info* type;
+        void* where;
+        std::uint64_t thrown, caught;
+    };
+    std::vector<Row> rows;
+    std::uint64_t latency[n_buckets] = { }, lost = 0, total = 0, caught = 0;
+    for (PerThread* t = threads.load(std::memory_order_acquire); t; t = t->next)
+    {
+        for (const Site& s : t->sites)
+        {
+            const std::type_info* type = s.type.load(std::memory_order_acquire);
+            if (!type)
+                continue;
+            Row r{ type, s.where.load(std::memory_order_relaxed), s.thrown.load(std::memory_order_relaxed),
+                   s.caught.load(std::memory_order_relaxed) };
+            auto same = [&](const Row& x) { return x.type == r.type && x.where == r.where; };
+            if (auto it = std::find_if(rows.begin(), rows.end(), same); it != rows.end())
+            {
+                it->thrown += r.thrown;
+                it->caught += r.caught;
+            }
+            else
+            {
+                rows.push_back(r);
+            }
+        }
+        lost += t->lost.load(std::memory_order_relaxed);
+        for (std::size_t b = 0; b < n_buckets; ++b)
+            latency[b] += t->latency[b].load(std::memory_order_relaxed);
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.thrown > b.thrown; });
+
+    auto name = [](const std::type_info* type) {   // the demangled names have no quotes or backslashes to escape
+        int status = 0;
+        char* s = abi::__cxa_demangle(type->name(), nullptr, nullptr, &status);
+        std::string n = status == 0 ? s : type->name();
+        std::free(s);
+        return n;
+    };
+    auto escaped = [](const std::string& s) {  // a path can have any byte but '\0', a symbol an operator"" in it
+        std::string e;
+        for (unsigned char ch : s)
+        {
+            if (ch == '"' || ch == '\\')
+            {
+                e += '\\';
+                e += static_cast<char>(ch);
+            }
+            else if (ch < 0x20)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+                e += buf;
+            }
+            else
+            {
+                e += static_cast<char>(ch);
+            }
+        }
+        return e;
+    };
+    auto function = [&](void* where) {  // the function, or the file and the offset for addr2line, ready for a JSON string
+        Dl_info info;
+        char* at = static_cast<char*>(where) - 1;   // the call itself, the return address may be past the end of the function
+        if (!dladdr(at, &info))
+            return std::string("?");
+        if (!info.dli_sname)    // static functions, the .cold parts of functions, the executable without -rdynamic
+        {
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "+%#lx", static_cast<unsigned long>(at - static_cast<char*>(info.dli_fbase)));
+            return escaped(std::string(info.dli_fname) + buf);
+        }
+        int status = 0;
+        char* s = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string n = escaped(status == 0 ? s : info.dli_sname);
+        std::free(s);
+        return n;
+    };
+
+    double scale = ns_per_tick();
+    std::fprintf(out, "{\n  \"sites\": [");
+    for (std::size_t i = 0; i < rows.size(); ++i)
+    {
+        std::fprintf(out, "%s\n    { \"type\": \"%s\", \"site\": \"%p\", \"function\": \"%s\", \"thrown\": %llu, \"caught\": %llu }",
+                     i ? "," : "", name(rows[i].type).c_str(), rows[i].where, function(rows[i].where).c_str(),
+                     (unsigned long long)rows[i].thrown, (unsigned long long)rows[i].caught);
+        total += rows[i].thrown;
+        caught += rows[i].caught;
+    }
+    std::fprintf(out, "\n  ],\n  \"types\": [");
+    bool first = true;
+    for (std::size_t i = 0; i < rows.size(); ++i)
+    {
+        bool seen = false;
+        for (std::size_t j = 0; j < i; ++j)
+            seen = seen || rows[j].type == rows[i].type;
+        if (seen)
+            continue;
+        std::uint64_t th = 0, ca = 0;
+        for (const Row& r : rows)
+            if (r.type == rows[i].type)
+            {
+                th += r.thrown;
+                ca += r.caught;
+            }
+        std::fprintf(out, "%s\n    { \"type\": \"%s\", \"thrown\": %llu, \"caught\": %llu }", first ? "" : ",",
+                     name(rows[i].type).c_str(), (unsigned long long)th, (unsigned long long)ca);
+        first = false;
+    }
+    std::fprintf(out, "\n  ],\n  \"thrown\": %llu, \"caught\": %llu, \"lost\": %llu,\n  \"latency_ns\": [",
+                 (unsigned long long)total, (unsigned long long)caught, (unsigned long long)lost);
+    first = true;
+    for (std::size_t b = 0; b < n_buckets; ++b)
+    {
+        if (!latency[b])
+            continue;
+        std::fprintf(out, "%s\n    { \"below\": %.0f, \"count\": %llu }", first ? "" : ",", double(2ull << b) * scale,
+                     (unsigned long long)latency[b]);
+        first = false;
+    }
+    std::fprintf(out, "\n  ],\n  \"recent\": [");
+    std::uint64_t end = recent_pos.load(std::memory_order_acquire), now = __rdtsc();
+    first = true;
+    for (std::uint64_t pos = end > n_recent ? end - n_recent : 0; pos < end; ++pos)
+    {
+        Recent& r = recent[pos % n_recent];
+        std::uint64_t seq = r.seq.load(std::memory_order_acquire);
+        const std::type_info* type = r.type.load(std::memory_order_relaxed);
+        void* where = r.where.load(std::memory_order_relaxed);
+        std::uint64_t tsc = r.tsc.load(std::memory_order_relaxed);
+        std::uint32_t thread = r.thread.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq != pos + 1 || r.seq.load(std::memory_order_relaxed) != seq)
+            continue;   // being written, or already overwritten
+        std::fprintf(out, "%s\n    { \"type\": \"%s\", \"site\": \"%p\", \"thread\": %u, \"age_ns\": %.0f }", first ? "" : ",",
+                     name(type).c_str(), where, thread, double(now - tsc) * scale);
+        first = false;
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+}
+
+// On the way out nothing is trusted, not even the heap: no demangling, no stdio, only snprintf into the stack and write()
+void ThrowStats::write_recent_raw(int fd) noexcept
+{
+    char line[256];
+    int n;
+    if (const std::type_info* t = abi::__cxa_current_exception_type())
+    {
+        n = std::snprintf(line, sizeof(line), "terminate called with an active exception of type %s\n", t->name());
+        (void)!::write(fd, line, n < int(sizeof(line)) ? n : sizeof(line) - 1);
+    }
+    std::uint64_t end = recent_pos.load(std::memory_order_acquire);
+    n = std::snprintf(line, sizeof(line), "last throws (%llu in total), newest first:\n", (unsigned long long)end);
+    (void)!::write(fd, line, n);
+    for (std::uint64_t pos = end; pos-- > (end > n_dumped ? end - n_dumped : 0);)
+    {
+        Recent& r = recent[pos % n_recent];
+        if (r.seq.load(std::memory_order_acquire) != pos + 1)
+            continue;
+        n = std::snprintf(line, sizeof(line), "  %-40s at %p, thread %u\n", r.type.load(std::memory_order_relaxed)->name(),
+                          r.where.load(std::memory_order_relaxed), r.thread.load(std::memory_order_relaxed));
+        (void)!::write(fd, line, n < int(sizeof(line)) ? n : sizeof(line) - 1);
+    }
+}
+
+void ThrowStats::terminate_dump()
+{
+    write_recent_raw(STDERR_FILENO);
+    if (previous)
+        previous();
+    std::abort();
+}
+
+#endif // THROW_STATS
+
+void f()
+{
+ThrowStats::install_terminate_dump(); // at the start of main
+...
+ThrowStats::write_json(stdout); // on a signal, from an admin endpoint, at exit...
+}
+
+// Basic example of a benchmark: ns per throw + catch with and without -DTHROW_STATS, and the cost of the hooks alone
+// (usage: bench [terminate])
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct indexError : public std::out_of_range   // the one from EXCEPTION HIERARCHIES - 4, shortened
+{
+    explicit indexError(int i) : out_of_range("Bad index"), index(i) { }
+    int index;
+};
+
+[[gnu::noinline]] int checked(const std::vector<int>& v, int i)
+{
+    if (i < 0 || i >= static_cast<int>(v.size()))
+        throw indexError(i);
+    return v[i];
+}
+
+double ns_per_throw(int n)
+{
+    std::vector<int> v(10);
+    std::string s = "abc";
+    long sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        try
+        {
+            sum += i % 4 ? checked(v, 10 + i) : s.at(3 + i);    // indexError, or std::out_of_range from libstdc++
+        }
+        catch (const std::out_of_range&)
+        {
+            ++sum;
+        }
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n + 0 * sum;
+}
+
+int main(int argc, char* argv[])
+{
+    const int n = 1'000'000;
+#if defined(THROW_STATS)
+    ThrowStats::install_terminate_dump();
+    const char* mode = "THROW_STATS";
+#else
+    const char* mode = "off";
+#endif
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 3; ++t)
+        workers.emplace_back([] { ns_per_throw(1000); });
+    for (std::thread& w : workers)
+        w.join();
+
+    std::printf("%-12s throw + catch: %7.1f ns\n", mode, ns_per_throw(n));
+#if defined(THROW_STATS)
+    ThrowStats::write_json(stdout);
+    alignas(16) static char fake[64];
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+    {
+        ThrowStats::on_throw(fake, &typeid(indexError), fake);
+        ThrowStats::on_catch(fake);
+    }
+    double hooks = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+    std::printf("%-12s hooks alone:   %7.1f ns\n", mode, hooks);
+    std::uint64_t sink = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+        sink += __rdtsc();
+    double clock = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+    asm volatile("" : : "r"(sink));     // the loop is not optimized away
+    std::printf("%-12s one __rdtsc(): %7.1f ns\n", mode, clock);
+#endif
+    if (argc > 1 && std::strcmp(argv[1], "terminate") == 0)
+        []() noexcept { checked(std::vector<int>(), 1); }();   // a throw through noexcept: std::terminate
+}
+
+/*
+We can not see from the code how often the error paths really run: an indexError in a loop, the std::out_of_range of a string::at()
+somewhere deep in a library. ThrowStats counts them without touching the throw sites. Every throw of a C++ program calls __cxa_throw() of
+the runtime, and every catch calls __cxa_begin_catch(). If the executable defines functions with these names, the dynamic linker uses
+them instead of the ones in libstdc++.so, even for the calls inside libstdc++ itself. Our versions record the throw and jump to the real
+function (dlsym(RTLD_NEXT) finds it).
+
+What is recorded:
+    per thread, per (dynamic type, throw site): the number of throws and catches. The site is the return address of the call of
+    __cxa_throw, so no source change is needed. write_json() resolves it with dladdr() to a function, or to "file+offset" for addr2line
+    (the .cold parts where gcc moves the throws have no exported symbol)
+    per thread, the time from the throw to the catch in a log2 histogram of clock ticks. The exception object is the key: the hook of
+    the throw remembers the address and the time, the catch looks for the same address
+    the last 64 throws of all threads in a ring buffer, every slot is a small seqlock so a reader never sees half a record
+    std::set_terminate() (see EXCEPTION SPECIFICATION BEFORE C++11 above): the handler prints the newest 16 throws with write() only,
+    then calls the old handler. At that point the heap may be broken, so the names are not demangled
+Nothing is locked on the way. The tables belong to one thread, so a counter is a plain load and store, only the other threads read them.
+The ring has one atomic fetch_add per throw.
+
+The details that were not obvious:
+    <cxxabi.h> is not included. It declares __cxa_throw [[noreturn]], and gcc does not turn the call at the end of a noreturn
+    function into a jump. With a real call our __cxa_throw stays on the stack during the unwinding, and the unwinder handles one
+    more frame: that was about 200 ns on every throw, much more than the statistics cost
+    without -DTHROW_STATS the whole section is gone, nothing is replaced, and the cost is zero
+    the time is __rdtsc(), steady_clock::now() is about twice as expensive. The ticks are converted to nanoseconds only in write_json(),
+    with the ratio of the ticks and steady_clock since the start
+
+The output on my machine (g++ 12 -O2, the throws are 3/4 indexError from a function and 1/4 std::out_of_range from string::at; the
+hooks alone is on_throw() + on_catch() in a loop, without a throw):
+
+    off          throw + catch:  1562.6 ns
+    THROW_STATS  throw + catch:  1558.9 ns
+    THROW_STATS  hooks alone:      70.2 ns
+    THROW_STATS  one __rdtsc():    19.0 ns
+
+and the start of the JSON:
+
+    {
+      "sites": [
+        { "type": "indexError", "site": "0x5619b89d92d5", "function": "./bench+0x22d4", "thrown": 752250, "caught": 752250 },
+        { "type": "std::out_of_range", "site": "0x7f85504a026d", "function": "/lib/x86_64-linux-gnu/libstdc++.so.6+0xa026c", ... }
+      ],
+      "types": [
+        { "type": "indexError", "thrown": 752250, "caught": 752250 },
+        { "type": "std::out_of_range", "thrown": 250750, "caught": 250750 }
+      ],
+      "thrown": 1003000, "caught": 1003000, "lost": 0,
+      "latency_ns": [
+        { "below": 2048, "count": 838129 },
+        { "below": 4096, "count": 164187 },
+        { "below": 8192, "count": 300 },
+        ...
+
+The throw + catch of the two builds changes more from run to run (1.4 - 2.0 microseconds) than the hooks cost, so the difference can
+not be seen there. Measured alone the hooks are 60-70 ns here, which is more than the 50 ns we wanted, but two __rdtsc() calls are
+almost 40 ns of it: reading the time stamp counter is slow in this virtual machine, on real hardware it is a few nanoseconds. The rest
+(the table, the ring, the histogram) is about 20 ns. addr2line -f -C -e bench 0x22d4 says the indexError site is
+checked(...) [clone .cold]. The terminate handler prints for example:
+
+    terminate called with an active exception of type 10indexError
+    last throws (2003001 in total), newest first:
+      10indexError                             at 0x55d68224e2d5, thread 3
+      ...
+*/
+
+
+
+// NOEXCEPT SPECIFIER
+
+void f() noexcept(expr) { } // the compiler will evaluate the parameter in compilation time
+void f() noexcept(true) { }
+void f() noexcept { } // noexcept(true)
+
+/*
+Noexcept is important for optimizations and code safety. C++ functions are either non-throwing or potentially throwing (we are not sure if they will throw, but potentially they can).
+C++ cannot execute full compile time check on possible exceptions due to possible call of non C++ functions.
+
+IMPORTANT: Destructors, deallocation functions are non-throwing, so it means we don't need to write noexcept for them.
+
+Based on how we declared the base class or function that the following expression call, they can be non-throwing as well: Implicitly declared or defaulted default-, copy- and move constructors,
+copy, move oper. So again, based on what base class or operators they are calling (if they call a noexcept base class for example) we do not need to describe them as noexcept.
+
+At move semantic, for example, using noexcept can lead to better performance.
+*/
+
+
+
+// NOEXCEPT OPERATOR
+
+template <typename T>
+//       this is the specifier   and this is the operator!!!
+void f() noexcept               (noexcept(T::g())) {
+    T::g();
+}
+
+/*
+In C++ there are noexcept specifier, and operator. In case of noexcept operator the noexcept has a parameter (T::g()). The parameter produces true or false values based on its argument is
+non-throwing or potentially throwing.
+
+The key difference between the noexcept operator and specifier: In the f() with a noexcept operator we aren't saying that this function never gives exception, but we rather say that this f()
+will throw or not throw exception based on what we know about function g().
+
+This is especially useful with templates when we do not know what type it will be instantiated with. We do not know that the type the template will be instantiated with will throw exception or not.
+
+*/
+
+// Basic example of output
+template <typename T>
+void f() noexcept(noexcept(T::g(5 + 2))) {
+    T::g();
+}
+
+// OUTPUT: True
+
+
+
+// DESTRUCTORS
+
+/*
+In C++ it is a very strong rule that destructors must not throw exceptions. It's not strictly in the standard library, so we can write destructors that throw exception and there are examples for that in real
+life as well, but we have to be careful with that. This article inspects this topic in more detail (https://akrzemi1.wordpress.com/2011/09/21/destructors-that-throw/).
+*/
+
+
+
+// EXCEPTION SAFETY
+
+class T1 {...};
+class T2 {...};
+
+template <typename T1, typename T2>
+void f(T1*, T2*);
+
+void g() {
+    f(new T1(), new T2());
+    // ...
+}
+
+/*
+Imagine that I have constructed T1, but T2 throws exception, because we couldn't allocate the memory in the heap of T2 or the constructor of T2 throws exception then C++ guarantees that the memory reserved by T2 will
+free, but the memory space of T1 won't free and then we get memory leak. Before C++17 it was also possible that the expressions got overlapped in the call. Both expression were before the sequence point, so it was possible
+before C++17 that the memory was allocated for T1 and then T2, but the constructor got called for T1 and then T2 and if there was an exception in any of the parameters then the memory allocated to the other parameter didn't free.
+
+This is the exception safety problem that's the reason why we have to carefully implement exceptions because there can happen memory leak and we lose the whole point of working with exceptions.
+*/
+
+
+
+// ENSURE EXCEPTION SAFETY
+
+class T1 {...};
+
+class T2 {...};
+
+template <typename T1, typename T2>
+void f(std::unique_ptr<T1>, std::unique_ptr<T2>);
+
+void g() {
+    std::unique_ptr<T1> ptr1{ new T1() };
+    std::unique_ptr<T2> ptr2{ new T2() };
+    f(ptr1, ptr2);
+    // ...
+}
+
+/*
+By rearranging the source code and using sequence points we can make sure that exception safety is guaranteed.
+For example, using unique pointers and declare them differently (under each other, so there are sequance point between them) we can ensure exception safety.
+
+*/
+
+
+
+// ENSURE EXCEPTION SAFETY - 2 | A TRANSACTION FOR BUILDING MANY OBJECTS
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// the memory and the objects of a committed ScopedArena: they are destroyed in reverse order and freed together
+class Arena
+{
+public:
+    Arena() noexcept = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Arena(Arena&& rhs) noexcept : chunks(rhs.chunks), cleanups(rhs.cleanups)
+    {
+        rhs.chunks = nullptr;
+        rhs.cleanups = nullptr;
+    }
+
+    Arena& operator=(Arena&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            clear();
+            std::swap(chunks, rhs.chunks);
+            std::swap(cleanups, rhs.cleanups);
+        }
+        return *this;
+    }
+
+    ~Arena() { clear(); }
+
+    void clear() noexcept
+    {
+        destroy(cleanups, nullptr);
+        cleanups = nullptr;
+        free_chunks(chunks, nullptr);
+        chunks = nullptr;
+    }
+
+private:
+    friend class ScopedArena;
+
+    struct Chunk
+    {
+        Chunk* prev;
+        std::size_t size;   // with this header
+    };
+
+    // in front of every object that has a destructor to run; trivially destructible objects have none
+    struct Cleanup
+    {
+        void (*destroy)(void*) noexcept;
+        void* obj;
+        Cleanup* prev;
+    };
+
+    // runs the destructors from the newest down to (not including) stop
+    static void destroy(Cleanup* c, Cleanup* stop) noexcept
+    {
+        for (; c != stop; c = c->prev)
+            c->destroy(c->obj);
+    }
+
+    static void free_chunks(Chunk* c, Chunk* stop) noexcept
+    {
+        while (c != stop)
+        {
+            Chunk* prev = c->prev;
+            ::operator delete(c, c->size);
+            c = prev;
+        }
+    }
+
+    Arena(Chunk* ch, Cleanup* cl) noexcept : chunks(ch), cleanups(cl) { }
+
+    Chunk* chunks = nullptr;
+    Cleanup* cleanups = nullptr;
+};
+
+// A transaction: objects made with make() come from bump allocations in a few big chunks (one if the first chunk is big enough).
+// If it is destroyed without commit() (an exception on the way, an early return), every object built so far is destroyed in reverse
+// order and the memory is rewound. commit() hands the objects over to an Arena
+class ScopedArena
+{
+public:
+    explicit ScopedArena(std::size_t first_chunk = 64 * 1024) noexcept : next_size(first_chunk) { }
+    ScopedArena(const ScopedArena&) = delete;
+    ScopedArena& operator=(const ScopedArena&) = delete;
+
+    ~ScopedArena()
+    {
+        rollback();
+        Arena::free_chunks(chunks, nullptr);
+    }
+
+    // strong guarantee: if the allocation or the constructor throws, the objects made before are untouched
+    template <class T, class... Args>
+    T* make(Args&&... args)
+    {
+        constexpr bool cleanup = !std::is_trivially_destructible<T>::value;
+        char* saved_cur = cur;
+        char* saved_end = end;
+        Arena::Chunk* saved_chunks = chunks;
+        std::size_t saved_next_size = next_size;
+        Arena::Cleanup* c = nullptr;
+        T* obj;
+        try
+        {
+            if constexpr (cleanup)
+                c = static_cast<Arena::Cleanup*>(bump(sizeof(Arena::Cleanup), alignof(Arena::Cleanup)));
+            void* p = bump(sizeof(T), alignof(T));
+            obj = ::new (p) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            // the second bump or the constructor can fail after the first bump added a chunk: free the chunks added for this object
+            Arena::free_chunks(chunks, saved_chunks);
+            chunks = saved_chunks;
+            cur = saved_cur;
+            end = saved_end;
+            next_size = saved_next_size;
+            throw;
+        }
+        if constexpr (cleanup)
+        {
+            *c = { [](void* o) noexcept { static_cast<T*>(o)->~T(); }, obj, cleanups };
+            cleanups = c;
+        }
+        return obj;
+    }
+
+    // destroys everything made since the start (or the last commit), newest first, and keeps the last chunk for reuse
+    void rollback() noexcept
+    {
+        Arena::destroy(cleanups, nullptr);
+        cleanups = nullptr;
+        if (chunks)
+        {
+            Arena::free_chunks(chunks->prev, nullptr);
+            chunks->prev = nullptr;
+            cur = reinterpret_cast<char*>(chunks + 1);
+        }
+    }
+
+    // the objects now belong to the Arena; the transaction starts again empty
+    Arena commit() noexcept
+    {
+        Arena a(chunks, cleanups);
+        chunks = nullptr;
+        cleanups = nullptr;
+        cur = end = nullptr;
+        return a;
+    }
+
+private:
+    void* bump(std::size_t size, std::size_t align)
+    {
+        char* p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(std::uintptr_t(align) - 1));
+        if (!cur || p + size > end)
+        {
+            grow(size + align);
+            p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(std::uintptr_t(align) - 1));
+        }
+        cur = p + size;
+        return p;
+    }
+
+    void grow(std::size_t need)     // the only place that can throw bad_alloc, before anything changes
+    {
+        std::size_t size = sizeof(Arena::Chunk) + (need > next_size ? need : next_size);
+        Arena::Chunk* c = static_cast<Arena::Chunk*>(::operator new(size));
+        *c = { chunks, size };
+        chunks = c;
+        cur = reinterpret_cast<char*>(c + 1);
+        end = reinterpret_cast<char*>(c) + size;
+        next_size *= 2;
+    }
+
+    Arena::Chunk* chunks = nullptr;     // the newest first
+    Arena::Cleanup* cleanups = nullptr; // the newest first
+    char* cur = nullptr;
+    char* end = nullptr;
+    std::size_t next_size;
+};
+
+void f()
+{
+Arena graph;
+{
+ScopedArena tx;
+Node* a = tx.make<Node>("a");
+Node* b = tx.make<Node>("b", a); // if this throws, a is destroyed and nothing leaks
+a->next = b;
+graph = tx.commit(); // now the Arena owns a and b
+}
+}
+
+// Basic example of a benchmark: 10000 small objects linked into a graph, built and destroyed, and built with a failure at the end
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static int fail_at = -1;
+
+struct Node     // trivially destructible: no cleanup entry in the arena
+{
+    explicit Node(int i) : id(i)
+    {
+        if (i == fail_at)
+            throw std::runtime_error("bad node");
+    }
+    int id;
+    Node* edges[3] = { };
+};
+
+struct NamedNode    // has a destructor to run
+{
+    explicit NamedNode(int i) : id(i), name("node " + std::to_string(i))
+    {
+        if (i == fail_at)
+            throw std::runtime_error("bad node");
+    }
+    int id;
+    std::string name;
+    NamedNode* edges[3] = { };
+};
+
+template <class N, class Make>
+void link(std::vector<N*>& nodes, int n, Make make)
+{
+    unsigned seed = 1;
+    for (int i = 0; i < n; ++i)
+    {
+        N* x = make(i);
+        for (N*& e : x->edges)
+        {
+            seed = seed * 1103515245u + 12345u;
+            e = i ? nodes[(seed >> 8) % i] : x;
+        }
+        nodes.push_back(x);
+    }
+}
+
+template <class N>
+Arena build_arena(int n, std::vector<N*>& nodes)
+{
+    ScopedArena tx(n * (sizeof(N) + 32));  // one chunk for all
+    link(nodes, n, [&](int i) { return tx.make<N>(i); });
+    return tx.commit();
+}
+
+template <class N>
+std::vector<std::unique_ptr<N>> build_unique(int n, std::vector<N*>& nodes)
+{
+    std::vector<std::unique_ptr<N>> owner;
+    owner.reserve(n);
+    link(nodes, n, [&](int i) {
+        owner.push_back(std::make_unique<N>(i));
+        return owner.back().get();
+    });
+    return owner;
+}
+
+template <class F>
+double ns_per_object(int n, int rounds, F f)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / (double(n) * rounds);
+}
+
+template <class N>
+void bench(const char* name)
+{
+    const int n = 10'000, rounds = 200;
+    std::vector<N*> nodes;
+    nodes.reserve(n);
+    auto arena = [&] { nodes.clear(); Arena a = build_arena<N>(n, nodes); };
+    auto unique = [&] { nodes.clear(); auto o = build_unique<N>(n, nodes); };
+    auto failing = [](auto build) {
+        return [build] { try { build(); } catch (const std::runtime_error&) { } };
+    };
+
+    fail_at = -1;
+    double a_ok = ns_per_object(n, rounds, arena), u_ok = ns_per_object(n, rounds, unique);
+    fail_at = n - 1;    // the last constructor throws: everything before is destroyed
+    double a_fail = ns_per_object(n, rounds, failing(arena)), u_fail = ns_per_object(n, rounds, failing(unique));
+    std::printf("%-10s  %10.1f ns %10.1f ns %14.1f ns %10.1f ns\n", name, u_ok, a_ok, u_fail, a_fail);
+}
+
+int main()
+{
+    std::printf("%-10s  %13s %13s %17s %13s\n", "", "unique_ptr", "ScopedArena", "unique_ptr, fail", "arena, fail");
+    bench<Node>("Node");
+    bench<NamedNode>("NamedNode");
+}
+
+/*
+With unique_ptr every object is safe on its own: if the second new throws, the first unique_ptr is already there to delete the first
+object. For a group of objects that only make sense together (the nodes of a graph, the parts of a document) this is still one
+allocation, one free and one unique_ptr per object, and a failure in the middle leaves a half built group that the caller has to throw
+away object by object.
+
+ScopedArena is the transaction for such a group:
+    make<T>(args...) builds T in the current chunk: moving a pointer forward is the whole allocation. If T has a destructor, a small
+    cleanup record (the destructor, the object, the previous record) goes in front of it, in the same chunk, so the records form a
+    list from the newest object to the oldest without any extra allocation. Trivially destructible objects have no record at all
+    make() is strong: if an allocation or the constructor throws, the position in the chunk is restored and the chunks that were
+    added for this object are freed, so the ScopedArena is exactly as before the call
+    without commit() the destructor of ScopedArena (also when the stack unwinds because of an exception) runs the destructors from
+    the newest to the oldest, the reverse order of construction, like the destructors of local variables, and frees the chunks. For
+    trivially destructible objects the rollback is only resetting the pointer. rollback() does the same and keeps the last chunk
+    commit() is noexcept and moves the chunks and the cleanup list into an Arena, which destroys the objects (again in reverse order)
+    when it dies. Nothing is copied, the pointers to the objects stay valid
+The objects do not own each other, so any pointer structure works, cycles too (unlike with unique_ptr).
+
+The output on my machine (g++ 12 -O2, 10000 nodes with 3 random edges each, built and destroyed 200 times; ns per object; "fail" means
+the constructor of the last node throws and everything is rolled back):
+
+                   unique_ptr   ScopedArena  unique_ptr, fail   arena, fail
+    Node              35.0 ns        8.0 ns           44.9 ns        7.3 ns
+    NamedNode         72.1 ns       32.4 ns           58.5 ns       34.9 ns
+
+Node is trivially destructible, so the arena is just the constructor and the edges, 4-5 times faster than a new and a delete per node,
+and the rollback is free. NamedNode has a std::string (short, so it stays in the small buffer), the destructors have to run, and the
+arena is about two times faster: what is left is the string and the walk of the cleanup list. The unique_ptr version also cleans up
+after a failure (the vector of unique_ptrs is destroyed during the unwinding), but it frees 10000 blocks one by one, the arena frees
+one chunk.
+*/
+
+
+
+// EXCEPTION SAFETY IN STL
+
+/*
+In the stl there are there levels of exception safety described:
+    Basic guarantee: no memory leak or other resource issue
+    Strong guarantee: the operation is atomic:
+                    it either succeeds or has no effect
+        e.g. push_back() for vector, insert() for assoc. cont.
+    Nothrow guarantee: the operation does not throw
+        e.g. pop_back() for vector, erase() for assoc. cont., swap()
+
+It is possible that a push_back throws exception, but if it happens it's guaranteed that we keep the vectors old value before the push_back().
+
+In case of pop_back() it's guaranteed that it won't throw exception. That's the difference between nothrow guarantee and strong guarantee.
+*/
+
+
+
+// STRONG GUARANTEE EXAMPLE
+
+template <class T>
+class Vec
+{
+    // ...
+private:
+    size_t cap;
+    size_t sz;
+    T* v;
+};
+
+Vec<T>& Vec<T>::operator=(const Vec& rhs)
+{
+    if (this != &rhs)                          if (this != &rhs)
+    {                                          {
+        delete[] v;                              Vec tmp(rhs);
+        cap = sz = rhs.sz;                       cap = sz = tmp.sz;
+        v = new T[cap];                          std::swap(v, tmp.v);
+        for (size_t i = 0; i < cap; ++i)       }
+    v[i] = rhs.v[i];                           // tmp deleted here with the old buffer
+    }
+    return *this;                              return *this;
+}                                             }
+
+/*
+On the right hand we create a temporal object - in this case a class called Vec. Here in the temporal object we do the copying and if this copying cannot allocate the memory
+or the elements in the buffer throws exception it's not a problem because the temporal object will be terminated. If the copying is successfull then we do operations that are
+are noexcept guaranteed, like swap. The problem with the copying on the right hand side is that for a moment we will allocate double of the memory, so it will result in memory overhead.
+
+That's the reason why not all the expressions are strong guaranteed, but only a few of those.
+*/
+
+
+
+// STRONG GUARANTEE EXAMPLE - 2 | A FULL VEC WITH MOVE_IF_NOEXCEPT
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <class T, class Alloc = std::allocator<T>>
+class Vec
+{
+    using alloc_traits = std::allocator_traits<Alloc>;
+
+public:
+    using value_type = T;
+    using allocator_type = Alloc;
+    using size_type = std::size_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    Vec() noexcept(noexcept(Alloc())) : Vec(Alloc()) { }
+
+    explicit Vec(const Alloc& a) noexcept : alloc(a), cap(0), sz(0), v(nullptr) { }
+
+    Vec(std::initializer_list<T> il, const Alloc& a = Alloc()) : Vec(a)
+    {
+        reserve(il.size());
+        for (const T& x : il)
+            push_back(x);
+    }
+
+    Vec(const Vec& rhs) : Vec(rhs, alloc_traits::select_on_container_copy_construction(rhs.alloc)) { }
+
+    Vec(const Vec& rhs, const Alloc& a) : alloc(a), cap(rhs.sz), sz(0), v(allocate(rhs.sz))
+    {
+        try
+        {
+            construct_copies(rhs.v, rhs.v + rhs.sz, v);
+            sz = rhs.sz;
+        }
+        catch (...)
+        {
+            deallocate(v, cap);     // elements already built were destroyed by construct_copies
+            throw;
+        }
+    }
+
+    Vec(Vec&& rhs) noexcept : alloc(std::move(rhs.alloc)), cap(rhs.cap), sz(rhs.sz), v(rhs.v)
+    {
+        rhs.cap = rhs.sz = 0;
+        rhs.v = nullptr;
+    }
+
+    ~Vec()
+    {
+        destroy(v, v + sz);
+        deallocate(v, cap);
+    }
+
+    Vec& operator=(const Vec& rhs)
+    {
+        if (this != &rhs)
+        {
+            if constexpr (alloc_traits::propagate_on_container_copy_assignment::value)
+            {
+                if (alloc != rhs.alloc)     // our buffer cannot be reused or freed by the new allocator
+                {
+                    Vec tmp(rhs, rhs.alloc);
+                    destroy(v, v + sz);
+                    deallocate(v, cap);
+                    alloc = rhs.alloc;
+                    steal(tmp);
+                    return *this;
+                }
+            }
+            assign(rhs.v, rhs.v + rhs.sz);
+        }
+        return *this;
+    }
+
+    Vec& operator=(Vec&& rhs) noexcept(alloc_traits::propagate_on_container_move_assignment::value
+                                       || alloc_traits::is_always_equal::value)
+    {
+        if (this == &rhs)
+            return *this;
+        if constexpr (!alloc_traits::propagate_on_container_move_assignment::value
+                      && !alloc_traits::is_always_equal::value)
+        {
+            if (alloc != rhs.alloc)     // e.g. two different arenas: the buffer cannot change hands
+            {
+                Vec tmp(alloc);
+                tmp.reserve(rhs.sz);
+                for (T& x : rhs)
+                    tmp.emplace_back(std::move_if_noexcept(x));
+                swap_buffers(tmp);
+                return *this;
+            }
+        }
+        destroy(v, v + sz);
+        deallocate(v, cap);
+        if constexpr (alloc_traits::propagate_on_container_move_assignment::value)
+            alloc = std::move(rhs.alloc);
+        steal(rhs);
+        return *this;
+    }
+
+    void swap(Vec& other) noexcept  // like std::vector: unequal, non-propagating allocators are UB
+    {
+        if constexpr (alloc_traits::propagate_on_container_swap::value)
+        {
+            using std::swap;
+            swap(alloc, other.alloc);
+        }
+        swap_buffers(other);
+    }
+
+    allocator_type get_allocator() const noexcept { return alloc; }
+
+    void reserve(size_type n)   // strong guarantee
+    {
+        if (n <= cap)
+            return;
+        T* nv = allocate(n);
+        try
+        {
+            relocate(v, v + sz, nv);
+        }
+        catch (...)
+        {
+            deallocate(nv, n);
+            throw;
+        }
+        destroy_relocated(v, v + sz);
+        deallocate(v, cap);
+        v = nv;
+        cap = n;
+    }
+
+    void push_back(const T& x) { emplace_back(x); }
+    void push_back(T&& x) { emplace_back(std::move(x)); }
+
+    template <class... Args>
+    T& emplace_back(Args&&... args)     // strong guarantee
+    {
+        if (sz < cap)
+        {
+            construct(v + sz, std::forward<Args>(args)...);
+        }
+        else
+        {
+            size_type ncap = next_capacity();
+            T* nv = allocate(ncap);
+            try
+            {
+                // build the new element first: args may refer into the old buffer
+                construct(nv + sz, std::forward<Args>(args)...);
+                try
+                {
+                    relocate(v, v + sz, nv);
+                }
+                catch (...)
+                {
+                    destroy(nv + sz);
+                    throw;
+                }
+            }
+            catch (...)
+            {
+                deallocate(nv, ncap);
+                throw;
+            }
+            destroy_relocated(v, v + sz);
+            deallocate(v, cap);
+            v = nv;
+            cap = ncap;
+        }
+        return v[sz++];
+    }
+
+    template <class It>     // forward iterators
+    void assign(It first, It last)      // strong guarantee
+    {
+        size_type n = std::distance(first, last);
+        if constexpr (reuse_is_safe)
+        {
+            if (n <= cap)
+            {
+                // nothing below can throw, so overwriting in place is still all-or-nothing
+                size_type common = sz < n ? sz : n;
+                It mid = std::next(first, common);
+                std::copy(first, mid, v);
+                if (sz < n)
+                    construct_copies(mid, last, v + sz);
+                else
+                    destroy(v + n, v + sz);
+                sz = n;
+                return;
+            }
+        }
+        else if constexpr (nothrow_relocate)
+        {
+            if (n <= cap && sz < cap)
+            {
+                assign_beside(first, last, n);
+                return;
+            }
+        }
+        // a bigger buffer is needed anyway, or moving T may throw: the copy-and-swap from above
+        Vec tmp(alloc);
+        tmp.reserve(n);
+        tmp.construct_copies(first, last, tmp.v);       // on a throw tmp frees the buffer
+        tmp.sz = n;
+        swap_buffers(tmp);
+    }
+
+    template <class It>     // forward iterators
+    void append(It first, It last) { insert(end(), first, last); }
+
+    iterator insert(const_iterator pos, const T& x) { return emplace(pos, x); }
+    iterator insert(const_iterator pos, T&& x) { return emplace(pos, std::move(x)); }
+
+    template <class It>     // forward iterators
+    iterator insert(const_iterator pos, It first, It last)     // strong guarantee
+    {
+        size_type idx = pos - v;
+        size_type n = std::distance(first, last);
+        if (n == 0)
+            return v + idx;
+        if (sz + n <= cap && (idx == sz || shift_is_safe))
+        {
+            // build the new elements at the end (the only step that may throw, and [first, last) may be a part of this Vec),
+            // then rotate them into the gap; an append has nothing to rotate, so it does not care how T moves
+            construct_copies(first, last, v + sz);
+            if constexpr (bitwise)
+            {
+                unsigned char* bytes = reinterpret_cast<unsigned char*>(v);     // rotating the bytes rotates the elements
+                std::rotate(bytes + idx * sizeof(T), bytes + sz * sizeof(T), bytes + (sz + n) * sizeof(T));
+            }
+            else
+            {
+                std::rotate(v + idx, v + sz, v + sz + n);
+            }
+            sz += n;
+            return v + idx;
+        }
+        // the same as emplace(): the new elements first, then the old ones around them
+        size_type ncap = sz + n <= cap ? cap : std::max(sz + n, next_capacity());
+        T* nv = allocate(ncap);
+        size_type built = 0;
+        try
+        {
+            construct_copies(first, last, nv + idx);
+            try
+            {
+                relocate(v, v + idx, nv);
+                built = idx;
+                relocate(v + idx, v + sz, nv + idx + n);
+            }
+            catch (...)
+            {
+                destroy(nv, nv + built);
+                destroy(nv + idx, nv + idx + n);
+                throw;
+            }
+        }
+        catch (...)
+        {
+            deallocate(nv, ncap);
+            throw;
+        }
+        destroy_relocated(v, v + sz);
+        deallocate(v, cap);
+        v = nv;
+        cap = ncap;
+        sz += n;
+        return v + idx;
+    }
+
+    template <class... Args>
+    iterator emplace(const_iterator pos, Args&&... args)  // strong guarantee
+    {
+        size_type idx = pos - v;
+        if (idx == sz)
+        {
+            emplace_back(std::forward<Args>(args)...);
+            return v + idx;
+        }
+        if constexpr (bitwise)
+        {
+            if (sz < cap)
+            {
+                // build the new element aside (args may refer into the buffer), then open the gap with one memmove
+                alignas(T) unsigned char tmp[sizeof(T)];
+                construct(reinterpret_cast<T*>(tmp), std::forward<Args>(args)...);    // the only step that may throw
+                relocate_bytes(v + idx + 1, v + idx, sz - idx);
+                std::memcpy(static_cast<void*>(v + idx), tmp, sizeof(T));
+                ++sz;
+                return v + idx;
+            }
+        }
+        else if (sz < cap && shift_is_safe)
+        {
+            // aside, but through the allocator too: a pmr string has to get its memory from our resource
+            alignas(T) unsigned char buf[sizeof(T)];
+            T* tmp = reinterpret_cast<T*>(buf);
+            construct(tmp, std::forward<Args>(args)...);    // the only step that may throw
+            construct(v + sz, std::move(v[sz - 1]));
+            std::move_backward(v + idx, v + sz - 1, v + sz);
+            v[idx] = std::move(*tmp);
+            destroy(tmp);
+            ++sz;
+            return v + idx;
+        }
+        // shifting with a throwing move could leave a half-moved buffer: build a new one instead
+        size_type ncap = sz < cap ? cap : next_capacity();
+        T* nv = allocate(ncap);
+        size_type built = 0;
+        try
+        {
+            construct(nv + idx, std::forward<Args>(args)...);
+            try
+            {
+                relocate(v, v + idx, nv);
+                built = idx;
+                relocate(v + idx, v + sz, nv + idx + 1);
+            }
+            catch (...)
+            {
+                destroy(nv, nv + built);
+                destroy(nv + idx);
+                throw;
+            }
+        }
+        catch (...)
+        {
+            deallocate(nv, ncap);
+            throw;
+        }
+        destroy_relocated(v, v + sz);
+        deallocate(v, cap);
+        v = nv;
+        cap = ncap;
+        ++sz;
+        return v + idx;
+    }
+
+    iterator erase(const_iterator pos)  // nothrow if the move assignment of T is nothrow (or T is trivially relocatable)
+    {
+        size_type idx = pos - v;
+        if constexpr (bitwise)
+        {
+            destroy(v + idx);
+            relocate_bytes(v + idx, v + idx + 1, sz - idx - 1);
+            --sz;
+        }
+        else
+        {
+            std::move(v + idx + 1, v + sz, v + idx);
+            destroy(v + --sz);
+        }
+        return v + idx;
+    }
+
+    void pop_back() noexcept { destroy(v + --sz); }
+    void clear() noexcept { destroy(v, v + sz); sz = 0; }
+
+    T& operator[](size_type i) noexcept { return v[i]; }
+    const T& operator[](size_type i) const noexcept { return v[i]; }
+
+    iterator begin() noexcept { return v; }
+    iterator end() noexcept { return v + sz; }
+    const_iterator begin() const noexcept { return v; }
+    const_iterator end() const noexcept { return v + sz; }
+
+    T* data() noexcept { return v; }
+    const T* data() const noexcept { return v; }
+    size_type size() const noexcept { return sz; }
+    size_type capacity() const noexcept { return cap; }
+    bool empty() const noexcept { return sz == 0; }
+
+private:
+    template <class, class> friend struct vec_paths;   // the audit below reads the constants of the paths
+
+    // copy-assigning into the old buffer is only all-or-nothing if it cannot fail half way
+    static constexpr bool reuse_is_safe = std::is_nothrow_copy_assignable<T>::value
+                                       && std::is_nothrow_copy_constructible<T>::value;
+
+    T* allocate(size_type n)
+    {
+        return n ? alloc_traits::allocate(alloc, n) : nullptr;
+    }
+
+    void deallocate(T* p, size_type n) noexcept
+    {
+        if (p)
+            alloc_traits::deallocate(alloc, p, n);
+    }
+
+    // every element is built and ended through the allocator: a polymorphic_allocator passes its resource on to a pmr::string
+    // element, a scoped_allocator_adaptor its inner allocator. Only the bitwise relocation below copies bytes instead
+    template <class... Args>
+    void construct(T* p, Args&&... args)
+    {
+        alloc_traits::construct(alloc, p, std::forward<Args>(args)...);
+    }
+
+    void destroy(T* p) noexcept { alloc_traits::destroy(alloc, p); }
+
+    void destroy(T* first, T* last) noexcept
+    {
+        for (; first != last; ++first)
+            alloc_traits::destroy(alloc, first);
+    }
+
+    // std::uninitialized_copy through the allocator: on a throw the copies already built are destroyed
+    template <class It>
+    void construct_copies(It first, It last, T* dest)
+    {
+        T* cur = dest;
+        try
+        {
+            for (; first != last; ++first, ++cur)
+                construct(cur, *first);
+        }
+        catch (...)
+        {
+            destroy(dest, cur);
+            throw;
+        }
+    }
+
+    // take over the buffer of other, which must come from an equal allocator
+    void steal(Vec& other) noexcept
+    {
+        cap = other.cap;
+        sz = other.sz;
+        v = other.v;
+        other.cap = other.sz = 0;
+        other.v = nullptr;
+    }
+
+    void swap_buffers(Vec& other) noexcept
+    {
+        std::swap(cap, other.cap);
+        std::swap(sz, other.sz);
+        std::swap(v, other.v);
+    }
+
+    // elements that are relocatable by bytes are moved with memcpy / memmove, and the old ones are not destroyed
+    static constexpr bool bitwise = is_trivially_relocatable_v<T>;
+
+    // moving the elements inside the buffer (insert in place) cannot fail half way
+    static constexpr bool shift_is_safe = bitwise || (std::is_nothrow_move_constructible<T>::value
+                                                      && std::is_nothrow_move_assignable<T>::value);
+
+    // relocate_nothrow() can be used: the commit step of assign()
+    static constexpr bool nothrow_relocate = bitwise || std::is_nothrow_move_constructible<T>::value;
+
+    // move if T cannot throw while moving (or cannot be copied), copy otherwise:
+    // on a throw the source is untouched, so the caller can simply drop the new buffer
+    void relocate(T* first, T* last, T* dest)
+    {
+        if constexpr (bitwise)
+        {
+            relocate_bytes(dest, first, last - first);
+        }
+        else
+        {
+            T* cur = dest;
+            try
+            {
+                for (; first != last; ++first, ++cur)
+                    construct(cur, std::move_if_noexcept(*first));
+            }
+            catch (...)
+            {
+                destroy(dest, cur);
+                throw;
+            }
+        }
+    }
+
+    // The new elements are built beside the old ones: into the spare capacity, and what does not fit there into a scratch
+    // buffer of sz + n - cap elements. Until the last one is built the old elements are untouched, after it nothing can throw:
+    // the old ones are destroyed and the new ones moved down
+    template <class It>
+    void assign_beside(It first, It last, size_type n)
+    {
+        size_type in_spare = n < cap - sz ? n : cap - sz;
+        size_type rest = n - in_spare;
+        It mid = std::next(first, in_spare);
+        T* scratch = allocate(rest);
+        try
+        {
+            construct_copies(first, mid, v + sz);
+            try
+            {
+                construct_copies(mid, last, scratch);
+            }
+            catch (...)
+            {
+                destroy(v + sz, v + sz + in_spare);
+                throw;
+            }
+        }
+        catch (...)
+        {
+            deallocate(scratch, rest);
+            throw;
+        }
+        destroy(v, v + sz);
+        relocate_nothrow(v + sz, v + sz + in_spare, v);
+        relocate_nothrow(scratch, scratch + rest, v + in_spare);
+        deallocate(scratch, rest);
+        sz = n;
+    }
+
+    // moves [first, last) to dest and ends the old elements; dest may overlap the range if it is below first. Both ends use our
+    // allocator, so a move that takes an allocator (a pmr string) does not have to copy either
+    void relocate_nothrow(T* first, T* last, T* dest) noexcept
+    {
+        static_assert(nothrow_relocate);
+        if constexpr (bitwise)
+        {
+            relocate_bytes(dest, first, last - first);
+        }
+        else
+        {
+            for (; first != last; ++first, ++dest)
+            {
+                construct(dest, std::move(*first));
+                destroy(first);
+            }
+        }
+    }
+
+    // the end of relocate(): the old elements are destroyed, unless their bytes were taken over
+    void destroy_relocated(T* first, T* last) noexcept
+    {
+        if constexpr (!bitwise)
+            destroy(first, last);
+    }
+
+    size_type next_capacity() const noexcept
+    {
+        return cap ? 2 * cap : 4;
+    }
+
+    [[no_unique_address]] Alloc alloc;     // an empty std::allocator takes no room: a Vec<int> is 24 bytes
+    size_t cap;
+    size_t sz;
+    T* v;
+};
+
+// Basic example of a benchmark: allocations and peak heap on large reassignments
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// the allocations and the peak heap are counted by the operator new of COUNTING THE HEAP
+
+template <class C, class Assign>
+void reassign_bench(const char* name, Assign assign)
+{
+    C a, b;
+    for (int i = 0; i < 1'000'000; ++i) { a.push_back(i); b.push_back(-i); }
+
+    n_allocs = 0;
+    peak_bytes = cur_bytes.load();
+    std::size_t base = cur_bytes;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int round = 0; round < 100; ++round)
+        assign(a, b);       // assign a large vector over a large vector
+    auto t1 = std::chrono::steady_clock::now();
+    std::printf("%-16s allocs: %4zu  extra peak: %6zu KB  time: %lld ms\n", name, n_allocs.load(),
+                (peak_bytes - base) / 1024,
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count());
+}
+
+int main()
+{
+    reassign_bench<std::vector<long>>("std::vector", [](auto& a, auto& b) { a = b; });
+    reassign_bench<Vec<long>>("Vec copy-and-swap", [](auto& a, auto& b) { Vec<long> tmp(b); a.swap(tmp); });
+    reassign_bench<Vec<long>>("Vec", [](auto& a, auto& b) { a = b; });
+}
+
+/*
+This is the copy-and-swap Vec from above turned into a real container. The interesting part is how it grows. When reserve() or push_back()
+needs a bigger buffer, the elements are put into the new buffer with std::move_if_noexcept. If the move constructor of T is noexcept we move
+(cheap), otherwise we copy. Copying is slower, but if a copy throws in the middle, the old buffer has not been touched at all, so we
+just destroy what we built in the new buffer and rethrow. The Vec looks exactly like it did before the call: this is the strong guarantee.
+If we moved with a throwing move constructor and it threw at element 500, then 499 elements would already be "stolen" and we could not go back.
+That is the same reason why std::vector copies types that have a throwing move constructor.
+
+emplace_back() constructs the new element in the new buffer before moving the old ones, because the argument could be a reference into
+the old buffer (v.push_back(v[0])).
+
+insert() in the middle shifts the elements in place only if moving cannot throw. Otherwise it builds a new buffer, just like the growth case,
+so insert() is also strong. erase() has the same guarantee as std::vector: nothrow if the move assignment of T does not throw.
+
+The copy assignment does not always allocate a second buffer any more. If the old buffer is big enough and copying T cannot throw (int, double,
+plain structs) we overwrite the old elements in place. Nothing can fail half way, so it is still all-or-nothing. When copying T may throw
+the old value has to stay alive until the last copy is done: assign() builds the new elements beside the old ones (STRONG GUARANTEE
+EXAMPLE - 5), and copy-and-swap is only left for a buffer that is too small or a T whose move may throw.
+
+The benchmark counts the allocations and the peak heap size (COUNTING THE HEAP) while we assign a 1M element vector
+of longs over another one 100 times. The output on my machine:
+
+    std::vector       allocs:    0  extra peak:      0 KB  time: 93 ms
+    Vec copy-and-swap allocs:  100  extra peak:   7812 KB  time: 127 ms
+    Vec               allocs:    0  extra peak:      0 KB  time: 96 ms
+
+So the plain copy-and-swap allocates a second full buffer on every assignment (the peak is two times the data), while the new Vec is on par
+with std::vector. The difference from std::vector is that std::vector reuses the buffer even if copying T can throw (then it only gives
+the basic guarantee), while Vec builds the new elements beside the old ones in that case and keeps the strong guarantee.
+*/
+
+
+
+// STRONG GUARANTEE EXAMPLE - 3 | SMALL BUFFER OPTIMIZATION AND ALLOCATORS
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <class T, std::size_t N, class Alloc = std::allocator<T>>
+class SmallVec
+{
+    static_assert(N > 0, "SmallVec needs an inline buffer, use Vec for N = 0");
+
+    using alloc_traits = std::allocator_traits<Alloc>;
+
+public:
+    using value_type = T;
+    using allocator_type = Alloc;
+    using size_type = std::size_t;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    SmallVec() noexcept(noexcept(Alloc())) : SmallVec(Alloc()) { }
+
+    explicit SmallVec(const Alloc& a) noexcept : alloc(a), cap(N), sz(0), v(inline_buf()) { }
+
+    SmallVec(const SmallVec& rhs)
+        : SmallVec(rhs, alloc_traits::select_on_container_copy_construction(rhs.alloc)) { }
+
+    SmallVec(const SmallVec& rhs, const Alloc& a) : SmallVec(a)
+    {
+        if (rhs.sz > N)
+        {
+            v = allocate(rhs.sz);
+            cap = rhs.sz;
+        }
+        try
+        {
+            construct_copies(rhs.v, rhs.v + rhs.sz, v);
+            sz = rhs.sz;
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    SmallVec(SmallVec&& rhs) noexcept(std::is_nothrow_move_constructible<T>::value)
+        : SmallVec(rhs.alloc)
+    {
+        take(rhs);
+    }
+
+    ~SmallVec()
+    {
+        destroy(v, v + sz);
+        release();
+    }
+
+    SmallVec& operator=(const SmallVec& rhs)
+    {
+        if (this == &rhs)
+            return *this;
+        if constexpr (alloc_traits::propagate_on_container_copy_assignment::value)
+        {
+            if (alloc != rhs.alloc)     // our buffer cannot be reused or freed by the new allocator
+            {
+                copy_new(rhs, rhs.alloc);
+                return *this;
+            }
+        }
+        if (rhs.sz <= cap && reuse_is_safe)
+        {
+            // nothing below can throw, so overwriting in place is still all-or-nothing
+            size_type common = sz < rhs.sz ? sz : rhs.sz;
+            std::copy(rhs.v, rhs.v + common, v);
+            if (sz < rhs.sz)
+                construct_copies(rhs.v + sz, rhs.v + rhs.sz, v + sz);
+            else
+                destroy(v + rhs.sz, v + sz);
+            sz = rhs.sz;
+        }
+        else
+        {
+            copy_new(rhs, alloc);
+        }
+        return *this;
+    }
+
+    SmallVec& operator=(SmallVec&& rhs) noexcept(std::is_nothrow_move_constructible<T>::value
+                                                 && alloc_traits::is_always_equal::value)
+    {
+        if (this != &rhs)
+        {
+            clear();
+            release();
+            if constexpr (alloc_traits::propagate_on_container_move_assignment::value)
+                alloc = rhs.alloc;      // a copy: rhs may still have inline elements to end with it
+            take(rhs);                  // steals a heap buffer if the allocators are equal now, moves the elements otherwise
+        }
+        return *this;
+    }
+
+    void reserve(size_type n)   // strong guarantee
+    {
+        if (n <= cap)
+            return;
+        T* nv = allocate(n);
+        try
+        {
+            relocate(v, v + sz, nv);
+        }
+        catch (...)
+        {
+            alloc_traits::deallocate(alloc, nv, n);
+            throw;
+        }
+        destroy(v, v + sz);
+        release();
+        v = nv;
+        cap = n;
+    }
+
+    void push_back(const T& x) { emplace_back(x); }
+    void push_back(T&& x) { emplace_back(std::move(x)); }
+
+    template <class... Args>
+    T& emplace_back(Args&&... args)     // strong guarantee
+    {
+        if (sz < cap)
+        {
+            construct(v + sz, std::forward<Args>(args)...);
+        }
+        else
+        {
+            size_type ncap = 2 * cap;
+            T* nv = allocate(ncap);
+            try
+            {
+                construct(nv + sz, std::forward<Args>(args)...);
+                try
+                {
+                    relocate(v, v + sz, nv);
+                }
+                catch (...)
+                {
+                    destroy(nv + sz);
+                    throw;
+                }
+            }
+            catch (...)
+            {
+                alloc_traits::deallocate(alloc, nv, ncap);
+                throw;
+            }
+            destroy(v, v + sz);
+            release();
+            v = nv;
+            cap = ncap;
+        }
+        return v[sz++];
+    }
+
+    void pop_back() noexcept { destroy(v + --sz); }
+    void clear() noexcept { destroy(v, v + sz); sz = 0; }
+
+    T& operator[](size_type i) noexcept { return v[i]; }
+    const T& operator[](size_type i) const noexcept { return v[i]; }
+
+    iterator begin() noexcept { return v; }
+    iterator end() noexcept { return v + sz; }
+    const_iterator begin() const noexcept { return v; }
+    const_iterator end() const noexcept { return v + sz; }
+
+    T* data() noexcept { return v; }
+    size_type size() const noexcept { return sz; }
+    size_type capacity() const noexcept { return cap; }
+    bool empty() const noexcept { return sz == 0; }
+    bool is_inline() const noexcept { return v == inline_buf(); }
+    allocator_type get_allocator() const noexcept { return alloc; }
+
+private:
+    static constexpr bool reuse_is_safe = std::is_nothrow_copy_assignable<T>::value
+                                       && std::is_nothrow_copy_constructible<T>::value;
+
+    T* inline_buf() noexcept { return reinterpret_cast<T*>(buf); }
+    const T* inline_buf() const noexcept { return reinterpret_cast<const T*>(buf); }
+
+    T* allocate(size_type n) { return alloc_traits::allocate(alloc, n); }
+
+    // free the heap buffer (if any) and go back to the inline one; the elements must be destroyed already
+    void release() noexcept
+    {
+        if (!is_inline())
+            alloc_traits::deallocate(alloc, v, cap);
+        v = inline_buf();
+        cap = N;
+    }
+
+    // the copy assignment into new elements that use the allocator a: *this is unchanged if a copy throws
+    void copy_new(const SmallVec& rhs, const Alloc& a)
+    {
+        if (std::is_nothrow_move_constructible<T>::value || rhs.sz == 0)
+        {
+            SmallVec tmp(rhs, a);       // may throw, *this is untouched
+            clear();
+            release();
+            adopt(a);
+            take(tmp);                  // cannot throw, tmp has our allocator now
+        }
+        else
+        {
+            // moving out of an inline tmp could throw half way, so the copy
+            // goes to the heap even if it would fit and we commit by taking its pointer
+            Alloc na(a);
+            T* nv = alloc_traits::allocate(na, rhs.sz);
+            size_type built = 0;
+            try
+            {
+                for (; built < rhs.sz; ++built)     // built with the allocator that will own them
+                    alloc_traits::construct(na, nv + built, rhs.v[built]);
+            }
+            catch (...)
+            {
+                for (size_type i = 0; i < built; ++i)
+                    alloc_traits::destroy(na, nv + i);
+                alloc_traits::deallocate(na, nv, rhs.sz);
+                throw;
+            }
+            clear();
+            release();
+            adopt(na);
+            v = nv;
+            cap = sz = rhs.sz;
+        }
+    }
+
+    // a is rhs.alloc only if it propagates, otherwise it is our own (and may not even be assignable, like a polymorphic_allocator)
+    void adopt(const Alloc& a) noexcept
+    {
+        if constexpr (alloc_traits::propagate_on_container_copy_assignment::value)
+            alloc = a;
+    }
+
+    // *this is empty and inline: steal a heap buffer, or move the elements of an inline one
+    void take(SmallVec& rhs)
+    {
+        if (!rhs.is_inline() && alloc == rhs.alloc)
+        {
+            v = rhs.v;
+            cap = rhs.cap;
+            sz = rhs.sz;
+            rhs.v = rhs.inline_buf();
+            rhs.cap = N;
+            rhs.sz = 0;
+            return;
+        }
+        reserve(rhs.sz);
+        for (; sz < rhs.sz; ++sz)
+            construct(v + sz, std::move(rhs.v[sz]));
+        rhs.clear();
+    }
+
+    // like in Vec, the elements are built and ended through the allocator
+    template <class... Args>
+    void construct(T* p, Args&&... args)
+    {
+        alloc_traits::construct(alloc, p, std::forward<Args>(args)...);
+    }
+
+    void destroy(T* p) noexcept { alloc_traits::destroy(alloc, p); }
+
+    void destroy(T* first, T* last) noexcept
+    {
+        for (; first != last; ++first)
+            alloc_traits::destroy(alloc, first);
+    }
+
+    template <class It>
+    void construct_copies(It first, It last, T* dest)
+    {
+        T* cur = dest;
+        try
+        {
+            for (; first != last; ++first, ++cur)
+                construct(cur, *first);
+        }
+        catch (...)
+        {
+            destroy(dest, cur);
+            throw;
+        }
+    }
+
+    void relocate(T* first, T* last, T* dest)
+    {
+        T* cur = dest;
+        try
+        {
+            for (; first != last; ++first, ++cur)
+                construct(cur, std::move_if_noexcept(*first));
+        }
+        catch (...)
+        {
+            destroy(dest, cur);
+            throw;
+        }
+    }
+
+    [[no_unique_address]] Alloc alloc;
+    size_t cap;
+    size_t sz;
+    T* v;
+    alignas(T) unsigned char buf[N * sizeof(T)];
+};
+
+// Basic example of a benchmark: short lived vectors with fewer than 16 elements
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// the allocations are counted by the operator new of COUNTING THE HEAP
+
+template <class C, class Make, class Reset>
+void short_lived_bench(const char* name, Make make, Reset batch_done)
+{
+    n_allocs = 0;
+    long long sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int batch = 0; batch < 1000; ++batch)
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            C c = make();
+            for (int j = 0; j < 12; ++j)
+                c.push_back(i + j);
+            sum += c[11];
+        }   // destroyed here
+        batch_done();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    std::printf("%-24s allocs: %8zu  time: %4lld ms\n", name, n_allocs.load(),
+                (long long)std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count());
+    if (sum != 1000LL * (999 * 1000 / 2 + 11 * 1000))     // the sum of every c[11], it also keeps the vectors alive
+        std::printf("%-24s wrong elements (%lld)\n", name, sum);
+}
+
+int main()
+{
+    using pmr_vec = Vec<int, std::pmr::polymorphic_allocator<int>>;
+    auto nothing = [] { };
+
+    short_lived_bench<Vec<int>>("Vec (heap only)", [] { return Vec<int>(); }, nothing);
+    short_lived_bench<SmallVec<int, 16>>("SmallVec<int, 16>", [] { return SmallVec<int, 16>(); }, nothing);
+
+    std::pmr::unsynchronized_pool_resource pool;
+    short_lived_bench<pmr_vec>("Vec + pool resource", [&] { return pmr_vec(&pool); }, nothing);
+
+    static char arena[1024 * 1024];
+    std::pmr::monotonic_buffer_resource mono(arena, sizeof(arena), std::pmr::null_memory_resource());
+    short_lived_bench<pmr_vec>("Vec + monotonic arena", [&] { return pmr_vec(&mono); },
+                               [&] { mono.release(); });     // a whole batch is freed at once
+}
+
+/*
+The Vec above got a second template parameter, the allocator, just like std::vector has. All the memory goes through
+std::allocator_traits<Alloc>, so with std::pmr::polymorphic_allocator a Vec can draw from a monotonic arena
+(std::pmr::monotonic_buffer_resource, deallocate does nothing and the whole arena is freed at once) or from a pool
+(std::pmr::unsynchronized_pool_resource, freed blocks are reused for the next vector). The elements are built and destroyed with
+allocator_traits::construct / destroy too, not with placement new, so a Vec<std::pmr::string> passes its arena on to the strings (and a
+scoped_allocator_adaptor its inner allocator). The copy and move assignments follow the propagate_on_container_... traits: if two
+vectors use different arenas, a move cannot just steal the buffer, it has to move the elements. The allocator member is
+[[no_unique_address]], so the empty std::allocator costs nothing and a Vec<int> stays three words.
+
+SmallVec<T, N> keeps the first N elements inside the object itself, so a vector of fewer than N elements never touches the heap.
+The price is that "swap" is no longer just swapping three pointers: if the buffer is inline, the elements themselves have to be moved.
+That is why the copy assignment is done a bit differently:
+    if the old buffer is big enough and copying cannot throw, we overwrite in place (same as Vec)
+    if moving T cannot throw, we copy into a temporary (this can throw, but *this is untouched) and then move the temporary in, which cannot throw
+    otherwise we copy into a heap buffer even if the elements would fit inline, and commit by taking over its pointer
+    if the allocator propagates on copy assignment and rhs has a different one, we never reuse the old buffer (the new allocator could not
+    free it): the last two cases build the copy with the allocator of rhs, which *this takes over at the commit, like in Vec
+So the strong guarantee holds for the inline buffer as well, not only for the heap one. N has to be at least 1 (a static_assert):
+the growth doubles the capacity starting from N, and a SmallVec without an inline buffer is just a Vec.
+
+The benchmark builds and destroys 1M vectors of 12 ints (in batches of 1000, the arena is released after every batch). The output on my machine:
+
+    Vec (heap only)          allocs:  3000000  time:  118 ms
+    SmallVec<int, 16>        allocs:        0  time:   47 ms
+    Vec + pool resource      allocs:        0  time:  193 ms
+    Vec + monotonic arena    allocs:        0  time:   52 ms
+
+The heap only Vec allocates three times per vector (4, 8 and 16 elements), SmallVec never does. The heap only line includes the counter
+itself: its atomic counts and the size header cost about 10 ns per allocation (with a plain malloc and a non-atomic count the same line
+was 70-90 ms on the same day). The pool resource gets its big blocks through the aligned operator new, that is why the counter shows 0
+there. It is interesting that the pool is slower than plain malloc for this pattern: glibc malloc has a per-thread cache for small blocks,
+so a pool only pays off if the blocks are bigger or the pattern is less regular. The monotonic arena is faster, because deallocate() does
+nothing and the release of a whole batch is a single pointer reset.
+*/
+
+
+
+// STRONG GUARANTEE EXAMPLE - 4 | A COMPILE TIME NOEXCEPT AUDIT OF THE ELEMENT TYPES
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// what the compiler knows about the special members of T
+template <class T>
+struct member_audit
+{
+    static constexpr bool nothrow_default = std::is_nothrow_default_constructible<T>::value;
+    static constexpr bool copyable = std::is_copy_constructible<T>::value;
+    static constexpr bool nothrow_copy = std::is_nothrow_copy_constructible<T>::value;
+    static constexpr bool nothrow_move = std::is_nothrow_move_constructible<T>::value;
+    static constexpr bool nothrow_copy_assign = std::is_nothrow_copy_assignable<T>::value;
+    static constexpr bool nothrow_move_assign = std::is_nothrow_move_assignable<T>::value;
+    static constexpr bool nothrow_destructor = std::is_nothrow_destructible<T>::value;
+    static constexpr bool trivially_copyable = std::is_trivially_copyable<T>::value;
+    static constexpr bool trivially_relocatable = is_trivially_relocatable_v<T>;
+};
+
+enum class vec_growth
+{
+    bytes,      // memmove, T is trivially relocatable
+    move,       // move_if_noexcept moves
+    copy,       // move_if_noexcept copies: the move constructor may throw
+    unsafe_move // may throw and can not be copied: moved anyway, a throw loses the strong guarantee
+};
+
+// Which code of Vec<T, Alloc> gets instantiated for T. It reads the same constants that Vec decides with (it is a friend of Vec),
+// so the audit can not drift away from the container
+template <class T, class Alloc = std::allocator<T>>
+struct vec_paths : member_audit<T>
+{
+    using V = Vec<T, Alloc>;
+    using M = member_audit<T>;
+
+    static constexpr vec_growth growth = V::bitwise ? vec_growth::bytes
+                                       : M::nothrow_move ? vec_growth::move
+                                       : M::copyable ? vec_growth::copy
+                                       : vec_growth::unsafe_move;
+    static constexpr bool insert_in_place = V::shift_is_safe;  // in the middle, else: a new buffer (an append with room is always in place)
+    static constexpr bool erase_nothrow = V::bitwise || M::nothrow_move_assign;
+    static constexpr bool assign_in_place = V::reuse_is_safe;
+    static constexpr bool assign_beside = !assign_in_place && V::nothrow_relocate;  // else: copy-and-swap, a second buffer
+    static constexpr bool strong = growth != vec_growth::unsafe_move;   // reserve, push_back, insert
+};
+
+// The report is a warning for every slow path. The calls below depend on T, so they are checked when vec_audit<T> is instantiated,
+// and the compiler prints the warning with "[with T = ...]" and the line that asked for the audit
+struct grows_by_copy { };
+struct grows_without_strong_guarantee { };
+struct insert_reallocates { };
+struct erase_may_throw { };
+
+[[deprecated("Vec<T> grows by copying the elements: the move constructor of T is not noexcept")]]
+constexpr void vec_audit_note(grows_by_copy, const void*) { }
+[[deprecated("Vec<T> grows by a throwing move: reserve / push_back / insert only give the basic guarantee")]]
+constexpr void vec_audit_note(grows_without_strong_guarantee, const void*) { }
+[[deprecated("Vec<T>::insert in the middle builds a new buffer even when there is capacity: moving T may throw")]]
+constexpr void vec_audit_note(insert_reallocates, const void*) { }
+[[deprecated("Vec<T>::erase may throw: the move assignment of T is not noexcept")]]
+constexpr void vec_audit_note(erase_may_throw, const void*) { }
+
+enum class audit_mode
+{
+    report,     // warnings
+    enforce     // compile errors: for the types on a hot path
+};
+
+#if defined(VEC_AUDIT_ENFORCE)
+inline constexpr audit_mode default_audit_mode = audit_mode::enforce;   // -DVEC_AUDIT_ENFORCE: every audit is strict
+#else
+inline constexpr audit_mode default_audit_mode = audit_mode::report;
+#endif
+
+template <class T, audit_mode Mode = default_audit_mode, class Alloc = std::allocator<T>>
+constexpr bool vec_audit()
+{
+    using P = vec_paths<T, Alloc>;
+    constexpr const T* t = nullptr;
+    if constexpr (Mode == audit_mode::enforce)
+    {
+        static_assert(P::growth == vec_growth::bytes || P::growth == vec_growth::move,
+                      "hot path type: the move constructor of T must be noexcept (or T trivially relocatable)");
+        static_assert(P::erase_nothrow, "hot path type: the move assignment of T must be noexcept");   // with the first: insert in place
+        static_assert(P::nothrow_destructor, "hot path type: the destructor of T must not throw");
+    }
+    else
+    {
+        if constexpr (P::growth == vec_growth::copy)
+            vec_audit_note(grows_by_copy{ }, t);
+        if constexpr (P::growth == vec_growth::unsafe_move)
+            vec_audit_note(grows_without_strong_guarantee{ }, t);
+        if constexpr (!P::insert_in_place)
+            vec_audit_note(insert_reallocates{ }, t);
+        if constexpr (!P::erase_nothrow)
+            vec_audit_note(erase_may_throw{ }, t);
+    }
+    return true;
+}
+
+// the same as a table, for printing it
+template <class T, class Alloc = std::allocator<T>>
+void print_vec_audit(std::FILE* out, const char* name)
+{
+    using P = vec_paths<T, Alloc>;
+    static const char* const growth[] = { "memmove", "move", "copy", "throwing move" };
+    std::fprintf(out, "%-12s  move: %-9s  copy: %-9s  trivially copyable: %-3s  relocatable: %-3s\n", name,
+                 P::nothrow_move ? "nothrow" : "may throw", !P::copyable ? "deleted" : P::nothrow_copy ? "nothrow" : "may throw",
+                 P::trivially_copyable ? "yes" : "no", P::trivially_relocatable ? "yes" : "no");
+    std::fprintf(out, "%-12s  growth: %-13s  insert: %-11s  erase: %-9s  assign: %-13s  guarantee: %s\n", "",
+                 growth[static_cast<int>(P::growth)], P::insert_in_place ? "in place" : "new buffer",
+                 P::erase_nothrow ? "nothrow" : "may throw", P::assign_in_place ? "in place" : P::assign_beside ? "beside" : "copy-and-swap",
+                 P::strong ? "strong" : "basic");
+}
+
+struct Order        // the hot path type
+{
+    std::string symbol;
+    std::vector<double> fills;
+
+    Order(std::string s) : symbol(std::move(s)) { }
+    Order(const Order&) = default;
+    Order(Order&& o) : symbol(std::move(o.symbol)), fills(std::move(o.fills)) { }  // someone added a log line here and lost noexcept
+    Order& operator=(const Order&) = default;
+    Order& operator=(Order&&) = default;
+};
+
+void f()
+{
+static_assert(vec_audit<std::unique_ptr<int>, audit_mode::enforce>()); // fine, next to the declaration of the hot path vectors
+static_assert(vec_audit<Order>()); // warning: Vec<T> grows by copying the elements ... [with T = Order]
+static_assert(vec_audit<Order, audit_mode::enforce>()); // error: hot path type: the move constructor of T must be noexcept
+}
+
+// Basic example of a benchmark: what the lost noexcept costs, 1M push_back with growth
+
+#include <chrono>
+
+struct FastOrder    // the same with noexcept
+{
+    std::string symbol;
+    std::vector<double> fills;
+
+    FastOrder(std::string s) : symbol(std::move(s)) { }
+    FastOrder(const FastOrder&) = default;
+    FastOrder(FastOrder&& o) noexcept : symbol(std::move(o.symbol)), fills(std::move(o.fills)) { }
+    FastOrder& operator=(const FastOrder&) = default;
+    FastOrder& operator=(FastOrder&&) = default;
+};
+
+static_assert(vec_audit<FastOrder, audit_mode::enforce>());
+static_assert(vec_audit<Order>());  // the warnings of the report
+
+template <class T>
+double fill_ms(int n)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    Vec<T> v;
+    for (int i = 0; i < n; ++i)
+    {
+        v.push_back(T("a symbol longer than the small buffer"));
+        v[i].fills.assign(4, 1.0);
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main()
+{
+    print_vec_audit<long>(stdout, "long");
+    print_vec_audit<std::unique_ptr<int>>(stdout, "unique_ptr");
+    print_vec_audit<std::string>(stdout, "string");
+    print_vec_audit<Order>(stdout, "Order");
+    print_vec_audit<FastOrder>(stdout, "FastOrder");
+
+    const int n = 1'000'000;
+    std::printf("\nOrder:     %6.1f ms\nFastOrder: %6.1f ms\n", fill_ms<Order>(n), fill_ms<FastOrder>(n));
+}
+
+/*
+The NOEXCEPT OPERATOR section shows that noexcept(...) is a compile time question, and Vec asks it in every place where elements change
+address: std::move_if_noexcept in the growth, is_nothrow_move_constructible before shifting in place, is_nothrow_copy_assignable before
+reusing the buffer. The answer is never printed anywhere. If somebody writes a move constructor by hand and forgets the noexcept (or adds
+a member whose move may throw), everything still compiles and works, Vec just starts to copy every element when it grows. Nobody notices
+until the profile.
+
+The audit makes the answer visible:
+    member_audit<T> collects the traits of the special members (nothrow or not, trivially copyable, trivially relocatable)
+    vec_paths<T> says which code of Vec<T> is used: memmove, move or copy growth, insert in place or into a new buffer, erase nothrow
+    or not, copy assignment in place, beside the old elements or copy-and-swap, strong or only basic guarantee. It is a friend of Vec
+    and reads the constants Vec uses itself (bitwise, shift_is_safe, reuse_is_safe...), so if Vec changes its rules, the audit changes
+    with it
+    vec_audit<T>() is the report: every slow path calls a [[deprecated]] function, so the compiler prints a warning with the reason and
+    the type ("In instantiation of ... [with T = Order]"). The calls depend on T, so they are only checked when vec_audit<T> is
+    instantiated, and the if constexpr branches that are not taken are never instantiated
+    vec_audit<T, audit_mode::enforce>() turns the same checks into static_asserts. It is meant for the hot path types, written next to
+    their declaration: if the type loses its nothrow move, the build fails. -DVEC_AUDIT_ENFORCE makes every audit strict
+It is all in templates and constexpr, so it can live in a header, and nothing of it is left in the program (print_vec_audit() only prints
+the same constants).
+
+The warnings of the report for Order (g++ 12):
+
+    warning: 'constexpr void vec_audit_note(grows_by_copy, const void*)' is deprecated: Vec<T> grows by copying the elements: the
+    move constructor of T is not noexcept [-Wdeprecated-declarations]
+    warning: 'constexpr void vec_audit_note(insert_reallocates, const void*)' is deprecated: Vec<T>::insert builds a new buffer even
+    when there is capacity: moving T may throw [-Wdeprecated-declarations]
+
+And with the enforce mode:
+
+    error: static assertion failed: hot path type: the move constructor of T must be noexcept (or T trivially relocatable)
+
+The output on my machine (g++ 12 -O2):
+
+    long          move: nothrow    copy: nothrow    trivially copyable: yes  relocatable: yes
+                  growth: memmove        insert: in place     erase: nothrow    assign: in place       guarantee: strong
+    unique_ptr    move: nothrow    copy: deleted    trivially copyable: no   relocatable: yes
+                  growth: memmove        insert: in place     erase: nothrow    assign: beside         guarantee: strong
+    string        move: nothrow    copy: may throw  trivially copyable: no   relocatable: no
+                  growth: move           insert: in place     erase: nothrow    assign: beside         guarantee: strong
+    Order         move: may throw  copy: may throw  trivially copyable: no   relocatable: no
+                  growth: copy           insert: new buffer   erase: nothrow    assign: copy-and-swap  guarantee: strong
+    FastOrder     move: nothrow    copy: may throw  trivially copyable: no   relocatable: no
+                  growth: move           insert: in place     erase: nothrow    assign: beside         guarantee: strong
+
+    Order:      230.9 ms
+    FastOrder:  138.9 ms
+
+The only difference between Order and FastOrder is one noexcept, and filling a million of them is 1.7 times slower: every growth copies
+the strings and the vectors of the fills (an allocation each) instead of stealing their pointers.
+*/
+
+
+
+// STRONG GUARANTEE EXAMPLE - 5 | BULK INSERT AND ASSIGN WITHOUT A SECOND BUFFER
+
+#include <stdexcept>
+#include <string>
+
+static long copies_until_failure = -1;  // the copy constructor of Item throws when it gets to 0, -1: never
+
+struct Item     // copying may throw, moving may not
+{
+    long key;
+    std::string name;   // short, in the small buffer of the string: the copies never allocate
+
+    Item(long k) : key(k), name("item") { }
+
+    Item(const Item& o) : key(o.key), name(o.name)
+    {
+        if (copies_until_failure >= 0 && copies_until_failure-- == 0)
+            throw std::runtime_error("copy of Item failed");
+    }
+
+    Item(Item&&) noexcept = default;
+    Item& operator=(const Item&) = default;
+    Item& operator=(Item&&) noexcept = default;
+};
+
+void f()
+{
+Vec<Item> v = load();
+v.reserve(2 * v.size());
+v.assign(other.begin(), other.end());           // no allocation while other.size() <= v.capacity() - v.size()
+v.append(more.begin(), more.end());             // into the spare capacity
+v.insert(v.begin() + 10, more.begin(), more.end()); // built at the end, rotated into place
+}                                               // if a copy throws: v is the same as before the call
+
+// Basic example of a benchmark: time, extra heap and extra RSS of assign / append / insert against copy-and-swap
+// (one child process per case, so the peak RSS of a case does not hide the others)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the heap is counted by the operator new of COUNTING THE HEAP
+
+const std::size_t n = 1'000'000;
+
+// a Vec of n Items whose capacity is cap; it was bigger before, so the pages of the spare capacity are already in memory
+Vec<Item> make_vec(std::size_t cap, long first)
+{
+    Vec<Item> v;
+    v.reserve(cap);
+    for (std::size_t i = 0; i < cap; ++i)
+        v.emplace_back(first + long(i));
+    while (v.size() > n)
+        v.pop_back();
+    return v;
+}
+
+Vec<Item> make_src(std::size_t m)
+{
+    Vec<Item> v;
+    v.reserve(m);
+    for (std::size_t i = 0; i < m; ++i)
+        v.emplace_back(-long(i));
+    return v;
+}
+
+long max_rss_kb()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+template <class Op>
+void run_case(const char* op_name, const char* method, std::size_t cap, std::size_t n_src, Op op)
+{
+    std::fflush(stdout);
+    if (pid_t pid = fork())
+    {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    double best_ms = 1e9;
+    long base_rss = 0;
+    std::size_t extra_heap = 0;
+    for (int rep = 0; rep < 3; ++rep)
+    {
+        Vec<Item> a = make_vec(cap, 0);
+        Vec<Item> src = make_src(n_src);
+        if (rep == 0)
+            base_rss = max_rss_kb();
+        std::size_t base_heap = cur_bytes;
+        peak_bytes = cur_bytes.load();
+        auto t0 = std::chrono::steady_clock::now();
+        op(a, src);
+        auto t1 = std::chrono::steady_clock::now();
+        best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(t1 - t0).count());
+        extra_heap = peak_bytes - base_heap;
+    }
+    std::printf("%-16s %6.2fn  %-14s %8.1f ms %8.1f MB %8.1f MB\n", op_name, double(cap) / n, method, best_ms,
+                extra_heap / 1e6, (max_rss_kb() - base_rss) / 1e3);
+    std::fflush(stdout);
+    _exit(0);
+}
+
+template <class Op>
+bool rolls_back(Op op, std::size_t n_src)   // op with a copy that fails half way: is the Vec the same as before?
+{
+    Vec<Item> a = make_vec(n + n / 2, 0), src = make_src(n_src);
+    const Item* data = a.data();
+    std::size_t cap = a.capacity();
+    copies_until_failure = n_src / 2;
+    try
+    {
+        op(a, src);
+    }
+    catch (const std::runtime_error&)
+    {
+        copies_until_failure = -1;
+        bool same = a.size() == n && a.capacity() == cap && a.data() == data;
+        for (std::size_t i = 0; same && i < n; ++i)
+            same = a[i].key == long(i) && a[i].name == "item";
+        return same;
+    }
+    copies_until_failure = -1;
+    return false;
+}
+
+int main()
+{
+    auto assign = [](Vec<Item>& a, const Vec<Item>& src) { a.assign(src.begin(), src.end()); };
+    auto assign_cas = [](Vec<Item>& a, const Vec<Item>& src) { Vec<Item> tmp(src); a.swap(tmp); };
+    auto append = [](Vec<Item>& a, const Vec<Item>& src) { a.append(src.begin(), src.end()); };
+    auto append_cas = [](Vec<Item>& a, const Vec<Item>& src) {
+        Vec<Item> tmp;
+        tmp.reserve(a.size() + src.size());
+        tmp.append(a.begin(), a.end());
+        tmp.append(src.begin(), src.end());
+        a.swap(tmp);
+    };
+    auto insert = [](Vec<Item>& a, const Vec<Item>& src) { a.insert(a.begin() + a.size() / 2, src.begin(), src.end()); };
+    auto insert_cas = [](Vec<Item>& a, const Vec<Item>& src) {
+        Vec<Item> tmp;
+        tmp.reserve(a.size() + src.size());
+        tmp.append(a.begin(), a.begin() + a.size() / 2);
+        tmp.append(src.begin(), src.end());
+        tmp.append(a.begin() + a.size() / 2, a.end());
+        a.swap(tmp);
+    };
+
+    std::printf("%-16s %7s  %-14s %11s %11s %11s\n", "", "cap", "", "time", "extra heap", "extra RSS");
+    for (std::size_t cap : { 2 * n, n + n / 2, n })
+    {
+        run_case("assign n", "assign()", cap, n, assign);
+        run_case("", "copy-and-swap", cap, n, assign_cas);
+    }
+    run_case("append n/4", "append()", n + n / 4, n / 4, append);
+    run_case("", "copy-and-swap", n + n / 4, n / 4, append_cas);
+    run_case("insert n/4", "insert()", n + n / 4, n / 4, insert);
+    run_case("", "copy-and-swap", n + n / 4, n / 4, insert_cas);
+    run_case("insert n/4", "insert()", n, n / 4, insert);
+    run_case("", "copy-and-swap", n, n / 4, insert_cas);
+
+    std::printf("a copy throws half way, the Vec is unchanged: assign %s, append %s, insert %s\n",
+                rolls_back(assign, n) ? "yes" : "NO", rolls_back(append, n / 4) ? "yes" : "NO",
+                rolls_back(insert, n / 4) ? "yes" : "NO");
+}
+
+/*
+The strong guarantee has a price in memory: the old contents have to stay alive until the last new element is built, because any of the
+copies may throw. Copy-and-swap pays it with a whole second buffer, so assigning a 40 MB Vec needs 80 MB for a moment, and appending
+a few elements to it copies all of it. But the old and the new elements only have to exist at the same time, they do not need two
+buffers. The spare capacity of the Vec is already there.
+
+    append(first, last) and insert(pos, first, last) build the new elements at the end, in the spare capacity. This is the only step
+    that may throw, and if it does, only the new elements are destroyed. Then insert() rotates them into their place. The rotation
+    moves the elements inside the buffer, so it needs a nothrow move (or a trivially relocatable T, then the bytes are rotated). An
+    append has nothing to rotate, so it stays in place whenever there is room, whatever T's move does. If there is no room, or an
+    insert in the middle would have to move a T whose move may throw, it builds a new buffer like emplace() does
+    assign(first, last) copies in place when copying T cannot throw (the old operator= rule). Otherwise it builds the new elements
+    beside the old ones: into the spare capacity, and only the part that does not fit goes into a scratch buffer of sz + n - cap
+    elements. When the last one is built, the old ones are destroyed and the new ones are moved down to the front. Nothing can throw
+    there, because moving T is nothrow. So the extra memory is the part of the new contents that does not fit next to the old ones, not
+    the whole contents. The copy assignment is assign() now, and the audit in STRONG GUARANTEE EXAMPLE - 4 shows this path as "beside"
+    the source may be a part of the same Vec (v.insert(v.begin(), v.begin(), v.end())), because nothing old is touched before the new
+    elements are complete
+
+Copy-and-swap is still the fallback in two cases. One is when the new contents are bigger than the capacity, because a bigger buffer has
+to be allocated anyway. The other is a T whose move may throw, because then the final step could fail half way.
+
+The benchmark runs every case in its own child process. ru_maxrss is the peak of the whole process, so in one process the first big case
+would hide all the others. The heap is counted with the operator new of COUNTING THE HEAP. Item is a long and a short
+std::string: its copy can throw, and its move cannot. The Vec has 1M Items (40 MB) and a capacity of cap. It was bigger before, so
+the pages of the spare capacity are already in memory. The output on my machine (g++ 12 -O2, best of 3):
+
+                         cap                        time  extra heap   extra RSS
+    assign n           2.00n  assign()           24.0 ms      0.0 MB      0.5 MB
+                       2.00n  copy-and-swap      39.8 ms     40.0 MB     39.5 MB
+    assign n           1.50n  assign()           24.0 ms     20.0 MB     20.0 MB
+                       1.50n  copy-and-swap      36.6 ms     40.0 MB     39.6 MB
+    assign n           1.00n  assign()           36.2 ms     40.0 MB     39.6 MB
+                       1.00n  copy-and-swap      35.7 ms     40.0 MB     39.6 MB
+    append n/4         1.25n  append()            1.9 ms      0.0 MB      0.5 MB
+                       1.25n  copy-and-swap      29.9 ms     50.0 MB     49.3 MB
+    insert n/4         1.25n  insert()            9.5 ms      0.0 MB      0.5 MB
+                       1.25n  copy-and-swap      30.9 ms     50.0 MB     49.3 MB
+    insert n/4         1.00n  insert()           29.7 ms     80.0 MB     49.3 MB
+                       1.00n  copy-and-swap      30.7 ms     50.0 MB     49.3 MB
+    a copy throws half way, the Vec is unchanged: assign yes, append yes, insert yes
+
+With a full spare capacity the assignment needs no extra memory and is faster: it never maps the 40 MB of a new buffer (the page faults
+are a big part of copy-and-swap, as in STATIC ASSERT ERROR HANDLING - 2). With half of it, the scratch buffer and the extra peak are half
+as big. Without spare capacity there is nothing to gain, so assign() takes the copy-and-swap path itself and the two rows are the same.
+Appending and inserting with enough capacity only copy the new quarter, instead of the whole Vec. The rotation in insert() moves the
+upper half of the elements, and that is the 9.5 ms. The last two rows are the growth case: insert() doubles the capacity like
+emplace_back(), so it takes 80 MB of heap, but only the pages that are written count in the RSS. The copy-and-swap in the benchmark
+allocates exactly the size it needs.
+
+The last line is the check of the rollback. The n/2-th copy throws, and the elements, the size, the capacity and even the buffer address
+are the same as before the call.
+*/
+
+
+
+// STRONG GUARANTEE EXAMPLE - 6 | SIMD COPY, FILL, COMPARE AND SEARCH FOR A VEC OF TRIVIAL TYPES
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <immintrin.h>
+#include <unistd.h>     // sysconf
+
+// the element types the kernels know; a Vec of anything else keeps the normal loops
+template <class T>
+constexpr bool simd_element = (std::is_integral_v<T> || std::is_floating_point_v<T>) && !std::is_same_v<T, bool>
+                              && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+// What differs between the instruction sets: the width of a register, the non-temporal store, and turning a compare mask into
+// bits (one per byte). Everything else is written once with GCC vector extensions in the kernels below, and the compiler picks
+// the instructions of the set the kernel is compiled for
+struct simd_sse
+{
+    static constexpr std::size_t width = 16;
+    static bool supported() noexcept { return __builtin_cpu_supports("sse4.2"); }
+
+    [[gnu::target("sse4.2")]] static std::uint64_t bits(const void* mask) noexcept
+    {
+        return unsigned(_mm_movemask_epi8(_mm_loadu_si128(static_cast<const __m128i*>(mask))));
+    }
+    [[gnu::target("sse4.2")]] static void stream(void* dest, const void* src) noexcept     // dest is aligned to width
+    {
+        _mm_stream_si128(static_cast<__m128i*>(dest), _mm_loadu_si128(static_cast<const __m128i*>(src)));
+    }
+};
+
+struct simd_avx2
+{
+    static constexpr std::size_t width = 32;
+    static bool supported() noexcept { return __builtin_cpu_supports("avx2"); }
+
+    [[gnu::target("avx2")]] static std::uint64_t bits(const void* mask) noexcept
+    {
+        return unsigned(_mm256_movemask_epi8(_mm256_loadu_si256(static_cast<const __m256i*>(mask))));
+    }
+    [[gnu::target("avx2")]] static void stream(void* dest, const void* src) noexcept
+    {
+        _mm256_stream_si256(static_cast<__m256i*>(dest), _mm256_loadu_si256(static_cast<const __m256i*>(src)));
+    }
+};
+
+struct simd_avx512
+{
+    static constexpr std::size_t width = 64;
+    static bool supported() noexcept { return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"); }
+
+    [[gnu::target("avx512f,avx512bw")]] static std::uint64_t bits(const void* mask) noexcept
+    {
+        return _mm512_movepi8_mask(_mm512_loadu_si512(mask));
+    }
+    [[gnu::target("avx512f,avx512bw")]] static void stream(void* dest, const void* src) noexcept
+    {
+        _mm512_stream_si512(static_cast<__m512i*>(dest), _mm512_loadu_si512(src));
+    }
+};
+
+// above this many bytes copy() and fill() write around the cache: the data would not fit anyway, and it would push out
+// everything else (half of the L3, like glibc's memcpy does)
+inline std::size_t simd_stream_threshold() noexcept
+{
+    static const std::size_t bytes = [] {
+        long l3 = ::sysconf(_SC_LEVEL3_CACHE_SIZE);
+        return l3 > 0 ? std::size_t(l3) / 2 : std::size_t(4) << 20;
+    }();
+    return bytes;
+}
+
+// The kernels. They are only called from the functions of simd_kernels_for below, which are compiled for one instruction set
+// and flattened: the kernel, its lambdas and Isa::bits all end up inside that one function, and the vector code is generated
+// for that set. (always_inline on Isa::bits does not work: the kernel itself has no target, so GCC refuses the inlining)
+template <class Isa, class T>
+[[gnu::always_inline]] inline void copy_kernel(T* dest, const T* src, std::size_t n) noexcept
+{
+    constexpr std::size_t W = Isa::width;
+    typedef char V __attribute__((vector_size(W)));
+    char* d = reinterpret_cast<char*>(dest);
+    const char* s = reinterpret_cast<const char*>(src);
+    std::size_t bytes = n * sizeof(T);
+    if (bytes < W)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            dest[i] = src[i];
+        return;
+    }
+    auto move = [&](std::size_t i) {
+        V v;
+        std::memcpy(&v, s + i, W);
+        std::memcpy(d + i, &v, W);
+    };
+    std::size_t i = 0;
+    if (bytes >= simd_stream_threshold())
+    {
+        move(0);                                                    // up to the first aligned address of dest
+        for (i = W - reinterpret_cast<std::uintptr_t>(d) % W; i + W <= bytes; i += W)
+            Isa::stream(d + i, s + i);
+        _mm_sfence();                                               // the streamed stores are visible before we return
+    }
+    else
+    {
+        for (; i + 4 * W <= bytes; i += 4 * W)
+        {
+            move(i);
+            move(i + W);
+            move(i + 2 * W);
+            move(i + 3 * W);
+        }
+        for (; i + W <= bytes; i += W)
+            move(i);
+    }
+    if (i < bytes)
+        move(bytes - W);                                            // the last register overlaps the one before it
+}
+
+template <class Isa, class T>
+[[gnu::always_inline]] inline void fill_kernel(T* dest, std::size_t n, T x) noexcept
+{
+    constexpr std::size_t W = Isa::width, L = W / sizeof(T);
+    typedef T V __attribute__((vector_size(W)));
+    if (n < L)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            dest[i] = x;
+        return;
+    }
+    V v = V{} + x;
+    auto put = [&](std::size_t i) { std::memcpy(dest + i, &v, W); };
+    std::size_t i = 0;
+    if (n * sizeof(T) >= simd_stream_threshold())
+    {
+        put(0);
+        for (i = (W - reinterpret_cast<std::uintptr_t>(dest) % W) / sizeof(T); i + L <= n; i += L)
+            Isa::stream(dest + i, &v);
+        _mm_sfence();
+    }
+    else
+    {
+        for (; i + 4 * L <= n; i += 4 * L)
+        {
+            put(i);
+            put(i + L);
+            put(i + 2 * L);
+            put(i + 3 * L);
+        }
+        for (; i + L <= n; i += L)
+            put(i);
+    }
+    if (i < n)
+        put(n - L);
+}
+
+template <class Isa, class T>
+[[gnu::always_inline]] inline bool equal_kernel(const T* a, const T* b, std::size_t n) noexcept
+{
+    constexpr std::size_t W = Isa::width, L = W / sizeof(T);
+    typedef T U __attribute__((vector_size(W), aligned(alignof(T)), may_alias));     // an unaligned load, like __m128i_u
+    std::size_t i = 0;
+    for (; i + 4 * L <= n; i += 4 * L)
+    {
+        auto x = reinterpret_cast<const U*>(a + i), y = reinterpret_cast<const U*>(b + i);
+        // != of floats is true for a NaN, like !(x == y) in std::equal. The masks are turned into bits before they are
+        // combined: an | of two masks is split into single elements for AVX-512 (the kernel is parsed without a target)
+        auto m0 = x[0] != y[0], m1 = x[1] != y[1], m2 = x[2] != y[2], m3 = x[3] != y[3];
+        if (Isa::bits(&m0) | Isa::bits(&m1) | Isa::bits(&m2) | Isa::bits(&m3))
+            return false;
+    }
+    for (; i + L <= n; i += L)
+    {
+        auto m = *reinterpret_cast<const U*>(a + i) != *reinterpret_cast<const U*>(b + i);
+        if (Isa::bits(&m))
+            return false;
+    }
+    for (; i < n; ++i)
+        if (!(a[i] == b[i]))
+            return false;
+    return true;
+}
+
+template <class Isa, class T>
+[[gnu::always_inline]] inline const T* find_kernel(const T* p, std::size_t n, T x) noexcept
+{
+    constexpr std::size_t W = Isa::width, L = W / sizeof(T);
+    typedef T U __attribute__((vector_size(W), aligned(alignof(T)), may_alias));
+    typedef T V __attribute__((vector_size(W)));
+    V vx = V{} + x;
+    std::size_t i = 0;
+    for (; i + 4 * L <= n; i += 4 * L)
+    {
+        auto v = reinterpret_cast<const U*>(p + i);
+        auto m0 = v[0] == vx, m1 = v[1] == vx, m2 = v[2] == vx, m3 = v[3] == vx;
+        std::uint64_t b0 = Isa::bits(&m0), b1 = Isa::bits(&m1), b2 = Isa::bits(&m2), b3 = Isa::bits(&m3);
+        if (b0 | b1 | b2 | b3)
+        {
+            for (std::uint64_t b : { b0, b1, b2, b3 })
+            {
+                if (b)
+                    return p + i + __builtin_ctzll(b) / sizeof(T);
+                i += L;
+            }
+        }
+    }
+    for (; i + L <= n; i += L)
+    {
+        auto m = *reinterpret_cast<const U*>(p + i) == vx;
+        if (std::uint64_t b = Isa::bits(&m))
+            return p + i + __builtin_ctzll(b) / sizeof(T);
+    }
+    for (; i < n; ++i)
+        if (p[i] == x)
+            return p + i;
+    return p + n;
+}
+
+// min and max of the lanes of two registers of W bytes: the two halves are compared until one lane is left (a shuffle of all the
+// lanes would need AVX-512 VBMI for bytes)
+template <class T, std::size_t W>
+[[gnu::always_inline]] inline void fold_min_max(const void* lo_v, const void* hi_v, T& lo, T& hi) noexcept
+{
+    if constexpr (W == sizeof(T))
+    {
+        std::memcpy(&lo, lo_v, sizeof(T));
+        std::memcpy(&hi, hi_v, sizeof(T));
+    }
+    else
+    {
+        typedef T H __attribute__((vector_size(W / 2)));
+        H l0, l1, h0, h1;
+        std::memcpy(&l0, lo_v, W / 2);
+        std::memcpy(&l1, static_cast<const char*>(lo_v) + W / 2, W / 2);
+        std::memcpy(&h0, hi_v, W / 2);
+        std::memcpy(&h1, static_cast<const char*>(hi_v) + W / 2, W / 2);
+        l0 = l1 < l0 ? l1 : l0;
+        h0 = h1 > h0 ? h1 : h0;
+        fold_min_max<T, W / 2>(&l0, &h0, lo, hi);
+    }
+}
+
+template <class Isa, class T>
+[[gnu::always_inline]] inline std::pair<T, T> min_max_kernel(const T* p, std::size_t n) noexcept    // n > 0
+{
+    constexpr std::size_t W = Isa::width, L = W / sizeof(T);
+    typedef T V __attribute__((vector_size(W)));
+    V lo0 = V{} + p[0], hi0 = lo0, lo1 = lo0, hi1 = lo0;    // two pairs of accumulators: two loads per cycle
+    std::size_t i = 0;
+    for (; i + 2 * L <= n; i += 2 * L)
+    {
+        V a, b;
+        std::memcpy(&a, p + i, W);
+        std::memcpy(&b, p + i + L, W);
+        lo0 = a < lo0 ? a : lo0;
+        hi0 = a > hi0 ? a : hi0;
+        lo1 = b < lo1 ? b : lo1;
+        hi1 = b > hi1 ? b : hi1;
+    }
+    lo0 = lo1 < lo0 ? lo1 : lo0;
+    hi0 = hi1 > hi0 ? hi1 : hi0;
+    if (i + L <= n)
+    {
+        V a;
+        std::memcpy(&a, p + i, W);
+        lo0 = a < lo0 ? a : lo0;
+        hi0 = a > hi0 ? a : hi0;
+        i += L;
+    }
+    T lo, hi;
+    fold_min_max<T, W>(&lo0, &hi0, lo, hi);
+    for (; i < n; ++i)
+    {
+        lo = p[i] < lo ? p[i] : lo;
+        hi = p[i] > hi ? p[i] : hi;
+    }
+    return { lo, hi };
+}
+
+// the generic loops: for a CPU without SSE 4.2, and the reference in the benchmark
+template <class T>
+struct simd_kernels_generic
+{
+    static void copy(T* dest, const T* src, std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            dest[i] = src[i];
+    }
+    static void fill(T* dest, std::size_t n, T x) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            dest[i] = x;
+    }
+    static bool equal(const T* a, const T* b, std::size_t n) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            if (!(a[i] == b[i]))
+                return false;
+        return true;
+    }
+    static const T* find(const T* p, std::size_t n, T x) noexcept
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            if (p[i] == x)
+                return p + i;
+        return p + n;
+    }
+    static std::pair<T, T> min_max(const T* p, std::size_t n) noexcept
+    {
+        T lo = p[0], hi = p[0];
+        for (std::size_t i = 1; i < n; ++i)
+        {
+            lo = p[i] < lo ? p[i] : lo;
+            hi = p[i] > hi ? p[i] : hi;
+        }
+        return { lo, hi };
+    }
+};
+
+// the kernels compiled for one instruction set each
+template <class Isa, class T>
+struct simd_kernels_for;
+
+template <class T>
+struct simd_kernels_for<simd_sse, T>
+{
+    [[gnu::target("sse4.2"), gnu::flatten]] static void copy(T* d, const T* s, std::size_t n) noexcept { copy_kernel<simd_sse>(d, s, n); }
+    [[gnu::target("sse4.2"), gnu::flatten]] static void fill(T* d, std::size_t n, T x) noexcept { fill_kernel<simd_sse>(d, n, x); }
+    [[gnu::target("sse4.2"), gnu::flatten]] static bool equal(const T* a, const T* b, std::size_t n) noexcept
+    {
+        return equal_kernel<simd_sse>(a, b, n);
+    }
+    [[gnu::target("sse4.2"), gnu::flatten]] static const T* find(const T* p, std::size_t n, T x) noexcept
+    {
+        return find_kernel<simd_sse>(p, n, x);
+    }
+    [[gnu::target("sse4.2"), gnu::flatten]] static std::pair<T, T> min_max(const T* p, std::size_t n) noexcept
+    {
+        return min_max_kernel<simd_sse>(p, n);
+    }
+};
+
+template <class T>
+struct simd_kernels_for<simd_avx2, T>
+{
+    [[gnu::target("avx2"), gnu::flatten]] static void copy(T* d, const T* s, std::size_t n) noexcept { copy_kernel<simd_avx2>(d, s, n); }
+    [[gnu::target("avx2"), gnu::flatten]] static void fill(T* d, std::size_t n, T x) noexcept { fill_kernel<simd_avx2>(d, n, x); }
+    [[gnu::target("avx2"), gnu::flatten]] static bool equal(const T* a, const T* b, std::size_t n) noexcept
+    {
+        return equal_kernel<simd_avx2>(a, b, n);
+    }
+    [[gnu::target("avx2"), gnu::flatten]] static const T* find(const T* p, std::size_t n, T x) noexcept
+    {
+        return find_kernel<simd_avx2>(p, n, x);
+    }
+    [[gnu::target("avx2"), gnu::flatten]] static std::pair<T, T> min_max(const T* p, std::size_t n) noexcept
+    {
+        return min_max_kernel<simd_avx2>(p, n);
+    }
+};
+
+template <class T>
+struct simd_kernels_for<simd_avx512, T>
+{
+    [[gnu::target("avx512f,avx512bw"), gnu::flatten]] static void copy(T* d, const T* s, std::size_t n) noexcept { copy_kernel<simd_avx512>(d, s, n); }
+    [[gnu::target("avx512f,avx512bw"), gnu::flatten]] static void fill(T* d, std::size_t n, T x) noexcept { fill_kernel<simd_avx512>(d, n, x); }
+    [[gnu::target("avx512f,avx512bw"), gnu::flatten]] static bool equal(const T* a, const T* b, std::size_t n) noexcept
+    {
+        return equal_kernel<simd_avx512>(a, b, n);
+    }
+    [[gnu::target("avx512f,avx512bw"), gnu::flatten]] static const T* find(const T* p, std::size_t n, T x) noexcept
+    {
+        return find_kernel<simd_avx512>(p, n, x);
+    }
+    [[gnu::target("avx512f,avx512bw"), gnu::flatten]] static std::pair<T, T> min_max(const T* p, std::size_t n) noexcept
+    {
+        return min_max_kernel<simd_avx512>(p, n);
+    }
+};
+
+// The table of the running CPU: it is filled once, on the first call, then every call is one indirect jump
+template <class T>
+struct simd_kernels
+{
+    void (*copy)(T*, const T*, std::size_t) noexcept;
+    void (*fill)(T*, std::size_t, T) noexcept;
+    bool (*equal)(const T*, const T*, std::size_t) noexcept;
+    const T* (*find)(const T*, std::size_t, T) noexcept;
+    std::pair<T, T> (*min_max)(const T*, std::size_t) noexcept;
+    const char* isa;
+
+    template <class K>
+    static constexpr simd_kernels of(const char* isa) noexcept { return { K::copy, K::fill, K::equal, K::find, K::min_max, isa }; }
+
+    static const simd_kernels& best() noexcept
+    {
+        static const simd_kernels k = simd_avx512::supported() ? of<simd_kernels_for<simd_avx512, T>>("AVX-512")
+                                    : simd_avx2::supported()   ? of<simd_kernels_for<simd_avx2, T>>("AVX2")
+                                    : simd_sse::supported()    ? of<simd_kernels_for<simd_sse, T>>("SSE4.2")
+                                                               : of<simd_kernels_generic<T>>("generic");
+        return k;
+    }
+};
+
+// The operations on a Vec (STRONG GUARANTEE EXAMPLE - 2). None of them can throw: the elements are trivial, nothing is allocated
+
+template <class T, class A>
+bool operator==(const Vec<T, A>& a, const Vec<T, A>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    if constexpr (simd_element<T>)
+        return simd_kernels<T>::best().equal(a.data(), b.data(), a.size());
+    else
+        return std::equal(a.begin(), a.end(), b.begin());
+}
+
+template <class T, class A>
+void fill(Vec<T, A>& v, const T& x)    // every element becomes x
+{
+    if constexpr (simd_element<T>)
+        simd_kernels<T>::best().fill(v.data(), v.size(), x);
+    else
+        std::fill(v.begin(), v.end(), x);
+}
+
+template <class T, class A>
+typename Vec<T, A>::const_iterator find(const Vec<T, A>& v, const T& x)
+{
+    if constexpr (simd_element<T>)
+        return simd_kernels<T>::best().find(v.data(), v.size(), x);
+    else
+        return std::find(v.begin(), v.end(), x);
+}
+
+template <class T, class A>
+std::pair<T, T> min_max(const Vec<T, A>& v)   // v must not be empty; a NaN is only taken if it is the first element
+{
+    if constexpr (simd_element<T>)
+        return simd_kernels<T>::best().min_max(v.data(), v.size());
+    else
+    {
+        auto [lo, hi] = std::minmax_element(v.begin(), v.end());
+        return { *lo, *hi };
+    }
+}
+
+void f()
+{
+Vec<float> a = samples(), b = a;
+bool same = a == b;                             // AVX-512, AVX2 or SSE 4.2: looked up once, on the first call
+auto zero = find(a, 0.0f);
+auto [lo, hi] = min_max(a);
+fill(b, 1.0f);
+b = a;                                          // the copy of the Vec itself is std::copy, a memmove (see below)
+Vec<std::string> s = names(), t = s;
+bool same_names = s == t;                       // not a simd_element: std::equal
+}
+
+// Basic example of a benchmark: GB/s of copy, fill, equal, find and min_max over an int buffer of 64 B to 1 GB, for every table
+// and for the C library / <algorithm> functions. GB/s counts the bytes of one buffer (copy reads one and writes one, equal reads
+// two). Best of 5; the small sizes are repeated to at least 64 MB per run
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+const std::size_t max_bytes = std::size_t(1) << 30;
+const std::size_t sizes[] = { 64, 512, 4 << 10, 32 << 10, 256 << 10, 2 << 20, 16 << 20, 128 << 20, max_bytes };
+
+struct std_kernels     // what the Vec would use without the kernels
+{
+    static void copy(int* d, const int* s, std::size_t n) noexcept { std::memcpy(d, s, n * sizeof(int)); }
+    static void fill(int* d, std::size_t n, int x) noexcept { std::fill(d, d + n, x); }
+    static bool equal(const int* a, const int* b, std::size_t n) noexcept { return std::memcmp(a, b, n * sizeof(int)) == 0; }
+    static const int* find(const int* p, std::size_t n, int x) noexcept { return std::find(p, p + n, x); }
+    static std::pair<int, int> min_max(const int* p, std::size_t n) noexcept
+    {
+        auto [lo, hi] = std::minmax_element(p, p + n);
+        return { *lo, *hi };
+    }
+};
+
+volatile long sink;
+
+template <class Op>
+double gb_per_s(std::size_t bytes, Op op)    // bytes: the size of one buffer
+{
+    std::size_t reps = std::max<std::size_t>(1, (std::size_t(64) << 20) / bytes);
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        for (std::size_t r = 0; r < reps; ++r)
+            op();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+    return double(bytes) * double(reps) / best / 1e9;
+}
+
+int main()
+{
+    int* a = static_cast<int*>(std::aligned_alloc(64, max_bytes));
+    int* b = static_cast<int*>(std::aligned_alloc(64, max_bytes));
+    for (std::size_t i = 0; i < max_bytes / sizeof(int); ++i)
+        a[i] = b[i] = int(i % 1000);     // -1 is not there: find() and equal() read everything
+
+    struct
+    {
+        simd_kernels<int> k;
+        bool supported;
+    } tables[] = { { simd_kernels<int>::of<simd_kernels_generic<int>>("generic"), true },
+                   { simd_kernels<int>::of<simd_kernels_for<simd_sse, int>>("SSE4.2"), simd_sse::supported() },
+                   { simd_kernels<int>::of<simd_kernels_for<simd_avx2, int>>("AVX2"), simd_avx2::supported() },
+                   { simd_kernels<int>::of<simd_kernels_for<simd_avx512, int>>("AVX-512"), simd_avx512::supported() },
+                   { simd_kernels<int>::of<std_kernels>("libc/std"), true } };
+    std::printf("best(): %s, streaming stores from %zu MB\n", simd_kernels<int>::best().isa, simd_stream_threshold() >> 20);
+
+    const char* ops[] = { "copy", "fill", "equal", "find", "min_max" };
+    for (int op = 0; op < 5; ++op)
+    {
+        std::printf("\n%-9s", ops[op]);
+        for (std::size_t bytes : sizes)
+            bytes < 1024 ? std::printf("%7zu B", bytes) : bytes < (1 << 20) ? std::printf("%6zu KB", bytes >> 10)
+                                                 : std::printf("%6zu MB", bytes >> 20);
+        std::printf("\n");
+        if (op == 2)
+            std::memcpy(b, a, max_bytes);   // equal() compares a with a copy of it
+        for (auto& [k, supported] : tables)
+        {
+            if (!supported)
+                continue;
+            std::printf("%-9s", k.isa);
+            for (std::size_t bytes : sizes)
+            {
+                std::size_t n = bytes / sizeof(int);
+                double r = 0;
+                switch (op)
+                {
+                case 0: r = gb_per_s(bytes, [&] { k.copy(b, a, n); sink = b[n - 1]; }); break;
+                case 1: r = gb_per_s(bytes, [&] { k.fill(b, n, 7); sink = b[n - 1]; }); break;
+                case 2: r = gb_per_s(bytes, [&] { sink = k.equal(a, b, n); }); break;
+                case 3: r = gb_per_s(bytes, [&] { sink = k.find(a, n, -1) - a; }); break;
+                case 4: r = gb_per_s(bytes, [&] { sink = k.min_max(a, n).second; }); break;
+                }
+                std::printf("%9.1f", r);
+            }
+            std::printf("\n");
+        }
+    }
+}
+
+/*
+The Vec of STRONG GUARANTEE EXAMPLE has the copy loop "for (i < cap) v[i] = rhs.v[i]", but that one is the pseudo-code of the first
+example. The real Vec (STRONG GUARANTEE EXAMPLE - 2) copies with std::copy and std::uninitialized_copy, and for a trivially copyable T
+libstdc++ turns both into one memmove. The memmove of glibc is already chosen for the CPU when the program is loaded (an ifunc, with
+SSE2, AVX2, AVX-512 and "rep movsb" versions). So the copy was vectorized before, and what the Vec really missed were the other four
+operations: ==, fill(), find() and min_max() did not exist, and the std algorithms someone would use instead are slow for them.
+
+The kernels are written once, with the vector extensions of GCC: a "typedef T V __attribute__((vector_size(32)))" is a register of
+32 bytes, and a + b, a < b or a < b ? a : b work on all its lanes. The only things that need an intrinsic are in the Isa structs: turning
+a compare into a mask of bits (movemask, or movepi8_mask for AVX-512) and the non-temporal store. Every kernel is compiled three times,
+in functions with [[gnu::target("sse4.2")]], ("avx2") and ("avx512f,avx512bw"), and simd_kernels<T>::best() asks the CPU once with
+__builtin_cpu_supports which table it takes. A CPU with none of them gets the plain loops. A Vec of anything else (std::string,
+a struct) is not a simd_element and uses the std algorithms as before.
+
+It took a few tries to make GCC generate the code I wanted:
+
+    the functions of a table are [[gnu::flatten]], and the kernels [[gnu::always_inline]]. A kernel has no target itself, so a call
+    from it to Isa::bits can not be always_inline ("target specific option mismatch"). flatten inlines it anyway, once the kernel is
+    inside the function with the target
+    the masks of two compares must not be combined with | inside the kernel. For AVX-512 the | is done lane by lane with scalar code,
+    64 sete for a register of bytes. Each mask is turned into bits first, and the bits are combined
+    the min and max of the lanes at the end are folded half by half (64 -> 32 -> 16 ... bytes). A shuffle of the whole register is
+    scalar code for bytes, because vpermb needs AVX-512 VBMI
+    the arrays of registers (V x[4]) were copied to the stack. The loads use an unaligned type with may_alias instead, like the __m128i_u
+    of the intrinsic headers
+
+copy() and fill() write with non-temporal stores above half of the L3 (52 MB here, like glibc does). The data would not fit in the cache
+anyway, and a normal store first reads the line it writes. equal() is false for a NaN like std::equal, not like memcmp, which compares
+bytes: for memcmp NaN == NaN and 0.0 != -0.0.
+
+The benchmark runs every table on an int buffer of 64 B to 1 GB. GB/s is the size of one buffer per second. The output on my machine
+(g++ 12 -O2, one core of a VM with AVX-512, 2 MB of L2 and 105 MB of L3; the small sizes changed by up to a third between two runs):
+
+    best(): AVX-512, streaming stores from 52 MB
+
+    copy          64 B    512 B     4 KB    32 KB   256 KB     2 MB    16 MB   128 MB  1024 MB
+    generic        5.7      9.7      6.3      6.5     10.6      7.1      4.7      4.8      5.6
+    SSE4.2         8.9     29.9     41.9     31.3     32.1     12.6      6.1      7.3      7.9
+    AVX2           6.3     41.6     73.8     33.8     34.3     11.8      7.2      8.8      8.7
+    AVX-512        7.8     45.9    128.8     36.0     35.7     12.6      7.2      9.7      9.0
+    libc/std       7.9     55.2    118.5     36.5     37.3     12.5     10.3     10.2     10.2
+
+    fill          64 B    512 B     4 KB    32 KB   256 KB     2 MB    16 MB   128 MB  1024 MB
+    generic        5.8     10.2     10.8     11.5     11.5     11.4      8.3      7.1      7.9
+    SSE4.2        17.3     50.2     79.3     80.5     38.2     28.1     19.5     18.5     18.3
+    AVX2          14.4     92.0    162.0    165.5     42.5     29.4     17.7     17.3     18.3
+    AVX-512        5.8     42.3    129.5    175.5     45.3     32.0     20.8     18.3     18.3
+    libc/std       5.9      9.9      7.6      6.7      7.4      7.3      6.9      7.1      7.9
+
+    equal         64 B    512 B     4 KB    32 KB   256 KB     2 MB    16 MB   128 MB  1024 MB
+    generic        7.3     10.4     10.3     10.6     10.3     10.1      6.8      6.1      5.5
+    SSE4.2        15.5     18.3     19.7     25.5     22.7     11.3      6.3      6.1      7.1
+    AVX2          12.2     50.0     54.4     43.5     42.2     12.8      9.3      7.6      6.5
+    AVX-512       13.7     55.9     70.7     55.4     54.4     12.5      9.6      6.6      7.6
+    libc/std      12.7     63.9     74.8     51.7     51.9     13.1     11.8      8.3      8.0
+
+    find          64 B    512 B     4 KB    32 KB   256 KB     2 MB    16 MB   128 MB  1024 MB
+    generic        3.7      4.6      4.2      3.8      3.8      4.4      3.2      3.4      3.6
+    SSE4.2        11.1     24.1     27.9     29.6     29.2     22.7     17.3      8.8     10.2
+    AVX2          10.4     36.3     51.5     81.5     74.3     47.4     26.2     12.4     11.8
+    AVX-512       20.1     68.2     75.9     75.8     76.7     50.3     25.8     11.9     12.0
+    libc/std       7.9     13.0     15.0     16.6     17.1     17.4     13.3      8.9      7.3
+
+    min_max       64 B    512 B     4 KB    32 KB   256 KB     2 MB    16 MB   128 MB  1024 MB
+    generic        2.8      3.1      3.9      4.4      5.5      3.4      3.1      4.2      4.8
+    SSE4.2        13.9     32.6     40.6     40.5     41.2     31.7     23.1     10.1      9.7
+    AVX2          14.3     53.2     65.6     69.4     50.1     36.1     24.7     11.2     10.5
+    AVX-512       12.1     42.0     66.9     72.6     73.1     44.5     24.1     12.1     12.8
+    libc/std       8.4      9.1      8.4      8.0      7.9      7.8      8.5      6.8      6.7
+
+The copy kernels are as fast as memcpy while the data is in the L1 and L2, and a bit slower above that. So the Vec keeps its std::copy,
+and the copy of the table is only there for the comparison. memcmp is as fast as the equal() kernels too, but it is wrong for floats,
+so == takes the kernel. The other three are the gain. std::fill of an int is a scalar loop at -O2 (the vectorizer of -O2 only takes the
+"very cheap" loops in g++ 12), 7 GB/s against 80-175 GB/s in the L1. std::find is unrolled but still one element at a time, 15-17 GB/s
+against 75, and std::minmax_element with its branches gets 8 against 70. The generic rows are the plain loops that a CPU without SSE 4.2
+would run.
+
+From the L3 on, the memory sets the speed, and every kernel gets 10-12 GB/s of reads. fill() is the exception: with the non-temporal
+stores it writes 18 GB/s, because it does not read the lines first. AVX-512 is ahead of AVX2 only in the L1 and the L2, and not always.
+At 64 B it is often the slowest, because one call does one register and the rest is the call and the loop setup. best() still takes
+AVX-512 for every size, since the difference is a few nanoseconds per call.
+*/
+
+
+
+// EXCEPTION PTR
+
+#include <iostream>
+#include <string>
+#include <exception>
+#include <stdexcept>
+
+void handle_eptr(std::exception_ptr eptr) // passing by value is ok
+{
+    try
+    {
+        if (eptr != std::exception_ptr())
+        {
+            std::rethrow_exception(eptr);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "Caught exception \"" << e.what() << "\"\n";
+    }
+}
+
+int main()
+{
+    std::exception_ptr eptr;
+    try
+    {
+        std::string().at(1); // this generates an std::out_of_range
+    }
+    catch (...)
+    {
+        eptr = std::current_exception(); // capture
+    }
+
+    handle_eptr(eptr);
+} // destructor for std::out_of_range called here, when the eptr is destructed
+  // output: Caught exception "basic_string::at"
+
+
+
+// EXCEPTION PTR - 2 | A LOCK-FREE QUEUE OF VALUES OR EXCEPTIONS BETWEEN PIPELINE STAGES
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// a T, or the exception that was thrown instead of it
+template <class T>
+class Result
+{
+public:
+    Result(T v) noexcept(std::is_nothrow_move_constructible_v<T>) : r(std::in_place_index<0>, std::move(v)) { }
+    Result(std::exception_ptr e) noexcept : r(std::in_place_index<1>, std::move(e)) { }
+
+    bool failed() const noexcept { return r.index() == 1; }
+    std::exception_ptr error() const noexcept { return failed() ? std::get<1>(r) : nullptr; }
+
+    T& get()    // the value, or handle_eptr's rethrow_exception
+    {
+        if (failed())
+            std::rethrow_exception(std::get<1>(r));
+        return std::get<0>(r);
+    }
+
+private:
+    std::variant<T, std::exception_ptr> r;
+};
+
+// Bounded queue for many producers and one consumer, with the sequence numbers of TaskQueue (NESTED EXCEPTIONS - 2). Every slot
+// is on its own cache line, so two producers filling neighbouring slots do not invalidate each other's line. The consumer is alone,
+// its position is not even atomic. A full queue makes the producers wait, an empty one the consumer: they spin a little, then sleep
+// with atomic wait, and the other side only pays a notify when somebody sleeps
+template <class T>
+class ResultQueue
+{
+    static_assert(std::is_nothrow_move_constructible_v<T>, "a slot is claimed before the move, the move may not fail");
+
+public:
+    explicit ResultQueue(std::size_t capacity)    // a power of two from 2 on, std::invalid_argument otherwise
+        : slots(new Slot[power_of_two(capacity)]), mask(capacity - 1)
+    {
+        for (std::size_t i = 0; i < capacity; ++i)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ResultQueue(const ResultQueue&) = delete;
+    ResultQueue& operator=(const ResultQueue&) = delete;
+
+    ~ResultQueue()
+    {
+        for (std::size_t pos = head; slots[pos & mask].seq.load(std::memory_order_acquire) == pos + 1; ++pos)
+            slots[pos & mask].result()->~Result<T>();
+    }
+
+    // producers
+
+    void push(T v) { push(Result<T>(std::move(v))); }
+    void push_error(std::exception_ptr e) { push(Result<T>(std::move(e))); }
+
+    // a pipeline stage: pushes what f() returns, or what it throws
+    template <class F>
+    void push_from(F&& f)
+    {
+        std::exception_ptr e;
+        try
+        {
+            push(Result<T>(f()));
+            return;
+        }
+        catch (...)
+        {
+            e = std::current_exception();
+        }
+        push_error(std::move(e));
+    }
+
+    void push(Result<T> r)
+    {
+        for (int spin = 0; !try_push(r); ++spin)
+        {
+            if (spin < 64)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            // sleep until the consumer frees a slot. waiters is raised before the slot is checked again, and the consumer
+            // frees the slot before it reads waiters (with a fence), so either we see the slot or it sees us
+            waiters.fetch_add(1);
+            unsigned e = space.load();
+            if (!has_space())
+                space.wait(e);
+            waiters.fetch_sub(1);
+        }
+    }
+
+    bool try_push(Result<T>& r) noexcept
+    {
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Slot& s = slots[pos & mask];
+            std::intptr_t diff = std::intptr_t(s.seq.load(std::memory_order_acquire)) - std::intptr_t(pos);
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    ::new (s.data) Result<T>(std::move(r));
+                    s.seq.store(pos + 1);   // seq_cst: ordered before the load of sleeping
+                    if (sleeping.load() && sleeping.exchange(false))
+                        sleeping.notify_one();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;   // full
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // after the last push of every producer; the consumer gets the rest, then pop() / pop_batch() say it is over
+    void close()
+    {
+        closed.store(true);
+        sleeping.store(false);
+        sleeping.notify_one();
+    }
+
+    // the consumer
+
+    // Waits for at least one result, then moves up to max of them to the end of out, in the order of the pushes.
+    // The errors are there as they were pushed, to inspect. Returns 0 when the queue is closed and empty, so max must not be 0
+    std::size_t pop_batch(std::vector<Result<T>>& out, std::size_t max)
+    {
+        if (max == 0)
+            throw std::invalid_argument("ResultQueue::pop_batch: max is 0, the result would mean closed");
+        out.reserve(out.size() + max);  // the only step that may throw, before anything is taken
+        if (!wait_ready())
+            return 0;
+        std::size_t n = 0;
+        for (; n < max && ready(head); ++n, ++head)
+        {
+            Slot& s = slots[head & mask];
+            Result<T>* r = s.result();
+            out.push_back(std::move(*r));
+            r->~Result<T>();
+            s.seq.store(head + mask + 1, std::memory_order_release);
+        }
+        wake_producers();   // once per batch
+        return n;
+    }
+
+    // The next value, or the exception that was pushed in its place is rethrown here, in its turn. Returns false when the
+    // queue is closed and empty
+    bool pop(T& v)
+    {
+        if (!wait_ready())
+            return false;
+        Slot& s = slots[head & mask];
+        Result<T>* r = s.result();
+        std::exception_ptr e = r->error();
+        if (!e)
+            v = std::move(r->get());
+        r->~Result<T>();
+        s.seq.store(head + mask + 1, std::memory_order_release);
+        ++head;
+        wake_producers();
+        if (e)
+            std::rethrow_exception(std::move(e));
+        return true;
+    }
+
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<std::size_t> seq;
+        alignas(Result<T>) unsigned char data[sizeof(Result<T>)];
+
+        Result<T>* result() noexcept { return std::launder(reinterpret_cast<Result<T>*>(data)); }
+    };
+
+    // with one slot, the sequence number of a full slot (pos + 1) would also mean "free" for the next position
+    static std::size_t power_of_two(std::size_t n)
+    {
+        if (n < 2 || (n & (n - 1)) != 0)
+            throw std::invalid_argument("ResultQueue: the capacity must be a power of two, at least 2");
+        return n;
+    }
+
+    bool ready(std::size_t pos, std::memory_order order = std::memory_order_acquire) const noexcept
+    {
+        return slots[pos & mask].seq.load(order) == pos + 1;
+    }
+
+    bool has_space() const noexcept
+    {
+        std::size_t pos = tail.load();
+        return std::intptr_t(slots[pos & mask].seq.load()) - std::intptr_t(pos) >= 0;
+    }
+
+    bool wait_ready()
+    {
+        for (int spin = 0; !ready(head); ++spin)
+        {
+            if (closed.load() && !ready(head))
+                return false;
+            if (spin < 64)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            // the producer stores seq before it reads sleeping, we store sleeping before we read seq (all seq_cst)
+            sleeping.store(true);
+            if (!ready(head, std::memory_order_seq_cst) && !closed.load())
+                sleeping.wait(true);
+            sleeping.store(false);
+        }
+        return true;
+    }
+
+    void wake_producers() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);    // the freed slots before the load of waiters
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            space.fetch_add(1);
+            space.notify_all();
+        }
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> tail{0};   // the producers
+    std::atomic<unsigned> waiters{0};
+    std::atomic<unsigned> space{0};
+    alignas(64) std::atomic<bool> sleeping{false};  // read by every push, written only around a sleep of the consumer
+    std::atomic<bool> closed{false};
+    alignas(64) std::size_t head = 0;               // the consumer, written by every pop: a line of its own
+};
+
+void f()
+{
+ResultQueue<Row> q(1024); // between the parse and the write stage
+std::thread parser([&] {
+for (const std::string& line : lines)
+q.push_from([&] { return parse(line); }); // a Row, or the exception of parse()
+q.close();
+});
+Row row;
+for (;;)
+{
+try
+{
+if (!q.pop(row)) // rethrows like handle_eptr(), in the order of the lines
+break;
+write(row);
+}
+catch (const std::exception& e)
+{
+log(e.what()); // and go on with the next line
+}
+}
+parser.join();
+}
+
+// Basic example of a benchmark: items per second and latency (push to pop) of ResultQueue and of a queue with a mutex and two
+// condition variables, with 1 to 32 producers and one consumer. Every 1000th item is an exception_ptr
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+template <class T>
+class LockedQueue   // the usual way: the same interface, one lock for everything
+{
+public:
+    explicit LockedQueue(std::size_t capacity) : capacity(capacity) { }
+
+    void push(Result<T> r)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        not_full.wait(lock, [this] { return q.size() < capacity; });
+        q.push_back(std::move(r));
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            closed = true;
+        }
+        not_empty.notify_one();
+    }
+
+    std::size_t pop_batch(std::vector<Result<T>>& out, std::size_t max)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        not_empty.wait(lock, [this] { return !q.empty() || closed; });
+        std::size_t n = std::min(max, q.size());
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            out.push_back(std::move(q.front()));
+            q.pop_front();
+        }
+        lock.unlock();
+        not_full.notify_all();
+        return n;
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable not_empty, not_full;
+    std::deque<Result<T>> q;
+    std::size_t capacity;
+    bool closed = false;
+};
+
+using Clock = std::chrono::steady_clock;
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+template <class Queue>
+void run(const char* name, unsigned producers)
+{
+    const std::size_t items = 2'000'000;
+    Queue q(1024);
+    std::exception_ptr failure = std::make_exception_ptr(std::runtime_error("stage failed"));
+    std::atomic<unsigned> running{producers};
+
+    auto t0 = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < producers; ++p)
+        threads.emplace_back([&, p] {
+            for (std::size_t i = p; i < items; i += producers)
+            {
+                if (i % 1000 == 999)
+                    q.push(Result<std::int64_t>(failure));
+                else
+                    q.push(Result<std::int64_t>(now_ns()));     // the value is the time of the push
+            }
+            if (running.fetch_sub(1) == 1)
+                q.close();
+        });
+
+    std::vector<std::uint32_t> latency;     // in ns
+    latency.reserve(items);
+    std::size_t errors = 0;
+    std::vector<Result<std::int64_t>> batch;
+    while (q.pop_batch(batch, 256) != 0)
+    {
+        std::int64_t t = now_ns();
+        for (Result<std::int64_t>& r : batch)
+        {
+            if (r.failed())
+                ++errors;
+            else
+                latency.push_back(std::uint32_t(std::min<std::int64_t>(t - r.get(), UINT32_MAX)));
+        }
+        batch.clear();
+    }
+    double s = std::chrono::duration<double>(Clock::now() - t0).count();
+    for (std::thread& t : threads)
+        t.join();
+
+    auto pct = [&](double p) {
+        std::size_t k = std::size_t(p * (latency.size() - 1));
+        std::nth_element(latency.begin(), latency.begin() + k, latency.end());
+        return latency[k] / 1000.0;
+    };
+    std::printf("%-12s %2u producers %8.2f M items/s   p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  (%zu errors)\n",
+                name, producers, items / s / 1e6, pct(0.5), pct(0.99), pct(0.999), errors);
+}
+
+int main()
+{
+    for (unsigned producers : { 1u, 2u, 4u, 8u, 16u, 32u })
+    {
+        run<ResultQueue<std::int64_t>>("ResultQueue", producers);
+        run<LockedQueue<std::int64_t>>("LockedQueue", producers);
+    }
+}
+
+/*
+handle_eptr() above gets the exception_ptr in the same thread. In a pipeline the stage that fails runs on another thread than the one
+that has to react, so the failure has to travel through the queue between them, in its place among the values. Result<T> is one
+element of that queue: a T or an exception_ptr, and get() either returns the value or rethrows, like handle_eptr(). ResultQueue moves
+them from many producers to one consumer:
+    it is the ring of TaskQueue with a sequence number in every slot. A producer claims a position with one CAS on tail, builds the
+    Result in the slot and publishes it with the sequence number. The consumer needs no CAS at all, it is the only one that moves head
+    every slot is aligned to 64 bytes. Without that, four Result<int64_t> share a cache line, and the producers filling them and the
+    consumer emptying them pull the same line back and forth. The same goes for the positions: tail (the producers), the flags every
+    push reads, and head (written by every pop) are on three different lines
+    pop_batch() takes all the ready slots (at most max) in one go and hands them over as Results, the errors can be inspected there.
+    pop() is the other style: it returns the next value, or rethrows the exception that is in its place. Either way the order of the
+    pushes is kept, so the consumer knows which item failed
+    push_from(f) is a stage in one line: it pushes what f() returns, or the exception f() throws
+    nobody waits on a lock. A producer that finds the ring full, or the consumer that finds it empty, yields 64 times and then sleeps
+    with atomic wait. The other side checks a flag (or a counter) and only calls notify if somebody really sleeps. For the consumer it
+    is checked once per batch, with one fence
+
+LockedQueue in the benchmark is the usual way: a deque with a mutex, and condition variables for "not empty" and "not full". It also
+pops in batches, so the difference is the lock, not the batching. Both have room for 1024 items, 2M int64_t items go through them (the
+value is the time of the push, so the consumer can measure the latency), and every 1000th item is an exception_ptr. The output on my
+machine (g++ 12 -O2, one core, batches of 256):
+
+    ResultQueue   1 producers    15.91 M items/s   p50      30.7 us  p99      60.9 us  p99.9     220.4 us  (2000 errors)
+    LockedQueue   1 producers     4.60 M items/s   p50      47.7 us  p99     102.6 us  p99.9     140.5 us  (2000 errors)
+    ResultQueue   2 producers    14.89 M items/s   p50      33.5 us  p99      72.9 us  p99.9     724.0 us  (2000 errors)
+    LockedQueue   2 producers     5.49 M items/s   p50      60.9 us  p99     119.3 us  p99.9     613.7 us  (2000 errors)
+    ResultQueue   4 producers    12.89 M items/s   p50      40.0 us  p99      88.6 us  p99.9     412.6 us  (2000 errors)
+    LockedQueue   4 producers    10.74 M items/s   p50      57.3 us  p99     119.1 us  p99.9     257.9 us  (2000 errors)
+    ResultQueue   8 producers    15.21 M items/s   p50      34.5 us  p99      70.9 us  p99.9     352.1 us  (2000 errors)
+    LockedQueue   8 producers     6.91 M items/s   p50     162.5 us  p99     241.9 us  p99.9     902.9 us  (2000 errors)
+    ResultQueue  16 producers    14.22 M items/s   p50      39.4 us  p99      72.3 us  p99.9     362.2 us  (2000 errors)
+    LockedQueue  16 producers     4.75 M items/s   p50     246.7 us  p99     390.8 us  p99.9    1144.3 us  (2000 errors)
+    ResultQueue  32 producers    10.93 M items/s   p50      54.8 us  p99     108.4 us  p99.9    1362.4 us  (2000 errors)
+    LockedQueue  32 producers     3.01 M items/s   p50     397.6 us  p99     861.4 us  p99.9    3971.6 us  (2000 errors)
+
+ResultQueue moves 11-16M items per second at every producer count, LockedQueue 3-11M, and it gets worse above 4 producers: the
+threads that wake up on not_full all go for the same mutex. My machine has one core, so the threads never really run at the same
+time. What is measured is the cost of the operations and of the sleeping and waking, the cache line fights would only show with more
+cores (the padding is there for those). The latency is mostly the time an item sits in the queue: the producers keep it full, so an
+item waits for about 1024 others. That is why p50 is tens of microseconds for both. The p99.9 is a thread that lost the core for a time
+slice. From 8 producers the lock makes that longer for the mutex queue, because a thread that loses the core holding it stops everybody.
+The 2000 errors arrived, each in its own place.
+*/
+
+
+
+// NESTED EXCEPTIONS
+
+void print_exception(const std::exception& e, int level = 0) // prints the string of an exception.
+{   // if nested, recurses
+    std::cerr << std::string(level, ' ') << "exception: " << e.what() << '\n';
+    try {
+        std::rethrow_if_nested(e);
+    } catch(const std::exception& e) {
+        print_exception(e, level + 1);
+    } catch(...) {}
+}
+
+void open_file(const std::string& s) // catches an exception and wraps it in a nested exception
+{
+    try {
+        std::ifstream file(s);
+        file.exceptions(std::ios_base::failbit);
+    } catch(...) {
+        std::throw_with_nested(std::runtime_error("Couldn't open " + s));
+    }
+}
+
+void run() // sample function that catches an exception and wraps it in a nested exception
+{
+    try {
+        open_file("nonexistent.file");
+    } catch(...) {
+        std::throw_with_nested(std::runtime_error("run() failed"));
+    }
+}
+
+int main() // runs the sample function above and prints the caught exception
+try { // exception: run() failed
+    run(); // exception: Couldn't open nonexistent file
+} catch(const std::exception& e) { // exception: basic_ios::clear
+    print_exception(e);
+}
+
+/*
+It is possible that we find some nested exceptions in real life systems, but it's rare. Even though, it's just good to know about them.
 */
 
 
 
-// EXCEPTION HIERARCHIES - 3 | WHY IS IT USEFUL TO CREATE EXCEPTION HIERARCHIES?
+// NESTED EXCEPTIONS - 2 | A THREAD POOL THAT CARRIES THE EXCEPTIONS OF ITS TASKS
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-struct matrixError // perhaps member in class Matrix
+// a type erased void() callable; small lambdas are stored inline, only the bigger ones are allocated
+class Task
 {
-    matrixError(std::string r) : reason(r) { }
-    std::string reason;
-    virtual ~matrixError() { } // we know that we will be working with inheritance, so we need a virtual destructor
+public:
+    Task() noexcept = default;
+
+    template <class F>
+    explicit Task(F&& f)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (sizeof(Fn) <= sizeof(buf) && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<Fn>)
+        {
+            ::new (buf) Fn(std::forward<F>(f));
+            ops = &inline_ops<Fn>;
+        }
+        else
+        {
+            ::new (buf) Fn*(new Fn(std::forward<F>(f)));
+            ops = &heap_ops<Fn>;
+        }
+    }
+
+    Task(Task&& t) noexcept { take(t); }
+
+    Task& operator=(Task&& t) noexcept
+    {
+        if (this != &t)
+        {
+            reset();
+            take(t);
+        }
+        return *this;
+    }
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->call(buf); }
+    explicit operator bool() const noexcept { return ops != nullptr; }
+
+    void reset() noexcept
+    {
+        if (ops)
+            ops->destroy(buf);
+        ops = nullptr;
+    }
+
+private:
+    struct Ops
+    {
+        void (*call)(void*);
+        void (*move)(void* from, void* to) noexcept;    // move constructs into to, destroys from
+        void (*destroy)(void*) noexcept;
+    };
+
+    template <class Fn>
+    static constexpr Ops inline_ops = {
+        [](void* p) { (*static_cast<Fn*>(p))(); },
+        [](void* from, void* to) noexcept { ::new (to) Fn(std::move(*static_cast<Fn*>(from))); static_cast<Fn*>(from)->~Fn(); },
+        [](void* p) noexcept { static_cast<Fn*>(p)->~Fn(); } };
+
+    template <class Fn>
+    static constexpr Ops heap_ops = {
+        [](void* p) { (**static_cast<Fn**>(p))(); },
+        [](void* from, void* to) noexcept { ::new (to) Fn*(*static_cast<Fn**>(from)); },
+        [](void* p) noexcept { delete *static_cast<Fn**>(p); } };
+
+    void take(Task& t) noexcept
+    {
+        ops = t.ops;
+        if (ops)
+            ops->move(t.buf, buf);
+        t.ops = nullptr;
+    }
+
+    const Ops* ops = nullptr;
+    alignas(std::max_align_t) unsigned char buf[48];
 };
 
-struct indexError : public matrixError, public std::out_of_range
+// bounded lock-free queue for any number of producers and consumers (Dmitry Vyukov's design). Every cell has a
+// sequence number: seq == pos means the cell is free for the producer at pos, seq == pos + 1 means it is full
+class TaskQueue
 {
-    indexError(int i, const char *r = "Bad index") : matrixError(r), out_of_range(r), index(i)
+public:
+    explicit TaskQueue(std::size_t capacity) // a power of two
+        : cells(new Cell[capacity]), mask(capacity - 1)
     {
-        std::ostringstream os;
-        os << index;
-        reason += ", index = ";
-        reason += os.str();
+        for (std::size_t i = 0; i < capacity; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
     }
 
-    const char *what() const noexcept override
+    bool try_push(Task& t, std::size_t id) noexcept
     {
-        return reason.c_str();
+        std::size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& c = cells[pos & mask];
+            std::intptr_t diff = std::intptr_t(c.seq.load(std::memory_order_acquire)) - std::intptr_t(pos);
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c.task = std::move(t);
+                    c.id = id;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;   // full
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
     }
 
-    virtual ~indexError() { }
-    int index;
+    bool try_pop(Task& t, std::size_t& id) noexcept
+    {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& c = cells[pos & mask];
+            std::intptr_t diff = std::intptr_t(c.seq.load(std::memory_order_acquire)) - std::intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    t = std::move(c.task);
+                    id = c.id;
+                    c.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;   // empty
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> seq;
+        std::size_t id;
+        Task task;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> tail{0};   // producers and consumers on different cache lines
+    alignas(64) std::atomic<std::size_t> head{0};
 };
 
-struct rowIndexError : public indexError
+struct task_error : public std::runtime_error
 {
-    rowIndexError(int i) : indexError(i, "Bad row index") { }
+    task_error(std::size_t id, const std::string& what, std::exception_ptr e)
+        : runtime_error("task " + std::to_string(id) + " failed: " + what), task(id), cause(std::move(e)) { }
+    std::size_t task;           // submission index since the last wait_all()
+    std::exception_ptr cause;   // the original exception, with its own nested exceptions
 };
 
-struct colIndexError : public indexError
+struct task_errors : public std::runtime_error  // thrown by wait_all(all_failures), the first failures are nested in it
 {
-    colIndexError(int i) : indexError(i, "Bad col index") { }
+    task_errors(std::size_t failed, std::size_t total, std::vector<std::exception_ptr> e)
+        : runtime_error(std::to_string(failed) + " of " + std::to_string(total) + " tasks failed"), errors(std::move(e)) { }
+    std::vector<std::exception_ptr> errors;     // every failure, in submission order
 };
 
-/*
-The main point of creating exception hierarchies is that we can express the bugs and handle them in the most sophisticated way.
-*/
+class TaskPool
+{
+public:
+    enum report { first_failure, all_failures };
+    static constexpr std::size_t max_nested = 16;   // task_errors chains at most this many failures for print_exception
 
+    explicit TaskPool(unsigned threads = std::thread::hardware_concurrency(), std::size_t queue_capacity = 4096)
+    {
+        n = std::max(threads, 1u);
+        for (unsigned i = 0; i < n; ++i)
+            queues.push_back(std::make_unique<TaskQueue>(queue_capacity));
+        for (unsigned i = 0; i < n; ++i)
+            workers.emplace_back([this, i] { work(i); });
+    }
 
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
 
-// STD EXCEPTION HIERARCHY
+    ~TaskPool()
+    {
+        drain();
+        delete_failures(failures.exchange(nullptr));    // failures nobody asked for are dropped
+        stop.store(true);
+        epoch.fetch_add(1);
+        epoch.notify_all();
+        for (std::thread& t : workers)
+            t.join();
+    }
 
-class exception {}; // in <exception>
+    unsigned size() const noexcept { return n; }
 
-class bad_exception : public exception {}; // calls unexpected()
-class bad_weak_ptr : public exception {}; // C++11 weak_ptr -> shared_ptr
-class bad_function_call : public exception {}; // C++11 function::operator()
-class bad_typeid : public exception {}; // typeid(0)
-class bad_cast : public exception {}; // dynamic_cast
-    class bad_any_cast : public bad_cast {}; // C++17
-class bad_variant_access : exception {} // C++17
-class bad_optional_access : exception {} // C++17
-class bad_alloc : public exception {}; // new <new>
-    class bad_array_new_length : bad_alloc {} // C++11, new T[-1]
+    // a worker submits to its own queue, other threads spread the tasks round robin; the idle workers steal from the others
+    template <class F>
+    void submit(F&& f)
+    {
+        Task t(std::forward<F>(f));
+        std::size_t id = submitted.fetch_add(1, std::memory_order_relaxed);
+        pending.fetch_add(1, std::memory_order_relaxed);
+        unsigned home = current == this ? current_index : round_robin++;
+        for (;;)
+        {
+            for (unsigned k = 0; k < n; ++k)
+            {
+                if (queues[(home + k) % n]->try_push(t, id))
+                {
+                    wake();
+                    return;
+                }
+            }
+            run_one(home);  // every queue is full: help instead of waiting
+        }
+    }
 
-class logic_error : public exception {};
-    class domain_error : public logic_error {}; // domain error,std::sqrt(-1)
-    class invalid_argument : public logic_error {}; // bitset char != 0 or 1
-    class length_error : public logic_error {}; // length str.resize(-1)
-    class out_of_range : public logic_error {}; // bad index in container or string
-    class future_error : public logic_error {}; // C++11: promise abandons the shared state
+    // Waits for every task submitted so far (the calling thread runs tasks too). Then, if any of them failed:
+    //     first_failure: rethrows the exception of the failed task with the smallest submission index
+    //     all_failures:  throws task_errors with the failures nested in it, print_exception() prints all of them
+    // Must not be called from a task
+    void wait_all(report r = first_failure)
+    {
+        drain();
+        Failure* list = failures.exchange(nullptr, std::memory_order_acquire);
+        std::size_t failed = n_failed.exchange(0), total = submitted.exchange(0);
+        if (failed == 0)
+            return;
+
+        std::vector<Failure*> v;
+        for (Failure* f = list; f; f = f->next)
+            v.push_back(f);
+        std::sort(v.begin(), v.end(), [](Failure* a, Failure* b) { return a->id < b->id; });
+        std::vector<std::exception_ptr> errors;
+        for (Failure* f : v)
+            errors.push_back(f->error);
+        std::vector<std::size_t> ids;
+        for (Failure* f : v)
+            ids.push_back(f->id);
+        delete_failures(list);
+
+        if (errors.empty())     // the failures were counted, but there was no memory to keep them
+            throw std::bad_alloc();
+        if (r == first_failure)
+            std::rethrow_exception(errors.front());
+
+        // task_errors -> task_error (first) -> task_error (second) -> ... ; each level needs the next one
+        // as the current exception, so the chain is built from the inside out
+        std::exception_ptr chain;
+        for (std::size_t i = std::min(errors.size(), max_nested); i-- > 0; )
+        {
+            task_error e(ids[i], message(errors[i]), errors[i]);
+            if (!chain)
+            {
+                chain = std::make_exception_ptr(e);
+                continue;
+            }
+            try
+            {
+                std::rethrow_exception(chain);
+            }
+            catch (...)
+            {
+                try
+                {
+                    std::throw_with_nested(e);
+                }
+                catch (...)
+                {
+                    chain = std::current_exception();
+                }
+            }
+        }
+        try
+        {
+            std::rethrow_exception(chain);
+        }
+        catch (...)
+        {
+            std::throw_with_nested(task_errors(failed, total, std::move(errors)));
+        }
+    }
 
-class runtime_error : public exception {};
-    class range_error : public runtime_error {}; // floating point ovf or unf
-    class overflow_error : public runtime_error {}; // int overflow INT_MAX+1
-    class underflow_error : public runtime_error {}; // int underflow INT_MIN-1
-    class system_error : public runtime_error {}; // e.g. std::thread constr.
-        class ios_base::failure : public system_error {}; // C++11
-        class filesystem::filesystem_error : public system_error {}; // C++17
-        class nonexistent_local_time : public system_error // C++20
-        class ambigous_local_time : public system_error // C++20
-        class format_error : public system_error // C++20
+private:
+    struct Failure
+    {
+        std::size_t id;
+        std::exception_ptr error;
+        Failure* next;
+    };
 
+    void work(unsigned i)
+    {
+        current = this;
+        current_index = i;
+        while (!stop.load(std::memory_order_acquire))
+        {
+            if (run_one(i))
+                continue;
+            bool found = false;
+            for (int spin = 0; spin < 64 && !(found = run_one(i)); ++spin)
+                std::this_thread::yield();
+            if (found)
+                continue;
+
+            // sleep until the next submit. sleepers is raised before epoch is read, and submit() raises epoch before it
+            // reads sleepers, so either we see the new epoch or submit() sees us (both are seq_cst)
+            sleepers.fetch_add(1);
+            unsigned e = epoch.load();
+            if (!run_one(i) && !stop.load())
+                epoch.wait(e);
+            sleepers.fetch_sub(1);
+        }
+    }
 
+    void wake() noexcept
+    {
+        epoch.fetch_add(1);
+        if (sleepers.load() != 0)
+            epoch.notify_one();
+    }
 
-// EXCEPTION SPECIFICATION BEFORE C++11
+    bool run_one(unsigned start) noexcept
+    {
+        Task t;
+        std::size_t id;
+        for (unsigned k = 0; k < n; ++k)
+        {
+            if (queues[(start + k) % n]->try_pop(t, id))
+            {
+                execute(t, id);
+                return true;
+            }
+        }
+        return false;
+    }
 
-class E1;
-class E2;
+    void execute(Task& t, std::size_t id) noexcept
+    {
+        try
+        {
+            t();
+        }
+        catch (...)
+        {
+            record(id, std::current_exception());
+        }
+        t.reset();
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            pending.notify_all();
+    }
 
-void f() throw(E1) // throws only E1 or subclasses
-{
-    ...
-    throw E1(); // throws exception of type E1
-    ...
-    throw E2(); // calls unexpected() which calls terminate()
-}
+    // the only allocation of a failing task; a lock-free push to the front of a list
+    void record(std::size_t id, std::exception_ptr e) noexcept
+    {
+        n_failed.fetch_add(1, std::memory_order_relaxed);
+        Failure* f = new (std::nothrow) Failure{id, std::move(e), nullptr};
+        if (!f)
+            return;
+        f->next = failures.load(std::memory_order_relaxed);
+        while (!failures.compare_exchange_weak(f->next, f, std::memory_order_release, std::memory_order_relaxed)) { }
+    }
+
+    void drain() noexcept
+    {
+        unsigned home = current == this ? current_index : 0;
+        for (std::size_t p; (p = pending.load(std::memory_order_acquire)) != 0; )
+        {
+            if (!run_one(home))
+                pending.wait(p, std::memory_order_acquire);
+        }
+    }
+
+    static std::string message(const std::exception_ptr& e)
+    {
+        try
+        {
+            std::rethrow_exception(e);
+        }
+        catch (const std::exception& x)
+        {
+            return x.what();
+        }
+        catch (...)
+        {
+            return "unknown exception";
+        }
+    }
+
+    static void delete_failures(Failure* f) noexcept
+    {
+        while (f)
+            delete std::exchange(f, f->next);
+    }
+
+    static inline thread_local const TaskPool* current = nullptr;   // the pool of this worker thread
+    static inline thread_local unsigned current_index = 0;
+    static inline thread_local unsigned round_robin = 0;
+
+    unsigned n;
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<bool> stop{false};
+    alignas(64) std::atomic<std::size_t> pending{0};
+    alignas(64) std::atomic<std::size_t> submitted{0};
+    alignas(64) std::atomic<unsigned> epoch{0};
+    std::atomic<unsigned> sleepers{0};
+    alignas(64) std::atomic<Failure*> failures{nullptr};
+    std::atomic<std::size_t> n_failed{0};
+};
 
-// same as:
 void f()
-try {
-    ...
+{
+TaskPool pool;
+for ( int i = 0; i < 4; ++i )
+{
+pool.submit(run); // run() from above, it always fails with a nested exception
 }
-catch(E1) { throw; }
-catch(...) { std::unexpected(); }
+try
+{
+pool.wait_all(TaskPool::all_failures);
+}
+catch ( const std::exception& e )
+{
+print_exception(e); // exception: 4 of 4 tasks failed
+}                   //  exception: task 0 failed: run() failed
+}                   //   exception: task 1 failed: run() failed ...
 
-/*
-The problem is that if f calls function c that calls another function that does exception handling. If this function throws exception that will go through
-function c and then in function f as well. The compiler cannot check it in C.
+// Basic example of a benchmark: tasks per second at 1 to 64 threads, with 0% and 1% failing tasks (usage: bench tasks)
 
-That is the reason why in C++ the throw(E1) only can throw E1 or its subclasses, but not any other classes avoiding the problem we described above. If E1 comes
-we catch it and throw, but if anything else comes then we abort the code instantly.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 
-Since C++17 this got deleted from the standard.
+// the allocations of all the threads are counted by the operator new of COUNTING THE HEAP
 
-The code below is a more sophisticated way of throwing exception and we do not terminate the code:
-*/
+int main(int argc, char* argv[])
+{
+    const std::size_t tasks = argc > 1 ? std::atol(argv[1]) : 1'000'000;
+    std::vector<unsigned> out(tasks);
 
-class E1;
-class E2;
+    std::printf("%7s %8s %12s %12s %14s %10s\n", "threads", "failing", "M tasks/s", "ns per task", "allocs per task", "failures");
+    for (unsigned threads = 1; threads <= 64; threads *= 2)
+    {
+        for (unsigned fail_every : { 0u, 100u })
+        {
+            TaskPool pool(threads);
+            std::size_t failures = 0;
+            n_allocs = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < tasks; ++i)
+            {
+                pool.submit([&out, i, fail_every] {
+                    unsigned x = static_cast<unsigned>(i);
+                    for (int k = 0; k < 50; ++k)    // a few dozen ns of work
+                        x = x * 1664525u + 1013904223u;
+                    if (fail_every && i % fail_every == 37)
+                        throw std::runtime_error("task failed");
+                    out[i] = x;
+                });
+            }
+            try
+            {
+                pool.wait_all(TaskPool::all_failures);
+            }
+            catch (const task_errors& e)
+            {
+                failures = e.errors.size();
+            }
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            std::printf("%7u %7u%% %12.2f %12.1f %14.3f %10zu\n", threads, fail_every ? 1 : 0, tasks / s * 1e-6, s * 1e9 / tasks,
+                        double(n_allocs) / tasks, failures);
+        }
+    }
 
-void f() throw(E1, std::bad_exception) // throws only E1 or subclasses
-{
-    ...
-    throw E1(); // throws exception of type E1
-    ...
-    throw E2(); // calls unexpected() which throws bad_exception()
+    TaskPool pool(2);
+    for (int i = 0; i < 3; ++i)
+        pool.submit(run);
+    try
+    {
+        pool.wait_all(TaskPool::all_failures);
+    }
+    catch (const std::exception& e)
+    {
+        print_exception(e);
+    }
 }
 
-typedef void (*terminate_handler)();
-terminate_handler set_terminate(terminate_handler);
-terminate_handler get_terminate(); // C++11
+/*
+handle_eptr() and print_exception() above only work on one thread, but std::exception_ptr was made for moving exceptions between
+threads (std::future uses it too). A task that throws in a worker thread must not terminate the program, so every task runs inside
+catch (...) and the exception is saved with std::current_exception(). wait_all() gives it back to the thread that submitted the tasks:
+    wait_all() or wait_all(TaskPool::first_failure) rethrows the exception of the first failed task (in submission order, not in time,
+    so the result does not depend on the scheduling). It is the original exception object, catch it like any other
+    wait_all(TaskPool::all_failures) throws a task_errors with the failures nested in it with throw_with_nested, so print_exception() walks
+    through them. task_errors::errors has every exception_ptr, task_error::cause is the original exception of one task with its own nested
+    exceptions (the chain only has room for the message, so only the first 16 failures are chained)
+The nested chain has to be built from the inside out, because std::nested_exception saves the exception that is being handled when it is
+constructed: every level is a rethrow and a throw_with_nested. That is slow, but it only happens once and only if something failed.
+
+The happy path is lock-free and does not allocate:
+    a task is a type erased callable with a 48 byte buffer, so a lambda with a few captures is stored inline, not with new
+    every worker has a bounded lock-free queue (the cells have sequence numbers, a push or a pop is one compare-and-swap). A worker takes
+    from its own queue first and steals from the others when it is empty, tasks submitted by a task go to the queue of its worker
+    a worker that found nothing sleeps in std::atomic::wait (a futex on Linux), submit() only wakes it if somebody sleeps
+    wait_all() does not sleep while there is work, the calling thread runs tasks too
+    when every queue is full, submit() runs a task itself instead of allocating more room
+Only a failing task allocates: the exception object, its message and a list node for the exception_ptr.
+
+The output on my machine (g++ 12 -O2, 1 million tasks):
+
+    threads  failing    M tasks/s  ns per task allocs per task   failures
+          1       0%         7.22        138.5          0.000          0
+          1       1%         5.92        169.0          0.020      10000
+          2       0%         7.24        138.0          0.000          0
+          2       1%         6.46        154.7          0.020      10000
+          4       0%         7.27        137.5          0.000          0
+          4       1%         5.66        176.7          0.020      10000
+          8       0%         5.56        179.8          0.000          0
+          8       1%         6.27        159.5          0.020      10000
+         16       0%         4.78        209.2          0.000          0
+         16       1%         5.34        187.1          0.020      10000
+         32       0%         4.71        212.4          0.000          0
+         32       1%         4.28        233.6          0.020      10000
+         64       0%         3.31        302.5          0.000          0
+         64       1%         3.42        292.6          0.020      10000
+    exception: 3 of 3 tasks failed
+     exception: task 0 failed: run() failed
+      exception: task 1 failed: run() failed
+       exception: task 2 failed: run() failed
+
+0 allocations per task on the happy path, 2 per failing task (the message of the runtime_error and the list node, the exception object
+itself comes from malloc). With 1% failures a failing task costs about 2-3 microseconds more, which is the price of a throw that we saw
+in EXCEPTIONS IN C++ - 2. The machine I ran it on has a single core, so more threads can only add overhead here (64 threads on one core
+lose about half of the throughput to the context switches); the scaling on a multi-core machine has to be measured there.
+*/
 
-// until C++17
-typedef void (*unexpected_handler)();
-unexpected_handler set_unexpected(unexpected_handler);
-unexpected_handler get_unexpected(); // C++11
 
-void f() throw() // does not throw, can be optimized
-// People using the f() function could assume that this function does not throw exception since the () after the throw is empty, so
-// they could optimize it. The problem is that during compilation time we cannot check it
 
-/*
-So here, instead of terminating the code we just include the std::bad_exception and then handle the exception.
+// NESTED EXCEPTIONS - 3 | WALKING THE CHAIN WITHOUT RETHROWING
 
-This got also removed from the standard since C++20
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h> // abi::__cxa_demangle
+#include <exception>
+#include <typeinfo>
 
-Because all of the issues with these exception handling methods we got the noexcept in the standard.
-*/
+struct ErrorLevel
+{
+    const std::type_info* type; // the dynamic type of the exception, nullptr if unknown
+    const char* what;           // nullptr if it is not a std::exception
+    int depth;                  // 0 for the outermost exception
+};
 
+// The nested chain as a flat array: walk() fills it without rethrowing anything, format() prints it like print_exception into
+// a buffer of the caller. One report can be reused for any number of errors, after the first ones it does not allocate.
+// The what() strings point into the exception objects: use the report while the exception is alive, or walk an exception_ptr
+class ErrorReport
+{
+public:
+    static constexpr int max_depth = 32;
 
+    ErrorReport() = default;
+    ErrorReport(const ErrorReport&) = delete;
+    ErrorReport& operator=(const ErrorReport&) = delete;
+    ~ErrorReport() { std::free(name_buf); }
 
-// NOEXCEPT SPECIFIER
+    void walk(const std::exception& e) noexcept
+    {
+        keep = nullptr;
+        walk(&typeid(e), &e);
+    }
 
-void f() noexcept(expr) { } // the compiler will evaluate the parameter in compilation time
-void f() noexcept(true) { }
-void f() noexcept { } // noexcept(true)
+    void walk(std::exception_ptr p) noexcept    // the report keeps the exception alive
+    {
+        keep = std::move(p);
+        if (!keep)
+        {
+            n = 0;
+            cut = false;
+            return;
+        }
+        const std::type_info* type;
+        const std::exception* e;
+        inspect(keep, type, e);
+        walk(type, e);
+    }
 
-/*
-Noexcept is important for optimizations and code safety. C++ functions are either non-throwing or potentially throwing (we are not sure if they will throw, but potentially they can).
-C++ cannot execute full compile time check on possible exceptions due to possible call of non C++ functions.
+    int size() const noexcept { return n; }
+    bool truncated() const noexcept { return cut; }   // the chain was deeper than max_depth
+    const ErrorLevel& operator[](int i) const noexcept { return levels[i]; }
+    const ErrorLevel* begin() const noexcept { return levels; }
+    const ErrorLevel* end() const noexcept { return levels + n; }
 
-IMPORTANT: Destructors, deallocation functions are non-throwing, so it means we don't need to write noexcept for them.
+    // "<indent><type>: <what>" for every level, like print_exception; returns the length of the whole text (like snprintf),
+    // if it is >= size the text was cut. buf is always terminated with '\0' when size > 0
+    std::size_t format(char* buf, std::size_t size) noexcept
+    {
+        std::size_t len = 0;
+        auto put = [&](const char* s, std::size_t k) {
+            if (len < size)
+                std::memcpy(buf + len, s, std::min(k, size - len));
+            len += k;
+        };
+        for (const ErrorLevel& l : *this)
+        {
+            for (int i = 0; i < l.depth; ++i)
+                put(" ", 1);
+            const char* name = type_name(l.type);
+            put(name, std::strlen(name));
+            put(": ", 2);
+            const char* what = l.what ? l.what : "(not a std::exception)";
+            put(what, std::strlen(what));
+            put("\n", 1);
+        }
+        if (cut)
+            put("...\n", 4);
+        if (size > 0)
+            buf[std::min(len, size - 1)] = '\0';
+        return len;
+    }
 
-Based on how we declared the base class or function that the following expression call, they can be non-throwing as well: Implicitly declared or defaulted default-, copy- and move constructors,
-copy, move oper. So again, based on what base class or operators they are calling (if they call a noexcept base class for example) we do not need to describe them as noexcept.
+private:
+    void walk(const std::type_info* type, const std::exception* e) noexcept
+    {
+        n = 0;
+        cut = false;
+        for (;;)
+        {
+            if (n == max_depth)
+            {
+                cut = true;
+                return;
+            }
+            levels[n] = { type, e ? e->what() : nullptr, n };
+            ++n;
+            const std::nested_exception* nested = e ? as_nested(type, e) : nullptr;
+            if (!nested)
+                return;
+            std::exception_ptr inner = nested->nested_ptr();
+            if (!inner)
+                return;
+            inspect(inner, type, e);    // the inner object stays alive after inner is gone, the outer one owns it
+        }
+    }
 
-At move semantic, for example, using noexcept can lead to better performance.
-*/
+#if defined(__GLIBCXX__)
+    // The same thing the catch clause does, without the throw: the exception_ptr of libstdc++ is a pointer to the thrown
+    // object, and type_info::__do_catch (used by the personality routine to match the handlers) tells whether the type
+    // is a std::exception and adjusts the pointer to that base
+    static void inspect(const std::exception_ptr& p, const std::type_info*& type, const std::exception*& e) noexcept
+    {
+        static_assert(sizeof(p) == sizeof(void*), "libstdc++ exception_ptr is a single pointer");
+        void* obj;
+        std::memcpy(&obj, &p, sizeof(obj));
+        type = p.__cxa_exception_type();
+        e = type && typeid(std::exception).__do_catch(type, &obj, 1) ? static_cast<const std::exception*>(obj) : nullptr;
+    }
+
+    // the same for the nested_exception base, it is cheaper than the cross cast of dynamic_cast
+    static const std::nested_exception* as_nested(const std::type_info* type, const std::exception* e) noexcept
+    {
+        void* obj = const_cast<void*>(dynamic_cast<const void*>(e));
+        return typeid(std::nested_exception).__do_catch(type, &obj, 1) ? static_cast<const std::nested_exception*>(obj) : nullptr;
+    }
+#else
+    // no way to look into an exception_ptr in standard C++: one rethrow per level, like print_exception
+    static void inspect(const std::exception_ptr& p, const std::type_info*& type, const std::exception*& e) noexcept
+    {
+        try
+        {
+            std::rethrow_exception(p);
+        }
+        catch (const std::exception& x)
+        {
+            type = &typeid(x);
+            e = &x;     // not a copy with libstdc++ and libc++, the object lives as long as p
+        }
+        catch (...)
+        {
+            type = nullptr;
+            e = nullptr;
+        }
+    }
+
+    static const std::nested_exception* as_nested(const std::type_info*, const std::exception* e) noexcept
+    {
+        return dynamic_cast<const std::nested_exception*>(e);
+    }
+#endif
 
+    // Demangling is slow, so the names are cached by type (a small direct mapped table, no allocation). The wrapper that
+    // throw_with_nested adds (std::_Nested_exception<T> in libstdc++) is left out, so the name is the T that was thrown
+    const char* type_name(const std::type_info* type) noexcept
+    {
+        if (!type)
+            return "unknown";
+        Name& slot = names[(reinterpret_cast<std::uintptr_t>(type) >> 4) % n_names];
+        if (slot.type == type)
+            return slot.name;
+
+        int status = 0;
+        char* s = abi::__cxa_demangle(type->name(), name_buf, &name_cap, &status);
+        if (status != 0)
+            return type->name();
+        name_buf = s;
+        std::size_t len = std::strlen(s);
+        const char wrapper[] = "std::_Nested_exception<";
+        const std::size_t w = sizeof(wrapper) - 1;
+        if (len > w + 1 && std::strncmp(s, wrapper, w) == 0 && s[len - 1] == '>')
+        {
+            s += w;
+            len -= w + 1;
+        }
+        len = std::min(len, sizeof(slot.name) - 1);
+        std::memcpy(slot.name, s, len);
+        slot.name[len] = '\0';
+        slot.type = type;
+        return slot.name;
+    }
 
+    struct Name
+    {
+        const std::type_info* type = nullptr;
+        char name[120];
+    };
+    static constexpr std::size_t n_names = 16;
+
+    ErrorLevel levels[max_depth];
+    int n = 0;
+    bool cut = false;
+    std::exception_ptr keep;
+    Name names[n_names];
+    char* name_buf = nullptr;   // malloc'd, as __cxa_demangle wants it
+    std::size_t name_cap = 0;
+};
 
-// NOEXCEPT OPERATOR
+void f()
+{
+try
+{
+run(); // from above
+}
+catch ( const std::exception& e )
+{
+static thread_local ErrorReport report;
+char buf[1024];
+report.walk(e);
+report.format(buf, sizeof(buf));
+std::fputs(buf, stderr); // std::runtime_error: run() failed
+}                        //  std::runtime_error: Couldn't open nonexistent.file
+}                        //   std::__ios_failure: basic_ios::clear: iostream error
+
+// Basic example of a benchmark: ns per report against the depth of the chain, print_exception and ErrorReport
+
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
 
-template <typename T>
-//       this is the specifier   and this is the operator!!!
-void f() noexcept               (noexcept(T::g())) {
-    T::g();
+void print_exception_to(std::ostream& os, const std::exception& e, int level = 0) // print_exception from above, into os
+{
+    os << std::string(level, ' ') << "exception: " << e.what() << '\n';
+    try {
+        std::rethrow_if_nested(e);
+    } catch(const std::exception& e) {
+        print_exception_to(os, e, level + 1);
+    } catch(...) {}
 }
 
-/*
-In C++ there are noexcept specifier, and operator. In case of noexcept operator the noexcept has a parameter (T::g()). The parameter produces true or false values based on its argument is
-non-throwing or potentially throwing.
+void throw_chain(int depth) // depth levels, each wraps the one below it
+{
+    if (depth == 1)
+        throw std::runtime_error("root cause");
+    try
+    {
+        throw_chain(depth - 1);
+    }
+    catch (...)
+    {
+        std::throw_with_nested(std::runtime_error("level " + std::to_string(depth)));
+    }
+}
 
-The key difference between the noexcept operator and specifier: In the f() with a noexcept operator we aren't saying that this function never gives exception, but we rather say that this f()
-will throw or not throw exception based on what we know about function g().
+template <class F>
+double ns_per_call(int n, F f)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i)
+        f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
 
-This is especially useful with templates when we do not know what type it will be instantiated with. We do not know that the type the template will be instantiated with will throw exception or not.
+int main()
+{
+    const int n = 100'000;
+    ErrorReport report;
+    std::ostringstream os;
+    char buf[4096];
+    std::size_t sink = 0;
+
+    std::printf("%5s %18s %18s %18s %8s\n", "depth", "print_exception", "walk + format", "walk only", "speedup");
+    for (int depth : { 1, 2, 5, 10, 20 })
+    {
+        try
+        {
+            throw_chain(depth);
+        }
+        catch (const std::exception& e)
+        {
+            double t_print = ns_per_call(n, [&] {
+                os.str("");
+                print_exception_to(os, e);
+                sink += os.tellp();
+            });
+            double t_report = ns_per_call(n, [&] {
+                report.walk(e);
+                sink += report.format(buf, sizeof(buf));
+            });
+            double t_walk = ns_per_call(n, [&] {
+                report.walk(e);
+                sink += report.size();
+            });
+            std::printf("%5d %15.1f ns %15.1f ns %15.1f ns %7.1fx\n", depth, t_print, t_report, t_walk, t_print / t_report);
+        }
+    }
+
+    try
+    {
+        throw_chain(3);
+    }
+    catch (...)
+    {
+        report.walk(std::current_exception());
+    }
+    report.format(buf, sizeof(buf));
+    std::fputs(buf, stdout);
+    asm volatile("" : : "r"(sink));     // the measured loops are not optimized away
+}
 
+/*
+print_exception() gets to the next level with std::rethrow_if_nested(), which is a real throw, caught by the catch in the next frame:
+a chain of depth 5 is 4 throws, each one a trip through the unwinder (about 1-2 microseconds, see EXCEPTIONS IN C++ - 2), just to
+read the strings that are already in memory. For a log line on an error path that is hit often this is a lot.
+
+ErrorReport walks the same chain without throwing at all:
+    the outermost exception is the one we caught, its type is typeid(e) and the nested part is dynamic_cast<const nested_exception*>
+    the inner exceptions are only reachable through nested_ptr(), an exception_ptr. Standard C++ can only open it with
+    rethrow_exception, so this is where the implementation specific part is: in libstdc++ the exception_ptr is a pointer to the thrown
+    object, __cxa_exception_type() gives its type and type_info::__do_catch does what a catch (const std::exception&) would do
+    (checks the base class and adjusts the pointer) without any unwinding. Other standard libraries fall back to one rethrow per level
+    the levels go to a fixed array in the report, the text goes to the buffer of the caller (the same idea as snprintf: the return value
+    is the length it needed). The type names are demangled once per type and cached in the report, __cxa_demangle alone takes longer
+    than the whole walk
+So no throws, and after the first report no allocations either. print_exception allocates a std::string for the indentation on every
+level, and an ostream is not cheap even without that.
+
+The output on my machine (g++ 12 -O2):
+
+    depth    print_exception      walk + format          walk only  speedup
+        1           107.5 ns            48.3 ns            28.4 ns     2.2x
+        2          2917.4 ns           137.4 ns            86.0 ns    21.2x
+        5         11924.4 ns           635.0 ns           410.5 ns    18.8x
+       10         28595.6 ns          1385.4 ns          1002.9 ns    20.6x
+       20         63558.1 ns          2070.3 ns          1767.0 ns    30.7x
+    std::runtime_error: level 3
+     std::runtime_error: level 2
+      std::runtime_error: root cause
+
+With depth 1 there is nothing nested, so print_exception does not throw either, the difference is only the ostream. From depth 2 every
+level costs about 3 microseconds with print_exception (one throw and catch) and about 50-100 ns with ErrorReport (a dynamic_cast to the
+most derived object, two __do_catch and the reference count of nested_ptr()). The report shows the dynamic type of every level, the
+_Nested_exception<T> that throw_with_nested really throws is shown as T.
 */
 
-// Basic example of output
-template <typename T>
-void f() noexcept(noexcept(T::g(5 + 2))) {
-    T::g();
-}
 
-// OUTPUT: True
 
+// NESTED EXCEPTIONS - 4 | COROUTINES ON THE THREAD POOL, THE EXCEPTION TRAVELS WITH THE RESULT
 
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
 
-// DESTRUCTORS
+// what the promise of AsyncTask<T> keeps: the value or the exception
+template <class T>
+struct async_result
+{
+    std::optional<T> value;
+    std::exception_ptr error;
 
-/*
-In C++ it is a very strong rule that destructors must not throw exceptions. It's not strictly in the standard library, so we can write destructors that throw exception and there are examples for that in real
-life as well, but we have to be careful with that. This article inspects this topic in more detail (https://akrzemi1.wordpress.com/2011/09/21/destructors-that-throw/).
-*/
+    void return_value(T v) { value.emplace(std::move(v)); }
 
+    T get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
 
+template <>
+struct async_result<void>
+{
+    std::exception_ptr error;
 
-// EXCEPTION SAFETY
+    void return_void() noexcept { }
 
-class T1 {...};
-class T2 {...};
+    void get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
 
-template <typename T1, typename T2>
-void f(T1*, T2*);
+// A coroutine that returns a T. It is lazy: it starts when it is awaited, or with start(). An exception that leaves the body is
+// stored as an exception_ptr and rethrown by co_await (or get()) in the coroutine that waits for it, so a throw_with_nested chain
+// arrives in one piece. (The name Task is taken by the callable of TaskPool above.)
+// A started task can run on another thread, so it must be awaited before it is destroyed, like a std::thread must be joined
+template <class T = void>
+class [[nodiscard]] AsyncTask
+{
+public:
+    struct promise_type : async_result<T>
+    {
+        // running: nobody waits for it yet; done: finished; anything else: the address of the coroutine that waits for it.
+        // The task and the waiter may get here at the same time on two threads, the atomic decides who resumes the waiter
+        std::atomic<std::uintptr_t> state{ running };
 
-void g() {
-    f(new T1(), new T2());
-    // ...
-}
+        AsyncTask get_return_object() noexcept { return AsyncTask(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return { }; }
+        void unhandled_exception() noexcept { this->error = std::current_exception(); }
 
-/*
-Imagine that I have constructed T1, but T2 throws exception, because we couldn't allocate the memory in the heap of T2 or the constructor of T2 throws exception then C++ guarantees that the memory reserved by T2 will
-free, but the memory space of T1 won't free and then we get memory leak. Before C++17 it was also possible that the expressions got overlapped in the call. Both expression were before the sequence point, so it was possible
-before C++17 that the memory was allocated for T1 and then T2, but the constructor got called for T1 and then T2 and if there was an exception in any of the parameters then the memory allocated to the other parameter didn't free.
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
 
-This is the exception safety problem that's the reason why we have to carefully implement exceptions because there can happen memory leak and we lose the whole point of working with exceptions.
-*/
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                std::uintptr_t waiter = h.promise().state.exchange(done, std::memory_order_acq_rel);
+                if (waiter == running)
+                    return std::noop_coroutine();
+                return std::coroutine_handle<>::from_address(reinterpret_cast<void*>(waiter));  // resume the waiter here
+            }
 
+            void await_resume() noexcept { }
+        };
 
+        final_awaiter final_suspend() noexcept { return { }; }
+    };
 
-// ENSURE EXCEPTION SAFETY
+    using handle = std::coroutine_handle<promise_type>;
 
-class T1 {...};
+    AsyncTask(AsyncTask&& t) noexcept : h(std::exchange(t.h, nullptr)), started(t.started) { }
+    AsyncTask& operator=(AsyncTask&&) = delete;
 
-class T2 {...};
+    ~AsyncTask()
+    {
+        if (!h)
+            return;
+        if (started && !ready())
+            std::terminate();   // the frame is still running somewhere
+        h.destroy();
+    }
 
-template <typename T1, typename T2>
-void f(std::unique_ptr<T1>, std::unique_ptr<T2>);
+    // runs the task on this thread until its first suspension (usually co_await on(pool)), and does not wait for it
+    void start()
+    {
+        if (!started)
+        {
+            started = true;
+            h.resume();
+        }
+    }
 
-void g() {
-    std::unique_ptr<T1> ptr1{ new T1() };
-    std::unique_ptr<T2> ptr2{ new T2() };
-    f(ptr1, ptr2);
-    // ...
-}
+    bool ready() const noexcept { return h.promise().state.load(std::memory_order_acquire) == done; }
 
-/*
-By rearranging the source code and using sequence points we can make sure that exception safety is guaranteed.
-For example, using unique pointers and declare them differently (under each other, so there are sequance point between them) we can ensure exception safety.
+    // co_await task gives the value, or rethrows the exception of the task
+    auto operator co_await() noexcept { return awaiter<true>{ *this }; }
 
-*/
+    // co_await task.when_ready() only waits: the value or the exception stays in the task, for get()
+    auto when_ready() noexcept { return awaiter<false>{ *this }; }
 
+    T get() { return h.promise().get(); }  // when it is ready
 
+private:
+    static constexpr std::uintptr_t running = 0, done = 1;
 
-// EXCEPTION SAFETY IN STL
+    explicit AsyncTask(handle c) noexcept : h(c) { }
 
-/*
-In the stl there are there levels of exception safety described:
-    Basic guarantee: no memory leak or other resource issue
-    Strong guarantee: the operation is atomic:
-                    it either succeeds or has no effect
-        e.g. push_back() for vector, insert() for assoc. cont.
-    Nothrow guarantee: the operation does not throw
-        e.g. pop_back() for vector, erase() for assoc. cont., swap()
+    template <bool Result>
+    struct awaiter
+    {
+        AsyncTask& t;
 
-It is possible that a push_back throws exception, but if it happens it's guaranteed that we keep the vectors old value before the push_back().
+        bool await_ready() const noexcept { return t.started && t.ready(); }
 
-In case of pop_back() it's guaranteed that it won't throw exception. That's the difference between nothrow guarantee and strong guarantee.
-*/
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) noexcept
+        {
+            std::uintptr_t me = reinterpret_cast<std::uintptr_t>(waiter.address());
+            if (!t.started)
+            {
+                t.started = true;
+                t.h.promise().state.store(me, std::memory_order_release);
+                return t.h;     // a lazy task starts here, without a new stack frame (symmetric transfer)
+            }
+            // after a successful exchange the waiter may already run on another thread, and *this is in its frame: no more t here
+            std::uintptr_t expected = running;
+            bool waits = t.h.promise().state.compare_exchange_strong(expected, me, std::memory_order_acq_rel, std::memory_order_acquire);
+            return waits ? std::noop_coroutine() : waiter;  // it finished in the meantime: go on
+        }
 
+        decltype(auto) await_resume()
+        {
+            if constexpr (Result)
+                return t.get();
+        }
+    };
 
+    handle h;
+    bool started = false;
+};
 
-// STRONG GUARANTEE EXAMPLE
+// co_await on(pool): the rest of the coroutine runs on a worker of the TaskPool from above
+inline auto on(TaskPool& pool) noexcept
+{
+    struct awaiter
+    {
+        TaskPool& pool;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { pool.submit([h] { h.resume(); }); }
+        void await_resume() const noexcept { }
+    };
+    return awaiter{ pool };
+}
 
+// starts every task, so they overlap, and waits for all of them. The values are in the order of the tasks, and if some of them
+// failed, the exception of the first one (in that order) is rethrown, like TaskPool::wait_all(first_failure)
 template <class T>
-class Vec
+AsyncTask<std::vector<T>> when_all(std::vector<AsyncTask<T>> tasks)
 {
-    // ...
-private:
-    size_t cap;
-    size_t sz;
-    T* v;
-};
+    for (AsyncTask<T>& t : tasks)
+        t.start();
+    for (AsyncTask<T>& t : tasks)
+        co_await t.when_ready();    // all of them, before anything is thrown: the frames can only be destroyed when they are done
+    std::vector<T> values;
+    values.reserve(tasks.size());
+    for (AsyncTask<T>& t : tasks)
+        values.push_back(t.get());
+    co_return values;
+}
 
-Vec<T>& Vec<T>::operator=(const Vec& rhs)
+struct detached_task    // a coroutine that nobody waits for, it destroys itself at the end
 {
-    if (this != &rhs)                          if (this != &rhs)
-    {                                          {
-        delete[] v;                              Vec tmp(rhs);
-        cap = sz = rhs.sz;                       cap = sz = tmp.sz;
-        v = new T[cap];                          std::swap(v, tmp.v);
-        for (size_t i = 0; i < cap; ++i)       }
-    v[i] = rhs.v[i];                           // tmp deleted here with the old buffer
-    }
-    return *this;                              return *this;
-}                                             }
+    struct promise_type
+    {
+        detached_task get_return_object() noexcept { return { }; }
+        std::suspend_never initial_suspend() noexcept { return { }; }
+        std::suspend_never final_suspend() noexcept { return { }; }
+        void return_void() noexcept { }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
 
-/*
-On the right hand we create a temporal object - in this case a class called Vec. Here in the temporal object we do the copying and if this copying cannot allocate the memory
-or the elements in the buffer throws exception it's not a problem because the temporal object will be terminated. If the copying is successfull then we do operations that are
-are noexcept guaranteed, like swap. The problem with the copying on the right hand side is that for a moment we will allocate double of the memory, so it will result in memory overhead.
+template <class T>
+detached_task signal_when_ready(AsyncTask<T>& t, std::mutex& m, std::condition_variable& cv, bool& ready)
+{
+    co_await t.when_ready();
+    std::lock_guard<std::mutex> lock(m);    // notify under the lock: sync_wait can not return before it is done
+    ready = true;
+    cv.notify_one();
+}
 
-That's the reason why not all the expressions are strong guaranteed, but only a few of those.
-*/
+// the bridge from normal code: blocks the calling thread until the task is done, then returns its value or rethrows
+template <class T>
+T sync_wait(AsyncTask<T> task)
+{
+    std::mutex m;
+    std::condition_variable cv;
+    bool ready = false;
+    signal_when_ready(task, m, cv, ready);
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&] { return ready; });
+    return task.get();
+}
 
+// open_file() from NESTED EXCEPTIONS as a coroutine: the open and the read run on the pool, the context is added the same way.
+// The parameters are by value, the coroutine frame keeps them (a reference could dangle after the first suspension)
+AsyncTask<std::size_t> read_file_async(TaskPool& pool, std::string s)
+{
+    co_await on(pool);
+    std::ifstream file;
+    try
+    {
+        file.open(s, std::ios::binary);
+        file.exceptions(std::ios_base::failbit);    // throws if the open failed, like open_file()
+    }
+    catch (...)
+    {
+        std::throw_with_nested(std::runtime_error("Couldn't open " + s));
+    }
+    file.exceptions(std::ios_base::badbit);         // the end of the file sets failbit too, only a read error throws
+    char buf[4096];
+    std::size_t n = 0;
+    while (file.read(buf, sizeof(buf)) || file.gcount())
+        n += file.gcount();
+    co_return n;
+}
 
+void f()
+{
+TaskPool pool(16); // threads that may block in open() and read()
+try
+{
+std::vector<AsyncTask<std::size_t>> reads;
+for (const std::string& name : names)
+reads.push_back(read_file_async(pool, name));
+std::vector<std::size_t> sizes = sync_wait(when_all(std::move(reads))); // the opens and the reads overlap
+}
+catch (const std::exception& e)
+{
+print_exception(e); // exception: Couldn't open nonexistent.file
+} //  exception: basic_ios::clear: iostream error
+}
 
-// EXCEPTION PTR
+// Basic example of a benchmark: open and read 10000 files, sequentially and with AsyncTask on pools of 4, 16 and 64 threads,
+// with a cold and a hot page cache (usage: bench dir; the cold runs need root for /proc/sys/vm/drop_caches)
 
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <numeric>
 #include <string>
-#include <exception>
-#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
 
-void handle_eptr(std::exception_ptr eptr) // passing by value is ok
+std::size_t read_file(const std::string& s)     // the same steps without the coroutine: open_file() + the read
 {
+    std::ifstream file;
     try
     {
-        if (eptr != std::exception_ptr())
-        {
-            std::rethrow_exception(eptr);
-        }
+        file.open(s, std::ios::binary);
+        file.exceptions(std::ios_base::failbit);
     }
-    catch (const std::exception& e)
+    catch (...)
     {
-        std::cout << "Caught exception \"" << e.what() << "\"\n";
+        std::throw_with_nested(std::runtime_error("Couldn't open " + s));
     }
+    file.exceptions(std::ios_base::badbit);
+    char buf[4096];
+    std::size_t n = 0;
+    while (file.read(buf, sizeof(buf)) || file.gcount())
+        n += file.gcount();
+    return n;
 }
 
-int main()
+AsyncTask<std::size_t> total_size(TaskPool& pool, const std::vector<std::string>& names)   // the caller keeps names alive
 {
-    std::exception_ptr eptr;
+    std::vector<AsyncTask<std::size_t>> reads;
+    reads.reserve(names.size());
+    for (const std::string& name : names)
+        reads.push_back(read_file_async(pool, name));
     try
     {
-        std::string().at(1); // this generates an std::out_of_range
+        std::vector<std::size_t> sizes = co_await when_all(std::move(reads));
+        co_return std::accumulate(sizes.begin(), sizes.end(), std::size_t(0));
     }
     catch (...)
     {
-        eptr = std::current_exception(); // capture
+        std::throw_with_nested(std::runtime_error("total_size() failed"));
     }
-
-    handle_eptr(eptr);
-} // destructor for std::out_of_range called here, when the eptr is destructed
-  // output: Caught exception "basic_string::at"
-
-
-
-// NESTED EXCEPTIONS
-
-void print_exception(const std::exception& e, int level = 0) // prints the string of an exception.
-{   // if nested, recurses
-    std::cerr << std::string(level, ' ') << "exception: " << e.what() << '\n';
-    try {
-        std::rethrow_if_nested(e);
-    } catch(const std::exception& e) {
-        print_exception(e, level + 1);
-    } catch(...) {}
 }
 
-void open_file(const std::string& s) // catches an exception and wraps it in a nested exception
+bool drop_caches()
 {
-    try {
-        std::ifstream file(s);
-        file.exceptions(std::ios_base::failbit);
-    } catch(...) {
-        std::throw_with_nested(std::runtime_error("Couldn't open " + s));
-    }
+    ::sync();
+    std::FILE* fp = std::fopen("/proc/sys/vm/drop_caches", "w");
+    if (!fp)
+        return false;
+    bool ok = std::fputs("3", fp) >= 0;
+    return std::fclose(fp) == 0 && ok;
 }
 
-void run() // sample function that catches an exception and wraps it in a nested exception
+int main(int argc, char* argv[])
 {
-    try {
-        open_file("nonexistent.file");
-    } catch(...) {
-        std::throw_with_nested(std::runtime_error("run() failed"));
+    std::string dir = std::string(argc > 1 ? argv[1] : "/tmp") + "/bench_files";
+    const int n_files = 10'000;
+    const std::size_t file_size = 8192;
+
+    ::mkdir(dir.c_str(), 0755);
+    std::vector<std::string> names;
+    std::string content(file_size, 'x');
+    for (int i = 0; i < n_files; ++i)
+    {
+        names.push_back(dir + "/file_" + std::to_string(i));
+        std::ofstream(names.back(), std::ios::binary) << content;
     }
-}
 
-int main() // runs the sample function above and prints the caught exception
-try { // exception: run() failed
-    run(); // exception: Couldn't open nonexistent file
-} catch(const std::exception& e) { // exception: basic_ios::clear
-    print_exception(e);
+    auto run = [&](const char* what, bool cold, auto read_all) {
+        if (cold && !drop_caches())
+        {
+            std::printf("%-26s (no permission to drop the page cache)\n", what);
+            return;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        std::size_t bytes = read_all();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        std::printf("%-26s %9.1f ms %9.1f us per file  (%zu MB)\n", what, ms, ms * 1000 / n_files, bytes >> 20);
+    };
+    auto sequential = [&] {
+        std::size_t bytes = 0;
+        for (const std::string& name : names)
+            bytes += read_file(name);
+        return bytes;
+    };
+
+    for (bool cold : { true, false })
+    {
+        std::printf("%s page cache:\n", cold ? "cold" : "hot");
+        run("  sequential", cold, sequential);
+        for (unsigned threads : { 4u, 16u, 64u })
+        {
+            TaskPool pool(threads);
+            std::string what = "  AsyncTask, " + std::to_string(threads) + " threads";
+            run(what.c_str(), cold, [&] { return sync_wait(total_size(pool, names)); });
+        }
+    }
+
+    names.insert(names.begin() + 5000, dir + "/nonexistent.file");
+    try
+    {
+        TaskPool pool(16);
+        sync_wait(total_size(pool, names));
+    }
+    catch (const std::exception& e)
+    {
+        print_exception(e);     // from NESTED EXCEPTIONS, to std::cerr
+    }
+    for (const std::string& name : names)
+        ::unlink(name.c_str());
+    ::rmdir(dir.c_str());
 }
 
 /*
-It is possible that we find some nested exceptions in real life systems, but it's rare. Even though, it's just good to know about them.
+TaskPool can run the reads in parallel, but the callable of a Task returns void, so the result and the context of an error have to go
+around it (task_error, the failure list). A coroutine keeps both in its frame. AsyncTask<T> is a coroutine that returns a T:
+    it is lazy, nothing runs until it is awaited or start() is called. co_await on(pool) moves the rest of the coroutine to a worker of
+    the pool, so a blocking open() and read() only block that worker
+    an exception that leaves the body is caught by unhandled_exception() and stored as an exception_ptr next to the value. co_await
+    rethrows it in the coroutine that waits, on whatever thread that one runs. It is the same object, so a throw_with_nested chain
+    arrives with all of its levels, and the next level can add its own context with throw_with_nested again (total_size() below)
+    the task and the waiter race at the end: the task may finish while the waiter is just starting to wait. One atomic word decides it,
+    it holds "running", "done" or the address of the waiting coroutine. Whoever comes second resumes the waiter. The awaiter must not
+    touch its own members after it published the waiter, because the waiter may already run on another thread and reuse that memory
+    (ThreadSanitizer found this in my first version)
+    when_all() starts every task first and only then waits, that is where the overlap comes from. It waits for all of them even if one
+    failed, because a frame that still runs on a worker can not be destroyed, then rethrows the first failure (like first_failure)
+    sync_wait() is the way out of the coroutines for main(): it blocks on a condition variable until the task is done
+
+The benchmark writes 10000 files of 8 KB to an ext4 disk, then reads them all with read_file() (open_file() and the same read loop,
+one file after the other) and with total_size() on pools of 4, 16 and 64 threads. For the cold rows the page cache is dropped before
+the run (it needs root). The output on my machine (g++ 12 -O2, one core, a virtual disk):
+
+    cold page cache:
+      sequential                   491.4 ms      49.1 us per file  (78 MB)
+      AsyncTask, 4 threads         301.2 ms      30.1 us per file  (78 MB)
+      AsyncTask, 16 threads        241.1 ms      24.1 us per file  (78 MB)
+      AsyncTask, 64 threads        249.3 ms      24.9 us per file  (78 MB)
+    hot page cache:
+      sequential                    51.8 ms       5.2 us per file  (78 MB)
+      AsyncTask, 4 threads          85.4 ms       8.5 us per file  (78 MB)
+      AsyncTask, 16 threads         85.7 ms       8.6 us per file  (78 MB)
+      AsyncTask, 64 threads        100.3 ms      10.0 us per file  (78 MB)
+    exception: total_size() failed
+     exception: Couldn't open /tmp/bench_files/nonexistent.file
+      exception: basic_ios::clear: iostream error
+
+With a cold cache most of the time is waiting for the disk, and the threads wait at the same time, so the coroutines are 1.5-2x faster
+even on one core. It is noisy: in other runs the sequential read took 360-560 ms and the best pool size changed between 4 and 16. With a
+hot cache there is nothing to wait for, open() and read() are just CPU work, and one core can not do more of it with more threads. The
+coroutine frames, the queue of the pool and the context switches cost 3-5 us per file. With more cores the hot case would scale too,
+but on this machine the honest result is: coroutines on a pool are for I/O that really waits.
+
+The last three lines are the file in the middle that does not exist. The error happened on a worker, was stored in the frame of
+read_file_async(), rethrown in when_all(), wrapped by total_size() on another worker, and rethrown again by sync_wait() in main(). All
+three levels are there.
 */